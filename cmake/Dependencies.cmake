@@ -65,6 +65,11 @@ include_directories(SYSTEM ${OpenCV_INCLUDE_DIRS})
 list(APPEND Caffe_LINKER_LIBS ${OpenCV_LIBS})
 message(STATUS "OpenCV found (${OpenCV_CONFIG_PATH})")
 
+# ---[ JPEG
+find_package(JPEG REQUIRED)
+include_directories(SYSTEM ${JPEG_INCLUDE_DIR})
+list(APPEND Caffe_LINKER_LIBS ${JPEG_LIBRARIES})
+
 # ---[ BLAS
 if(NOT APPLE)
   set(BLAS "Atlas" CACHE STRING "Selected BLAS library")
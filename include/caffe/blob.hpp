@@ -226,6 +226,14 @@ class Blob {
   Dtype* mutable_gpu_data();
   Dtype* mutable_cpu_diff();
   Dtype* mutable_gpu_diff();
+  /**
+   * @brief Write-only access to the data, for callers that overwrite all of
+   *        it. Skips zero-filling new memory and copying from the GPU, see
+   *        SyncedMemory::mutable_cpu_data_discard.
+   */
+  Dtype* mutable_cpu_data_discard();
+  /// @brief Write-only access to the diff, like mutable_cpu_data_discard.
+  Dtype* mutable_cpu_diff_discard();
   void Update();
   void FromProto(const BlobProto& proto, bool reshape = true);
   void ToProto(BlobProto* proto, bool write_diff = false) const;
@@ -154,6 +154,16 @@ class Caffe {
   inline static void set_solver_count(int val) { Get().solver_count_ = val; }
   inline static bool root_solver() { return Get().root_solver_; }
   inline static void set_root_solver(bool val) { Get().root_solver_ = val; }
+  // Multi-process training info, one solver process per rank
+  inline static int process_count() { return Get().process_count_; }
+  inline static void set_process_count(int val) { Get().process_count_ = val; }
+  inline static int process_rank() { return Get().process_rank_; }
+  inline static void set_process_rank(int val) { Get().process_rank_ = val; }
+  // A seed equal in all processes, e.g. to shuffle a source alike in each
+  inline static unsigned int process_seed() { return Get().process_seed_; }
+  inline static void set_process_seed(unsigned int val) {
+    Get().process_seed_ = val;
+  }
 
  protected:
 #ifndef CPU_ONLY
@@ -165,6 +175,9 @@ class Caffe {
   Brew mode_;
   int solver_count_;
   bool root_solver_;
+  int process_count_;
+  int process_rank_;
+  unsigned int process_seed_;
 
  private:
   // The private constructor to avoid duplicate instantiation.
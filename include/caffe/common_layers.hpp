@@ -12,6 +12,7 @@
 #include "caffe/loss_layers.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/sparse_matrix.hpp"
 
 namespace caffe {
 
@@ -300,7 +301,7 @@ template <typename Dtype>
 class InnerProductLayer : public Layer<Dtype> {
  public:
   explicit InnerProductLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), output_bias_version_(0), packed_version_(0) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -320,11 +321,33 @@ class InnerProductLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // At test time, batches of up to kSmallBatch rows skip gemm for a kernel
+  // reading the weights packed in panels of kPanel outputs, interleaved so
+  // each input value is multiplied by a contiguous run of weights.
+  static const int kSmallBatch = 4;
+  static const int kPanel = 8;
+  void PackWeights();
+  void Forward_cpu_small(const Dtype* bottom_data, Dtype* top_data);
+  // The bias added to the outputs, scaled and shifted by output_scale_ and
+  // output_shift_, or NULL if there is none.
+  const Blob<Dtype>* output_bias();
+
   int M_;
   int K_;
   int N_;
   bool bias_term_;
+  Dtype output_scale_;
+  Dtype output_shift_;
   Blob<Dtype> bias_multiplier_;
+  Blob<Dtype> output_bias_;
+  // The bias output_bias_ was folded from, folded again when it changes
+  shared_ptr<SyncedMemory> output_bias_source_;
+  unsigned int output_bias_version_;
+  Blob<Dtype> packed_weights_;
+  SparseWeights<Dtype> sparse_weights_;
+  // The weights packed_weights_ was made from, repacked when they change
+  shared_ptr<SyncedMemory> packed_source_;
+  unsigned int packed_version_;
 };
 
 /**
@@ -10,6 +10,8 @@
 #include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
 
+namespace boost { class mutex; }
+
 namespace caffe {
 
 /**
@@ -18,7 +20,8 @@ namespace caffe {
  * are running in parallel, e.g. for multi-GPU training. This makes sure
  * databases are read sequentially, and that each solver accesses a different
  * subset of the database. Data is distributed to solvers in a round-robin
- * way to keep parallel training deterministic.
+ * way to keep parallel training deterministic. Sharded sources are read by
+ * a thread per shard, and their records interleaved.
  */
 class DataReader {
  public:
@@ -32,6 +35,21 @@ class DataReader {
     return queue_pair_->full_;
   }
 
+  /// @brief Read throughput of a source, summed over its shards.
+  struct ReadStats {
+    ReadStats() : records(0), bytes(0), seconds(0) { }
+    inline double megabytes_per_second() const {
+      return seconds ? bytes / seconds / 1e6 : 0;
+    }
+
+    uint64_t records;
+    uint64_t bytes;
+    // Spent in the database and parsing, not waiting for free datums
+    double seconds;
+  };
+  /// @brief What the source of this reader has read so far.
+  ReadStats read_stats() const;
+
  protected:
   // Queue pairs are shared between a body and its readers
   class QueuePair {
@@ -45,6 +63,32 @@ class DataReader {
   DISABLE_COPY_AND_ASSIGN(QueuePair);
   };
 
+  class Body;
+
+  // Parses the records of one database of a source, in a loop, from memory
+  // after the first pass if they are cached
+  class Shard : public InternalThread {
+   public:
+    Shard(const LayerParameter& param, const string& source, int size,
+        size_t cache_size, unsigned int seed, Body* body);
+    virtual ~Shard();
+
+    QueuePair queue_pair_;
+
+   protected:
+    void InternalThreadEntry();
+
+    const LayerParameter param_;
+    const string source_;
+    // Bytes of memory to cache the records in
+    const size_t cache_size_;
+    // Seeds the random orders of the records
+    const unsigned int seed_;
+    Body* body_;
+
+  DISABLE_COPY_AND_ASSIGN(Shard);
+  };
+
   // A single body is created per source
   class Body : public InternalThread {
    public:
@@ -53,10 +97,20 @@ class DataReader {
 
    protected:
     void InternalThreadEntry();
-    void read_one(db::Cursor* cursor, QueuePair* qp);
+    void read_one(QueuePair* qp);
+    void next();
+    void add_stats(const ReadStats& stats);
 
     const LayerParameter param_;
     BlockingQueue<shared_ptr<QueuePair> > new_queue_pairs_;
+    // Records to skip after each read, for multi-process training
+    int skip_;
+    // Added to by the shards, read by the readers
+    ReadStats stats_;
+    shared_ptr<boost::mutex> stats_mutex_;
+    // The shards read, and the one the next record comes from
+    vector<shared_ptr<Shard> > shards_;
+    int shard_;
 
     friend class DataReader;
 
@@ -39,7 +39,10 @@ class DataTransformer {
 
   /**
    * @brief Applies the transformation defined in the data layer's
-   * transform_param block to a vector of Datum.
+   * transform_param block to a vector of Datum, on up to batch_threads
+   * threads.
+   * Each item draws from its own random stream, so the result does not
+   * depend on the number of threads.
    *
    * @param datum_vector
    *    A vector of Datum containing the data to be transformed.
@@ -52,7 +55,8 @@ class DataTransformer {
 
   /**
    * @brief Applies the transformation defined in the data layer's
-   * transform_param block to a vector of Mat.
+   * transform_param block to a vector of Mat, on up to batch_threads
+   * threads.
    *
    * @param mat_vector
    *    A vector of Mat containing the data to be transformed.
@@ -133,8 +137,30 @@ class DataTransformer {
    *    A uniformly random integer value from ({0, 1, ..., n-1}).
    */
   virtual int Rand(int n);
+  // Draws from rng instead of rng_, for items transformed concurrently
+  int Rand(int n, Caffe::RNG* rng);
+
+  void Transform(const Datum& datum, Dtype* transformed_data,
+      Caffe::RNG* rng);
+  void Transform(const Datum& datum, Blob<Dtype>* transformed_blob,
+      Caffe::RNG* rng);
+  void Transform(const cv::Mat& cv_img, Blob<Dtype>* transformed_blob,
+      Caffe::RNG* rng);
+  // Checks there are one mean value or one per channel, and replicates a
+  // single one, before items are transformed concurrently
+  void CheckMeanValues(int channels);
+  // Transforms each input to an item of transformed_blob, with a random
+  // stream seeded from rng_, in up to batch_threads chunks run on
+  // TaskGraph::Shared()
+  template <typename Input>
+  void TransformBatch(const vector<Input>& inputs,
+      Blob<Dtype>* transformed_blob);
+  // Transforms the items of the chunk-th of chunks equal ranges of inputs
+  template <typename Input>
+  void TransformChunk(const vector<Input>* inputs,
+      Blob<Dtype>* transformed_blob, Dtype* transformed_data,
+      const vector<unsigned int>* seeds, int chunks, int chunk);
 
-  void Transform(const Datum& datum, Dtype* transformed_data);
   // Tranformation parameters
   TransformationParameter param_;
 
@@ -43,7 +43,8 @@ class InternalThread {
 
  private:
   void entry(int device, Caffe::Brew mode, int rand_seed, int solver_count,
-      bool root_solver);
+      bool root_solver, int process_count, int process_rank,
+      unsigned int process_seed);
 
   shared_ptr<boost::thread> thread_;
 };
@@ -11,6 +11,8 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/mapped_weights.hpp"
+#include "caffe/util/task_graph.hpp"
 
 namespace caffe {
 
@@ -26,6 +28,16 @@ class Net {
   explicit Net(const NetParameter& param, const Net* root_net = NULL);
   explicit Net(const string& param_file, Phase phase,
       const Net* root_net = NULL);
+  /**
+   * @brief Creates an inference replica of weights_net: a net with its own
+   *        layers and activations, whose parameters share the data of the
+   *        same-named layers of weights_net instead of being allocated and
+   *        initialized. Replicas do not share layers, so they can run
+   *        Forward concurrently, e.g. one per thread, without locking.
+   *        Weights must not be modified while replicas are in use, and
+   *        weights_net must outlive its replicas.
+   */
+  Net(const NetParameter& param, const Net& weights_net);
   virtual ~Net() {}
 
   /// @brief Initialize a network with a NetParameter.
@@ -114,10 +126,20 @@ class Net {
   void CopyTrainedLayersFrom(const string trained_filename);
   void CopyTrainedLayersFromBinaryProto(const string trained_filename);
   void CopyTrainedLayersFromHDF5(const string trained_filename);
+  /**
+   * @brief Points the layers' blobs at weights memory-mapped from a file
+   *        written by ToMappedWeights or WriteMappedWeights, instead of
+   *        copying them. Blobs can still be modified, copying the pages
+   *        written to, but remain mapped until the net is destroyed, so
+   *        nets sharing them must not outlive it.
+   */
+  void CopyTrainedLayersFromMapped(const string trained_filename);
   /// @brief Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false) const;
   /// @brief Writes the net to an HDF5 file.
   void ToHDF5(const string& filename, bool write_diff = false) const;
+  /// @brief Writes the net weights to a file that can be memory-mapped.
+  void ToMappedWeights(const string& filename) const;
 
   /// @brief returns the network name.
   inline const string& name() const { return name_; }
@@ -149,6 +171,18 @@ class Net {
   inline const vector<vector<Blob<Dtype>*> >& top_vecs() const {
     return top_vecs_;
   }
+  /// @brief returns the ids of the top blobs of layer i
+  inline const vector<int>& top_ids(int i) const {
+    CHECK_GE(i, 0) << "Invalid layer id";
+    CHECK_LT(i, top_id_vecs_.size()) << "Invalid layer id";
+    return top_id_vecs_[i];
+  }
+  /// @brief returns the ids of the bottom blobs of layer i
+  inline const vector<int>& bottom_ids(int i) const {
+    CHECK_GE(i, 0) << "Invalid layer id";
+    CHECK_LT(i, bottom_id_vecs_.size()) << "Invalid layer id";
+    return bottom_id_vecs_[i];
+  }
   inline const vector<vector<bool> >& bottom_need_backward() const {
     return bottom_need_backward_;
   }
@@ -200,6 +234,12 @@ class Net {
   const shared_ptr<Layer<Dtype> > layer_by_name(const string& layer_name) const;
 
   void set_debug_info(const bool value) { debug_info_ = value; }
+  /**
+   * @brief Sets the number of threads running independent layers
+   *        concurrently in CPU mode, 1 to run layers one after another.
+   */
+  void set_branch_threads(int threads);
+  inline int branch_threads() const { return branch_threads_; }
 
   // Helpers for Init.
   /**
@@ -211,6 +251,18 @@ class Net {
   /// @brief return whether NetState state meets NetStateRule rule
   static bool StateMeetsRule(const NetState& state, const NetStateRule& rule,
       const string& layer_name);
+  /**
+   * @brief Remove Power layers with power 1 whose input is only used by
+   *        them and computed by a Convolution or InnerProduct layer, which
+   *        then scales and shifts its outputs instead.
+   */
+  static void FoldAffineLayers(const NetParameter& param,
+      NetParameter* param_folded);
+  /**
+   * @brief Remove layers which the blobs listed in the output field of param
+   *        do not depend on.
+   */
+  static void PruneNet(const NetParameter& param, NetParameter* param_pruned);
 
  protected:
   // Helpers for Init.
@@ -225,6 +277,20 @@ class Net {
   /// @brief Append a new parameter blob to the net.
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
+  /// @brief Shares a layer's parameters with weights_net_ before its setup.
+  void ShareReplicaWeights(int layer_id);
+
+  /**
+   * @brief Finds for each layer the later layers that must wait for it,
+   *        as they read blobs it writes or write blobs it reads or writes.
+   */
+  void InitLayerGraph();
+  /// @brief Runs layers start to end on the branch threads.
+  Dtype ForwardConcurrent(int start, int end);
+  /// @brief Runs layers start down to end on the branch threads.
+  void BackwardConcurrent(int start, int end);
+  void ForwardLayer(int start, int index, vector<Dtype>* losses);
+  void BackwardLayer(int end, int index);
 
   /// @brief Helper for displaying debug info in Forward about input Blobs.
   void InputDebugInfo(const int layer_id);
@@ -292,8 +358,17 @@ class Net {
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Threads running independent layers, and the layers waiting for each
+  int branch_threads_;
+  shared_ptr<TaskGraph> task_graph_;
+  vector<vector<int> > layer_dependents_;
+  vector<vector<int> > layer_dependencies_;
   /// The root net that actually holds the shared layers in data parallelism
   const Net* const root_net_;
+  /// The net whose weights are shared by this replica, if any
+  const Net* const weights_net_;
+  /// Memory-mapped weight files the blobs may point to
+  vector<shared_ptr<MappedWeights> > mapped_weights_;
   DISABLE_COPY_AND_ASSIGN(Net);
 };
 
@@ -0,0 +1,60 @@
+#ifndef CAFFE_NET_BUCKETS_HPP_
+#define CAFFE_NET_BUCKETS_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Runs a net on inputs of varying shapes, e.g. images of many sizes
+ *        in a fully convolutional net, without reshaping per input.
+ *
+ * An inference replica of weights_net is set up for each bucket shape of the
+ * first input, once, so layer configurations and buffers are computed ahead
+ * and each bucket holds memory for its own shape only, instead of blobs
+ * growing to the largest input ever seen. An input runs in the smallest
+ * bucket that holds it, zero padded at the end of each axis; the caller
+ * crops outputs as needed. Other inputs keep the shapes of the param.
+ *
+ * Buckets are not locked, use one NetBuckets per thread.
+ */
+template <typename Dtype>
+class NetBuckets {
+ public:
+  NetBuckets(const NetParameter& param, const Net<Dtype>& weights_net,
+      const vector<vector<int> >& shapes);
+  virtual ~NetBuckets() {}
+
+  /**
+   * @brief Returns the index of the smallest bucket holding an input of the
+   *        given shape, or -1 if none does.
+   */
+  int Find(const vector<int>& shape) const;
+  /**
+   * @brief Copies input to the first input blob of its bucket, padding it
+   *        with zeros, and runs Forward in that bucket.
+   */
+  const vector<Blob<Dtype>*>& Forward(const Blob<Dtype>& input,
+      int* bucket = NULL);
+
+  inline int size() const { return nets_.size(); }
+  inline const vector<int>& shape(int i) const { return shapes_[i]; }
+  inline Net<Dtype>* net(int i) const { return nets_[i].get(); }
+  /// @brief Bytes of the blobs of a bucket, allocated once at setup.
+  size_t memory_used(int i) const;
+
+ protected:
+  vector<vector<int> > shapes_;
+  vector<shared_ptr<Net<Dtype> > > nets_;
+
+  DISABLE_COPY_AND_ASSIGN(NetBuckets);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_NET_BUCKETS_HPP_
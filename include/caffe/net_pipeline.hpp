@@ -0,0 +1,84 @@
+#ifndef CAFFE_NET_PIPELINE_HPP_
+#define CAFFE_NET_PIPELINE_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Runs a net for inference as a pipeline: the layers are split in
+ *        consecutive stages, each running on its own thread, so successive
+ *        micro-batches are processed by different stages at the same time.
+ *
+ * Each stage runs its layers in an inference replica of weights_net. Blobs
+ * passed between stages travel in micro-batch buffers, copied in and out of
+ * the stage replicas. The number of micro-batches in
+ * flight is bounded, Push blocks when all are in use. Outputs are returned
+ * by Pop in the order inputs were pushed. Push and Pop must be called from
+ * a single thread, or from one producer and one consumer thread.
+ */
+template <typename Dtype>
+class NetPipeline {
+ public:
+  /**
+   * @brief Splits the layers in the given number of stages, balancing the
+   *        forward times measured on the net. If pin_cores is set, each
+   *        stage thread is bound to its share of the CPU cores.
+   */
+  NetPipeline(const NetParameter& param, const Net<Dtype>& weights_net,
+      int stages, bool pin_cores = false);
+  /// @brief Stage i starts at layer starts[i], starts[0] must be 0.
+  NetPipeline(const NetParameter& param, const Net<Dtype>& weights_net,
+      const vector<int>& starts, bool pin_cores = false);
+  virtual ~NetPipeline();
+
+  /// @brief Copies inputs, shaped like the net inputs, into the pipeline.
+  void Push(const vector<Blob<Dtype>*>& inputs);
+  /// @brief Waits for the oldest micro-batch and copies the net outputs.
+  void Pop(const vector<Blob<Dtype>*>& outputs);
+
+  inline int stages() const { return starts_.size(); }
+  /// @brief The first layer of each stage.
+  inline const vector<int>& starts() const { return starts_; }
+
+  /// @brief Forward time of each layer in ms, averaged over iterations.
+  static vector<double> Profile(Net<Dtype>* net, int iterations);
+  /**
+   * @brief Splits consecutive costs in the given number of non-empty
+   *        ranges, minimizing the largest sum. Returns the range starts.
+   */
+  static vector<int> Partition(const vector<double>& costs, int stages);
+
+  class MicroBatch {
+   public:
+    // Indexed like the net blobs, set for inputs, outputs and blobs
+    // passed between stages
+    vector<shared_ptr<Blob<Dtype> > > blobs_;
+  };
+
+ protected:
+  class Stage;
+
+  void Init(const NetParameter& param, const Net<Dtype>& weights_net,
+      bool pin_cores);
+
+  vector<int> starts_;
+  vector<shared_ptr<Net<Dtype> > > nets_;
+  vector<shared_ptr<Stage> > stages_;
+  vector<shared_ptr<MicroBatch> > batches_;
+  // queues_[i] feeds stage i, the last one holds finished micro-batches
+  vector<shared_ptr<BlockingQueue<MicroBatch*> > > queues_;
+  BlockingQueue<MicroBatch*> free_;
+
+  DISABLE_COPY_AND_ASSIGN(NetPipeline);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_NET_PIPELINE_HPP_
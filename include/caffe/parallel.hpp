@@ -2,7 +2,9 @@
 #define CAFFE_PARALLEL_HPP_
 
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <stdint.h>
 
+#include <string>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -59,6 +61,21 @@ class GPUParams : public Params<Dtype> {
   using Params<Dtype>::diff_;
 };
 
+// Params stored in host memory.
+template<typename Dtype>
+class CPUParams : public Params<Dtype> {
+ public:
+  explicit CPUParams(shared_ptr<Solver<Dtype> > root_solver);
+  virtual ~CPUParams();
+
+  void configure(Solver<Dtype>* solver) const;
+
+ protected:
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
 class DevicePair {
  public:
   DevicePair(int parent, int device)
@@ -113,6 +130,114 @@ class P2PSync : public GPUParams<Dtype>, public Solver<Dtype>::Callback,
   using Params<Dtype>::diff_;
 };
 
+// Ring of processes connected by stream sockets, either TCP or Unix-domain.
+// Each rank listens on its own endpoint, connects to the next rank and
+// accepts a connection from the previous one. Endpoints are given as
+// "tcp://host:port" or "unix:path".
+class SocketRing {
+ public:
+  SocketRing(const vector<string>& endpoints, int rank);
+  virtual ~SocketRing();
+
+  inline int rank() const {
+    return rank_;
+  }
+  inline int size() const {
+    return size_;
+  }
+
+  // Sums buffers of all ranks in place, using a ring all-reduce: a
+  // reduce-scatter followed by an all-gather, so each rank sends and receives
+  // 2 * (size - 1) / size times the buffer size.
+  template<typename Dtype>
+  void allreduce(Dtype* buffer, size_t count);
+
+  // Same as allreduce, but values are sent in half precision, halving the
+  // bytes on the wire. Partial sums are accumulated in Dtype, and the result
+  // is rounded to half precision identically on all ranks.
+  template<typename Dtype>
+  void allreduce_half(Dtype* buffer, size_t count);
+
+  // Concatenates the send buffers of all ranks, in rank order, into recv,
+  // which must hold size * bytes.
+  void allgather(const void* send, size_t bytes, void* recv);
+
+  // Copies rank 0's buffer to all other ranks.
+  void broadcast(void* buffer, size_t bytes);
+
+  // Total bytes sent by this rank since construction.
+  inline uint64_t bytes_sent() const {
+    return bytes_sent_;
+  }
+
+  // Expands a list of endpoints separated by ',' to one endpoint per rank.
+  // If a single endpoint is given, rank i uses port + i for TCP, or
+  // path.i for Unix-domain sockets. A count of 0 takes the number of
+  // processes from the list.
+  static void expand(const string& spec, int count, vector<string>* endpoints);
+
+ protected:
+  // Sends to the next rank while receiving from the previous one.
+  void exchange(const void* send, size_t send_bytes,
+                void* recv, size_t recv_bytes);
+
+  const int rank_;
+  const int size_;
+  int listen_;
+  int next_;
+  int prev_;
+  string unix_path_;
+  vector<char> buffer_;
+  vector<char> decoded_;
+  vector<uint16_t> half_;
+  uint64_t bytes_sent_;
+
+DISABLE_COPY_AND_ASSIGN(SocketRing);
+};
+
+// Synchronous data parallelism between processes, e.g. several 'caffe train'
+// processes on one or more hosts. Each process runs a full solver, gradients
+// are summed over a SocketRing and every process applies the same update.
+// Gradients can be compressed before being sent, see
+// SolverParameter.gradient_compression.
+template<typename Dtype>
+class SocketSync : public CPUParams<Dtype>, public Solver<Dtype>::Callback {
+ public:
+  SocketSync(shared_ptr<Solver<Dtype> > root_solver,
+             const vector<string>& endpoints, int rank);
+  virtual ~SocketSync() {
+  }
+
+  inline const shared_ptr<Solver<Dtype> >& solver() const {
+    return solver_;
+  }
+
+  void run();
+
+ protected:
+  void on_start();
+  void on_gradients_ready();
+
+  // Sums the top-k values of each rank, keeping the others in residual_.
+  void allreduce_topk();
+
+  shared_ptr<Solver<Dtype> > solver_;
+  SocketRing ring_;
+  const SolverParameter_GradientCompression compression_;
+  // Gradient not sent yet by top-k compression
+  vector<Dtype> residual_;
+  vector<int> indices_;
+  vector<char> sparse_;
+  vector<char> gathered_;
+  // For logging the bytes sent per iteration
+  int reported_iter_;
+  uint64_t reported_bytes_;
+
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
 }  // namespace caffe
 
 #endif
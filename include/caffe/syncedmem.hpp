@@ -4,6 +4,7 @@
 #include <cstdlib>
 
 #include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -13,6 +14,7 @@ namespace caffe {
 // The improvement in performance seems negligible in the single GPU case,
 // but might be more significant for parallel training. Most importantly,
 // it improved stability for large models on many GPUs.
+// In CPU mode, blocks come from the caching HostAllocator, 64-byte aligned.
 inline void CaffeMallocHost(void** ptr, size_t size) {
 #ifndef CPU_ONLY
   if (Caffe::mode() == Caffe::GPU) {
@@ -20,8 +22,7 @@ inline void CaffeMallocHost(void** ptr, size_t size) {
     return;
   }
 #endif
-  *ptr = malloc(size);
-  CHECK(*ptr) << "host allocation of size " << size << " failed";
+  *ptr = HostAllocator::Get().Allocate(size);
 }
 
 inline void CaffeFreeHost(void* ptr) {
@@ -31,7 +32,7 @@ inline void CaffeFreeHost(void* ptr) {
     return;
   }
 #endif
-  free(ptr);
+  HostAllocator::Get().Free(ptr);
 }
 
 
@@ -45,10 +46,12 @@ class SyncedMemory {
  public:
   SyncedMemory()
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(0), head_(UNINITIALIZED),
-        own_cpu_data_(false), own_gpu_data_(false), gpu_device_(-1) {}
+        own_cpu_data_(false), own_gpu_data_(false), gpu_device_(-1),
+        version_(0) {}
   explicit SyncedMemory(size_t size)
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
-        own_cpu_data_(false), own_gpu_data_(false), gpu_device_(-1) {}
+        own_cpu_data_(false), own_gpu_data_(false), gpu_device_(-1),
+        version_(0) {}
   ~SyncedMemory();
   const void* cpu_data();
   void set_cpu_data(void* data);
@@ -56,9 +59,27 @@ class SyncedMemory {
   void set_gpu_data(void* data);
   void* mutable_cpu_data();
   void* mutable_gpu_data();
+  /**
+   * @brief Like mutable_cpu_data, for callers that overwrite every byte:
+   *        the memory is neither zero-filled on first use nor copied from
+   *        the GPU, so its content is undefined.
+   */
+  void* mutable_cpu_data_discard();
+  /**
+   * @brief Fill the memory returned by mutable_cpu_data_discard with NaNs,
+   *        so reads of values a caller failed to write show up in outputs.
+   *        On by default in DEBUG builds.
+   */
+  static void set_poison(bool poison) { poison_ = poison; }
+  static bool poison() { return poison_; }
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
   SyncedHead head() { return head_; }
   size_t size() { return size_; }
+  /**
+   * @brief Incremented each time the memory is handed out for writing or
+   *        replaced, so caches derived from the data can tell it changed.
+   */
+  unsigned int version() const { return version_; }
 
 #ifndef CPU_ONLY
   void async_gpu_push(const cudaStream_t& stream);
@@ -74,6 +95,8 @@ class SyncedMemory {
   bool own_cpu_data_;
   bool own_gpu_data_;
   int gpu_device_;
+  unsigned int version_;
+  static bool poison_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
@@ -0,0 +1,60 @@
+#ifndef CAFFE_UTIL_DATUM_CACHE_HPP_
+#define CAFFE_UTIL_DATUM_CACHE_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Keeps datums in memory up to a capacity, packed one after the other
+ *        in large blocks, so that sources read more than once are read,
+ *        parsed and decoded only once.
+ *
+ * Non-encoded datums are stored as raw records, compactly and without the
+ * cost of a protobuf parse to get them back. Encoded ones are stored
+ * serialized.
+ */
+class DatumCache {
+ public:
+  explicit DatumCache(size_t capacity);
+
+  /**
+   * @brief Appends a datum, or returns false and leaves the cache as is if
+   *        it does not fit in the capacity left.
+   */
+  bool Add(const Datum& datum);
+  /// @brief Reads back the i-th datum added.
+  void Get(size_t i, Datum* datum) const;
+  /// @brief The bytes taken by the i-th datum.
+  inline size_t bytes(size_t i) const { return records_[i].size; }
+  void Clear();
+
+  inline size_t size() const { return records_.size(); }
+  /// @brief The memory allocated, at most the capacity.
+  inline size_t allocated() const { return allocated_; }
+
+ protected:
+  struct Record {
+    const char* data;
+    size_t size;
+  };
+
+  const size_t capacity_;
+  // Records are appended to the last block while they fit
+  vector<shared_ptr<vector<char> > > blocks_;
+  size_t block_used_;
+  size_t allocated_;
+  vector<Record> records_;
+  // The record being added
+  string record_;
+
+  DISABLE_COPY_AND_ASSIGN(DatumCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DATUM_CACHE_HPP_
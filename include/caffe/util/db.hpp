@@ -2,6 +2,7 @@
 #define CAFFE_UTIL_DB_HPP
 
 #include <string>
+#include <vector>
 
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
@@ -19,6 +20,12 @@ class Cursor {
   virtual string key() = 0;
   virtual string value() = 0;
   virtual bool valid() = 0;
+  /**
+   * @brief Hints that the cursor moves forward from here on, for backends
+   *        to have the kernel read about this many bytes ahead of it.
+   *        0 stops the hints.
+   */
+  virtual void set_readahead(size_t bytes) { }
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
 };
@@ -48,6 +55,13 @@ class DB {
 DB* GetDB(DataParameter::DB backend);
 DB* GetDB(const string& backend);
 
+/**
+ * @brief The databases a source names. "path@N" names N shards, from
+ *        path-00000-of-0000N to path-0000(N-1)-of-0000N, which store records
+ *        0, N, 2N... to N-1, 2N-1, 3N-1... Other sources name one database.
+ */
+vector<string> ShardNames(const string& source);
+
 }  // namespace db
 }  // namespace caffe
 
@@ -56,7 +56,11 @@ class LevelDB : public DB {
     }
   }
   virtual LevelDBCursor* NewCursor() {
-    return new LevelDBCursor(db_->NewIterator(leveldb::ReadOptions()));
+    // Cursors scan the database once per pass, its blocks are not worth
+    // keeping in the block cache
+    leveldb::ReadOptions options;
+    options.fill_cache = false;
+    return new LevelDBCursor(db_->NewIterator(options));
   }
   virtual LevelDBTransaction* NewTransaction() {
     return new LevelDBTransaction(db_);
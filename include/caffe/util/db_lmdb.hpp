@@ -16,7 +16,9 @@ inline void MDB_CHECK(int mdb_status) {
 class LMDBCursor : public Cursor {
  public:
   explicit LMDBCursor(MDB_txn* mdb_txn, MDB_cursor* mdb_cursor)
-    : mdb_txn_(mdb_txn), mdb_cursor_(mdb_cursor), valid_(false) {
+    : mdb_txn_(mdb_txn), mdb_cursor_(mdb_cursor), valid_(false),
+      readahead_(0), map_end_(NULL), advised_begin_(NULL),
+      advised_end_(NULL) {
     SeekToFirst();
   }
   virtual ~LMDBCursor() {
@@ -33,6 +35,7 @@ class LMDBCursor : public Cursor {
         mdb_value_.mv_size);
   }
   virtual bool valid() { return valid_; }
+  virtual void set_readahead(size_t bytes);
 
  private:
   void Seek(MDB_cursor_op op) {
@@ -42,13 +45,23 @@ class LMDBCursor : public Cursor {
     } else {
       MDB_CHECK(mdb_status);
       valid_ = true;
+      if (readahead_) {
+        Advise();
+      }
     }
   }
+  // Asks the kernel for the map pages past the current value
+  void Advise();
 
   MDB_txn* mdb_txn_;
   MDB_cursor* mdb_cursor_;
   MDB_val mdb_key_, mdb_value_;
   bool valid_;
+  size_t readahead_;
+  // The end of the pages in use in the map, and the range last advised
+  char* map_end_;
+  char* advised_begin_;
+  char* advised_end_;
 };
 
 class LMDBTransaction : public Transaction {
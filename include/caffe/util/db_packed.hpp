@@ -0,0 +1,104 @@
+#ifndef CAFFE_UTIL_DB_PACKED_HPP
+#define CAFFE_UTIL_DB_PACKED_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/util/db.hpp"
+
+namespace caffe { namespace db {
+
+/**
+ * @brief Write-once databases of records appended to a single pack file,
+ *        with an index of their offsets for random access.
+ *
+ * A source is a directory holding "data", records of a little-endian uint32
+ * key length, the key, a uint32 value length and the value, and "index",
+ * the uint64 offset of each record. Records are kept in the order they are
+ * put, keys are not sorted nor looked up.
+ */
+class PackedCursor : public Cursor {
+ public:
+  PackedCursor(const string& data,
+      const shared_ptr<const vector<uint64_t> >& offsets);
+  virtual ~PackedCursor();
+  virtual void SeekToFirst() { Seek(0); }
+  virtual void Next() { Seek(record_ + 1); }
+  virtual string key() { return key_; }
+  virtual string value() { return value_; }
+  virtual bool valid() { return record_ < offsets_->size(); }
+  virtual void set_readahead(size_t bytes);
+
+  /// @brief Moves to the record with this index, in constant time.
+  void Seek(size_t record);
+  inline size_t record() const { return record_; }
+  inline size_t size() const { return offsets_->size(); }
+
+ private:
+  void ReadString(string* s);
+  // Reads the current record at this offset alone, without the stream
+  void ReadRecord(uint64_t offset);
+  // Asks the kernel for the data past the current position
+  void Advise();
+
+  FILE* file_;
+  const shared_ptr<const vector<uint64_t> > offsets_;
+  size_t record_;
+  // The position of the stream, to only seek when moving out of order
+  uint64_t position_;
+  uint64_t data_size_;
+  uint64_t readahead_;
+  // The range of the data last advised
+  uint64_t advised_begin_;
+  uint64_t advised_end_;
+  string key_;
+  string value_;
+  string record_buffer_;
+};
+
+class PackedDB;
+
+class PackedTransaction : public Transaction {
+ public:
+  explicit PackedTransaction(PackedDB* db) : db_(db) { }
+  virtual void Put(const string& key, const string& value);
+  virtual void Commit();
+
+ private:
+  PackedDB* db_;
+  // The records put, and their offsets in it
+  string records_;
+  vector<uint64_t> offsets_;
+
+  DISABLE_COPY_AND_ASSIGN(PackedTransaction);
+};
+
+class PackedDB : public DB {
+ public:
+  PackedDB() : data_(NULL), index_(NULL), data_size_(0) { }
+  virtual ~PackedDB() { Close(); }
+  virtual void Open(const string& source, Mode mode);
+  virtual void Close();
+  virtual PackedCursor* NewCursor();
+  virtual PackedTransaction* NewTransaction();
+
+ private:
+  // Appends records at the end of the data, with offsets relative to them
+  void Append(const string& records, const vector<uint64_t>& offsets);
+
+  string source_;
+  FILE* data_;
+  FILE* index_;
+  uint64_t data_size_;
+  shared_ptr<vector<uint64_t> > offsets_;
+
+  friend class PackedTransaction;
+};
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DB_PACKED_HPP
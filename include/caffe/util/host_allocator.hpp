@@ -0,0 +1,89 @@
+#ifndef CAFFE_UTIL_HOST_ALLOCATOR_H_
+#define CAFFE_UTIL_HOST_ALLOCATOR_H_
+
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Caching allocator for host memory, used by CaffeMallocHost in CPU
+ *        mode.
+ *
+ * Sizes are rounded up to a size class, 64-byte multiples for small blocks,
+ * then four classes per power of two, so at most 25% is wasted. Freed blocks
+ * are kept per class and handed out again, which avoids allocator churn and
+ * page faults when blobs are repeatedly reshaped, e.g. for variable size
+ * inputs. Blocks are 64-byte aligned for SIMD, and large blocks can be
+ * backed by transparent huge pages. The allocator is shared by all threads
+ * of the process. With neither a cache nor huge pages, the default, blocks
+ * come straight from posix_memalign, are not rounded and not counted in the
+ * stats.
+ */
+class HostAllocator {
+ public:
+  static const size_t kAlignment = 64;
+
+  struct Stats {
+    size_t live_bytes;    // Handed out and not yet freed
+    size_t peak_bytes;    // Maximum of live_bytes
+    size_t cached_bytes;  // Freed and kept for reuse
+    size_t allocations;
+    size_t cache_hits;
+  };
+
+  HostAllocator();
+  virtual ~HostAllocator();
+
+  /// @brief The allocator used by CaffeMallocHost.
+  static HostAllocator& Get();
+
+  void* Allocate(size_t size);
+  void Free(void* ptr);
+  /// @brief Returns all cached blocks to the system.
+  void Release();
+
+  Stats stats() const;
+  /**
+   * @brief Maximum bytes kept in the cache, blocks freed beyond it are
+   *        returned to the system. 0, the default, disables caching.
+   */
+  void set_cache_limit(size_t bytes);
+  inline size_t cache_limit() const { return cache_limit_; }
+  /// @brief Whether blocks of 2MB and more are backed by huge pages.
+  void set_huge_pages(bool huge_pages);
+  inline bool huge_pages() const { return huge_pages_; }
+
+  /// @brief The size actually reserved for a request of the given size.
+  static size_t size_class(size_t size);
+
+ protected:
+  struct Block {
+    size_t size;
+    bool mapped;
+  };
+
+  void* SystemAllocate(size_t size, bool* mapped);
+  void SystemFree(void* ptr, const Block& block);
+  void Trim(size_t limit);
+
+  size_t cache_limit_;
+  bool huge_pages_;
+  // Whether Free may be given blocks in live_
+  bool tracked_;
+  Stats stats_;
+  std::map<void*, Block> live_;
+  std::map<size_t, vector<std::pair<void*, Block> > > cache_;
+  mutable boost::mutex mutex_;
+
+  DISABLE_COPY_AND_ASSIGN(HostAllocator);
+};
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_HOST_ALLOCATOR_H_
@@ -134,6 +134,18 @@ cv::Mat ReadImageToCVMat(const string& filename);
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum);
 cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color);
 
+/**
+ * @brief Decodes an encoded image, scaled down if it is larger than
+ *        min_height x min_width but no smaller. JPEGs at least twice as
+ *        large are decoded by libjpeg at 1/2, 1/4 or 1/8 of their size,
+ *        which skips most of the work; other images are decoded whole.
+ *        scale is set to the size divisor actually used, 1 if decoded whole.
+ */
+cv::Mat DecodeImageToCVMat(const string& data, const int min_height,
+    const int min_width, const bool is_color, int* scale);
+cv::Mat DecodeDatumToCVMat(const Datum& datum, const int min_height,
+    const int min_width, const bool is_color, int* scale);
+
 void CVMatToDatum(const cv::Mat& cv_img, Datum* datum);
 
 }  // namespace caffe
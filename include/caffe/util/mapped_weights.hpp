@@ -0,0 +1,60 @@
+#ifndef CAFFE_UTIL_MAPPED_WEIGHTS_H_
+#define CAFFE_UTIL_MAPPED_WEIGHTS_H_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Trained weights stored as raw tensors, which can be memory-mapped
+ *        instead of parsed, so loading a model neither copies it nor needs
+ *        memory beyond the page cache.
+ *
+ * The file starts with the magic "CAFFEMAP" and a header of uint32 version,
+ * bytes per value (4 or 8), alignment and reserved fields, then the uint64
+ * size of a serialized NetParameter holding the layer names and blob shapes,
+ * without data. The raw values of the blobs follow, in the same order, each
+ * blob starting at a multiple of the alignment (a page).
+ */
+class MappedWeights {
+ public:
+  explicit MappedWeights(const string& filename);
+  virtual ~MappedWeights();
+
+  /// @brief Layer names and blob shapes, without data.
+  inline const NetParameter& param() const { return param_; }
+  /// @brief Bytes per value, 4 for float and 8 for double.
+  inline int value_size() const { return value_size_; }
+  /**
+   * @brief Returns the values of blob j of layer i. The mapping is private,
+   *        so writes are never seen by the file or other processes.
+   */
+  inline void* data(int i, int j) const {
+    return mapped_ + offsets_[i][j];
+  }
+
+ protected:
+  string filename_;
+  NetParameter param_;
+  int value_size_;
+  char* mapped_;
+  size_t mapped_size_;
+  vector<vector<size_t> > offsets_;
+
+  DISABLE_COPY_AND_ASSIGN(MappedWeights);
+};
+
+/**
+ * @brief Writes the blobs of a NetParameter, e.g. read from a .caffemodel,
+ *        in the format read by MappedWeights. Values are written as double
+ *        if the blobs have double_data, float otherwise.
+ */
+void WriteMappedWeights(const NetParameter& param, const string& filename);
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_MAPPED_WEIGHTS_H_
@@ -20,6 +20,17 @@ void caffe_cpu_gemm(const CBLAS_TRANSPOSE TransA,
     const Dtype alpha, const Dtype* A, const Dtype* B, const Dtype beta,
     Dtype* C);
 
+// Runs batch gemms, the i-th on A + i * stride_a, B + i * stride_b and
+// C + i * stride_c. A stride of 0 uses the same matrix for all. Large
+// batches of matrices too small for BLAS to thread are split among the
+// threads of TaskGraph::Shared().
+template <typename Dtype>
+void caffe_cpu_gemm_batched(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, const int stride_a, const Dtype* B,
+    const int stride_b, const Dtype beta, Dtype* C, const int stride_c,
+    const int batch);
+
 template <typename Dtype>
 void caffe_cpu_gemv(const CBLAS_TRANSPOSE TransA, const int M, const int N,
     const Dtype alpha, const Dtype* A, const Dtype* x, const Dtype beta,
@@ -145,6 +156,14 @@ DEFINE_CAFFE_CPU_UNARY_FUNC(fabs, y[i] = std::fabs(x[i]));
 template <typename Dtype>
 void caffe_cpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+// Conversion to and from IEEE 754 half precision, stored as uint16_t.
+// Rounds to nearest even; values beyond the half range become infinities.
+template <typename Dtype>
+void caffe_cpu_to_half(const int n, const Dtype* x, uint16_t* y);
+
+template <typename Dtype>
+void caffe_cpu_from_half(const int n, const uint16_t* x, Dtype* y);
+
 #ifndef CPU_ONLY  // GPU
 
 // Decaf gpu gemm provides an interface that is almost the same as the cpu
@@ -0,0 +1,50 @@
+#ifndef CAFFE_UTIL_RAW_RECORD_HPP_
+#define CAFFE_UTIL_RAW_RECORD_HPP_
+
+#include <stdint.h>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Raw records store a Datum as a fixed 24 byte little-endian header,
+ *        followed by its values, so that reading them costs a copy instead
+ *        of a protobuf parse.
+ *
+ * The header holds the bytes 0xCA 'f' 'f' 'e', which no serialized Datum
+ * starts with, the Datum::DataType of the values in one byte, 3 zero bytes,
+ * then the label, channels, height and width as int32. The values follow in
+ * channel, height, width order.
+ */
+const int kRawRecordHeaderSize = 24;
+
+/// @brief Whether a database value is a raw record rather than a Datum.
+bool IsRawRecord(const string& value);
+bool IsRawRecord(const char* value, size_t size);
+
+/**
+ * @brief Stores a non-encoded datum as a raw record of values of the given
+ *        type, converting them as needed.
+ */
+void DatumToRawRecord(const Datum& datum, Datum::DataType type,
+    string* record);
+
+/**
+ * @brief Reads a raw record into a datum, copying the values to its data and
+ *        setting its data_type.
+ */
+void RawRecordToDatum(const string& record, Datum* datum);
+void RawRecordToDatum(const char* record, size_t size, Datum* datum);
+
+/**
+ * @brief Converts the values of a datum to floats, from data of any
+ *        data_type or from float_data.
+ */
+void DatumToFloat(const Datum& datum, float* values);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_RAW_RECORD_HPP_
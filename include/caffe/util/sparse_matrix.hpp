@@ -0,0 +1,83 @@
+#ifndef CAFFE_UTIL_SPARSE_MATRIX_HPP_
+#define CAFFE_UTIL_SPARSE_MATRIX_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/syncedmem.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A row-major matrix in compressed sparse row (CSR) form, for products
+ *        with pruned weights that skip their zeros.
+ */
+template <typename Dtype>
+class SparseMatrix {
+ public:
+  SparseMatrix() : rows_(0), cols_(0) {}
+
+  /// @brief Keeps the non-zero entries of a dense rows x cols matrix.
+  void FromDense(int rows, int cols, const Dtype* dense);
+
+  /// @brief C = A * B, with B dense cols x n and C rows x n.
+  void Gemm(int n, const Dtype* B, Dtype* C) const;
+  /// @brief C = B * A^T, with B dense m x cols and C m x rows.
+  void GemmTransposed(int m, const Dtype* B, Dtype* C) const;
+
+  inline int rows() const { return rows_; }
+  inline int cols() const { return cols_; }
+  inline int nnz() const { return values_.size(); }
+
+ protected:
+  int rows_;
+  int cols_;
+  // The entries of row r are at row_start_[r] to row_start_[r + 1]
+  vector<int> row_start_;
+  vector<int> columns_;
+  vector<Dtype> values_;
+};
+
+/**
+ * @brief Keeps a sparse copy of a layer's weights, rebuilt when they change,
+ *        as long as they are sparse enough for sparse products to be faster.
+ */
+template <typename Dtype>
+class SparseWeights {
+ public:
+  SparseWeights() : version_(0), sparse_(false) {}
+
+  /**
+   * @brief Returns the weights as a rows x cols sparse matrix, or NULL if
+   *        more than sparse_max_density() of them are non-zero.
+   */
+  const SparseMatrix<Dtype>* Get(const Blob<Dtype>& weights, int rows,
+      int cols);
+
+ protected:
+  SparseMatrix<Dtype> matrix_;
+  shared_ptr<SyncedMemory> source_;
+  unsigned int version_;
+  bool sparse_;
+};
+
+/**
+ * @brief The largest fraction of non-zero weights for which layers use
+ *        sparse products at test time. Dense gemm wins above it; the
+ *        crossover depends on the BLAS and the shapes, tools/sparse_weights
+ *        benchmark measures it.
+ */
+double sparse_max_density();
+void set_sparse_max_density(double density);
+
+/**
+ * @brief Stores data or double_data as sparse values and indices, if at
+ *        most half of them are non-zero. Blob::FromProto reads either form.
+ */
+void SparsifyBlobProto(BlobProto* proto);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SPARSE_MATRIX_HPP_
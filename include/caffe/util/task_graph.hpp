@@ -0,0 +1,74 @@
+#ifndef CAFFE_UTIL_TASK_GRAPH_HPP_
+#define CAFFE_UTIL_TASK_GRAPH_HPP_
+
+#include <boost/function.hpp>
+
+#include <deque>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A pool of threads running a graph of tasks, each as soon as the
+ *        tasks it depends on are done. Used by Net to run independent
+ *        layers, e.g. the branches of inception modules, concurrently.
+ *
+ * The thread calling Run works on tasks too, so a pool of n threads uses
+ * n - 1 background threads. Run is not reentrant.
+ *
+ * Shared() is a pool of one thread per core for the whole process, on which
+ * library code runs parallel loops with ParallelFor.
+ */
+class TaskGraph {
+ public:
+  explicit TaskGraph(int threads);
+  virtual ~TaskGraph();
+
+  /**
+   * @brief Runs task(i) for each task i, after task(j) for each j having i
+   *        in dependents[j]. num_deps[i] is the number of such j. Returns
+   *        when all tasks are done.
+   */
+  void Run(const vector<vector<int> >& dependents,
+      const vector<int>& num_deps, const boost::function<void(int)>& task);
+
+  /**
+   * @brief Runs task(0) to task(count - 1) in any order. If the pool is
+   *        already busy, e.g. with a loop of another thread or the loop
+   *        calling this one, the calling thread runs the tasks itself, so
+   *        concurrent and nested loops never add threads.
+   */
+  void ParallelFor(int count, const boost::function<void(int)>& task);
+
+  inline int threads() const { return workers_.size() + 1; }
+
+  /// @brief The pool shared by the process, created on first use.
+  static TaskGraph& Shared();
+
+ protected:
+  class Worker;
+  class Sync;
+
+  // Runs ready tasks, returns when all are done for the caller of Run,
+  // never for workers
+  void Work(bool caller);
+
+  vector<shared_ptr<Worker> > workers_;
+  shared_ptr<Sync> sync_;
+  const vector<vector<int> >* dependents_;
+  const boost::function<void(int)>* task_;
+  vector<int> pending_;
+  std::deque<int> ready_;
+  int remaining_;
+  // Whether a ParallelFor is running
+  bool busy_;
+
+  DISABLE_COPY_AND_ASSIGN(TaskGraph);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_TASK_GRAPH_HPP_
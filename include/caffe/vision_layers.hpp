@@ -13,6 +13,7 @@
 #include "caffe/loss_layers.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/sparse_matrix.hpp"
 
 namespace caffe {
 
@@ -24,7 +25,7 @@ template <typename Dtype>
 class BaseConvolutionLayer : public Layer<Dtype> {
  public:
   explicit BaseConvolutionLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), output_bias_version_(0) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -46,6 +47,9 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
       weights);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  // The bias added to the outputs, scaled and shifted by output_scale_ and
+  // output_shift_, or NULL if there is none.
+  const Blob<Dtype>* output_bias();
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
@@ -75,6 +79,8 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int height_out_, width_out_;
   bool bias_term_;
   bool is_1x1_;
+  Dtype output_scale_;
+  Dtype output_shift_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
@@ -96,6 +102,10 @@ class BaseConvolutionLayer : public Layer<Dtype> {
         kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_, data);
   }
 #endif
+  // Direct convolution for depthwise layers, with one group per input
+  // channel, which im2col and per-group gemms would mostly spend on overhead.
+  void forward_cpu_depthwise(const Dtype* input, const Dtype* weights,
+      Dtype* output);
 
   int conv_out_channels_;
   int conv_in_channels_;
@@ -109,6 +119,11 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
+  Blob<Dtype> output_bias_;
+  // The bias output_bias_ was folded from, folded again when it changes
+  shared_ptr<SyncedMemory> output_bias_source_;
+  unsigned int output_bias_version_;
+  SparseWeights<Dtype> sparse_weights_;
 };
 
 /**
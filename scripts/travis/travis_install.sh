@@ -12,7 +12,7 @@ apt-get -y update
 apt-get install \
     wget git curl \
     python-dev python-numpy python3-dev\
-    libleveldb-dev libsnappy-dev libopencv-dev \
+    libleveldb-dev libsnappy-dev libopencv-dev libjpeg-dev \
     libprotobuf-dev protobuf-compiler \
     libatlas-dev libatlas-base-dev \
     libhdf5-serial-dev libgflags-dev libgoogle-glog-dev \
@@ -115,6 +115,18 @@ Dtype* Blob<Dtype>::mutable_cpu_diff() {
   return static_cast<Dtype*>(diff_->mutable_cpu_data());
 }
 
+template <typename Dtype>
+Dtype* Blob<Dtype>::mutable_cpu_data_discard() {
+  CHECK(data_);
+  return static_cast<Dtype*>(data_->mutable_cpu_data_discard());
+}
+
+template <typename Dtype>
+Dtype* Blob<Dtype>::mutable_cpu_diff_discard() {
+  CHECK(diff_);
+  return static_cast<Dtype*>(diff_->mutable_cpu_data_discard());
+}
+
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_gpu_diff() {
   CHECK(diff_);
@@ -456,7 +468,18 @@ void Blob<Dtype>::FromProto(const BlobProto& proto, bool reshape) {
   }
   // copy data
   Dtype* data_vec = mutable_cpu_data();
-  if (proto.double_data_size() > 0) {
+  if (proto.sparse_index_size() > 0) {
+    const bool is_double = proto.double_data_size() > 0;
+    CHECK_EQ(proto.sparse_index_size(),
+        is_double ? proto.double_data_size() : proto.data_size());
+    caffe_memset(count_ * sizeof(Dtype), 0, data_vec);
+    int index = 0;
+    for (int i = 0; i < proto.sparse_index_size(); ++i) {
+      index += proto.sparse_index(i);
+      CHECK_LT(index, count_) << "sparse index out of range";
+      data_vec[index] = is_double ? proto.double_data(i) : proto.data(i);
+    }
+  } else if (proto.double_data_size() > 0) {
     CHECK_EQ(count_, proto.double_data_size());
     for (int i = 0; i < count_; ++i) {
       data_vec[i] = proto.double_data(i);
@@ -490,6 +513,7 @@ void Blob<double>::ToProto(BlobProto* proto, bool write_diff) const {
   }
   proto->clear_double_data();
   proto->clear_double_diff();
+  proto->clear_sparse_index();
   const double* data_vec = cpu_data();
   for (int i = 0; i < count_; ++i) {
     proto->add_double_data(data_vec[i]);
@@ -510,6 +534,7 @@ void Blob<float>::ToProto(BlobProto* proto, bool write_diff) const {
   }
   proto->clear_data();
   proto->clear_diff();
+  proto->clear_sparse_index();
   const float* data_vec = cpu_data();
   for (int i = 0; i < count_; ++i) {
     proto->add_data(data_vec[i]);
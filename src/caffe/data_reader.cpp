@@ -7,6 +7,13 @@
 #include "caffe/data_layers.hpp"
 #include "caffe/data_reader.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/datum_cache.hpp"
+#include "caffe/util/db_packed.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/raw_record.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
@@ -30,6 +37,11 @@ DataReader::DataReader(const LayerParameter& param)
   body_->new_queue_pairs_.push(queue_pair_);
 }
 
+DataReader::ReadStats DataReader::read_stats() const {
+  boost::mutex::scoped_lock lock(*body_->stats_mutex_);
+  return body_->stats_;
+}
+
 DataReader::~DataReader() {
   string key = source_key(body_->param_);
   body_.reset();
@@ -60,9 +72,170 @@ DataReader::QueuePair::~QueuePair() {
 
 //
 
+DataReader::Shard::Shard(const LayerParameter& param, const string& source,
+    int size, size_t cache_size, unsigned int seed, Body* body)
+    : queue_pair_(size),
+      param_(param),
+      source_(source),
+      cache_size_(cache_size),
+      seed_(seed),
+      body_(body) {
+  StartInternalThread();
+}
+
+DataReader::Shard::~Shard() {
+  StopInternalThread();
+}
+
+void DataReader::Shard::InternalThreadEntry() {
+  const DataParameter& param = param_.data_param();
+  shared_ptr<db::DB> db(db::GetDB(param.backend()));
+  db->Open(source_, db::READ);
+  shared_ptr<db::Cursor> cursor(db->NewCursor());
+  db::PackedCursor* packed = dynamic_cast<db::PackedCursor*>(cursor.get());
+  CHECK(!param.shuffle() || packed || cache_size_)
+      << "Shuffling data needs the packed backend or a cache";
+  // Shuffled packed sources are read in a random order of the indexed records
+  rng_t rng(seed_);
+  vector<size_t> order;
+  if (param.shuffle() && packed) {
+    CHECK(packed->size()) << "No data in " << source_;
+    for (size_t i = 0; i < packed->size(); ++i) {
+      order.push_back(i);
+    }
+    shuffle(order.begin(), order.end(), &rng);
+    packed->Seek(order[0]);
+  } else {
+    cursor->set_readahead(static_cast<size_t>(param.readahead()) << 20);
+  }
+  // The first pass over the source fills the cache. Later passes read the
+  // records it holds from memory, in a new random order each if shuffling,
+  // then the others from the source. Encoded datums are cached decoded,
+  // unless the transformer forces their color.
+  DatumCache cache(cache_size_);
+  const TransformationParameter& transform = param_.transform_param();
+  const bool decode = !transform.force_color() && !transform.force_gray();
+  bool caching = cache_size_ > 0;
+  bool complete = false;
+  bool from_cache = false;
+  vector<size_t> cache_order;
+  size_t cached = 0;
+  size_t position = 0;
+  CPUTimer timer;
+  ReadStats pass;
+  try {
+    while (!must_stop()) {
+      Datum* datum = queue_pair_.free_.pop();
+      timer.Start();
+      ReadStats stats;
+      stats.records = 1;
+      bool end_of_pass = false;
+      if (from_cache) {
+        const size_t i = cache_order.size() ? cache_order[cached] : cached;
+        cache.Get(i, datum);
+        stats.bytes = cache.bytes(i);
+        queue_pair_.full_.push(datum);
+        if (++cached == cache.size()) {
+          cached = 0;
+          if (complete) {
+            end_of_pass = true;
+          } else {
+            // Read the records past the cached ones from the source
+            from_cache = false;
+            if (packed) {
+              packed->Seek(cache.size());
+            } else {
+              cursor->SeekToFirst();
+              for (size_t j = 0; j < cache.size(); ++j) {
+                cursor->Next();
+              }
+            }
+          }
+        }
+      } else {
+        // TODO deserialize in-place instead of copy?
+        const string value = cursor->value();
+        if (IsRawRecord(value)) {
+          RawRecordToDatum(value, datum);
+        } else {
+          datum->ParseFromString(value);
+        }
+        if (caching) {
+          if (decode && datum->encoded()) {
+            CHECK(DecodeDatumNative(datum)) << "Cannot decode datum";
+          }
+          if (!cache.Add(*datum)) {
+            caching = false;
+            if (param.shuffle() ||
+                param.cache_overflow() == DataParameter_CacheOverflow_DROP) {
+              CHECK(packed || !param.shuffle()) << source_
+                  << " does not fit in the cache to shuffle it";
+              cache.Clear();
+            }
+            LOG(INFO) << "Cache of " << source_ << " full, keeping "
+                << cache.size() << " records";
+          }
+        }
+        stats.bytes = value.size();
+        queue_pair_.full_.push(datum);
+        if (order.size()) {
+          if (++position == order.size()) {
+            shuffle(order.begin(), order.end(), &rng);
+            position = 0;
+            end_of_pass = true;
+          }
+          packed->Seek(order[position]);
+        } else {
+          cursor->Next();
+          end_of_pass = !cursor->valid();
+        }
+      }
+      stats.seconds = timer.MicroSeconds() / 1e6;
+      body_->add_stats(stats);
+      pass.records += stats.records;
+      pass.bytes += stats.bytes;
+      pass.seconds += stats.seconds;
+      if (!end_of_pass) {
+        continue;
+      }
+      DLOG(INFO) << "Restarting data prefetching of " << source_
+          << " from start, read " << pass.records << " records at "
+          << pass.megabytes_per_second() << " MB/s.";
+      pass = ReadStats();
+      if (caching) {
+        caching = false;
+        complete = true;
+        LOG(INFO) << "Cached the " << cache.size() << " records of "
+            << source_ << " in " << (cache.allocated() >> 20) << " MB";
+        // Later passes do not need the source
+        packed = NULL;
+        cursor.reset();
+        db.reset();
+      }
+      if (complete && param.shuffle()) {
+        for (size_t i = cache_order.size(); i < cache.size(); ++i) {
+          cache_order.push_back(i);
+        }
+        shuffle(cache_order.begin(), cache_order.end(), &rng);
+      }
+      from_cache = cache.size() > 0;
+      if (!from_cache && order.empty()) {
+        cursor->SeekToFirst();
+      }
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+//
+
 DataReader::Body::Body(const LayerParameter& param)
     : param_(param),
-      new_queue_pairs_() {
+      new_queue_pairs_(),
+      skip_(0),
+      stats_mutex_(new boost::mutex()),
+      shard_(0) {
   StartInternalThread();
 }
 
@@ -71,25 +244,56 @@ DataReader::Body::~Body() {
 }
 
 void DataReader::Body::InternalThreadEntry() {
-  shared_ptr<db::DB> db(db::GetDB(param_.data_param().backend()));
-  db->Open(param_.data_param().source(), db::READ);
-  shared_ptr<db::Cursor> cursor(db->NewCursor());
+  const DataParameter& data_param = param_.data_param();
+  const vector<string> sources = db::ShardNames(data_param.source());
+  const bool disjoint = param_.phase() == TRAIN &&
+      data_param.disjoint_shards() && Caffe::process_count() > 1;
+  vector<int> owned;
+  for (int i = 0; i < sources.size(); ++i) {
+    if (!disjoint || i % Caffe::process_count() == Caffe::process_rank()) {
+      owned.push_back(i);
+    }
+  }
+  CHECK(owned.size()) << "No shard of " << data_param.source()
+      << " for process " << Caffe::process_rank();
+  // Shards buffer as many records as the readers between them, and split
+  // the cache. Processes taking every process_count-th record of a source
+  // must shuffle it alike to read each record once per pass between them.
+  const int size = data_param.prefetch() * data_param.batch_size();
+  const size_t cache_size =
+      (static_cast<size_t>(data_param.cache_size()) << 20) / owned.size();
+  const bool split = param_.phase() == TRAIN && !disjoint &&
+      Caffe::process_count() > 1;
+  for (int i = 0; i < owned.size(); ++i) {
+    const unsigned int seed = split ? Caffe::process_seed() + owned[i] :
+        caffe_rng_rand();
+    shards_.push_back(shared_ptr<Shard>(new Shard(param_, sources[owned[i]],
+        (size + owned.size() - 1) / owned.size(), cache_size, seed, this)));
+  }
   vector<shared_ptr<QueuePair> > qps;
   try {
     int solver_count = param_.phase() == TRAIN ? Caffe::solver_count() : 1;
+    // In multi-process training, each process reads an interleaved subset
+    // of the database, starting at its rank, unless it owns its shards.
+    if (param_.phase() == TRAIN && !disjoint) {
+      skip_ = Caffe::process_count() - 1;
+      for (int i = 0; i < Caffe::process_rank(); ++i) {
+        next();
+      }
+    }
 
     // To ensure deterministic runs, only start running once all solvers
     // are ready. But solvers need to peek on one item during initialization,
     // so read one item, then wait for the next solver.
     for (int i = 0; i < solver_count; ++i) {
       shared_ptr<QueuePair> qp(new_queue_pairs_.pop());
-      read_one(cursor.get(), qp.get());
+      read_one(qp.get());
       qps.push_back(qp);
     }
     // Main loop
     while (!must_stop()) {
       for (int i = 0; i < solver_count; ++i) {
-        read_one(cursor.get(), qps[i].get());
+        read_one(qps[i].get());
       }
       // Check no additional readers have been created. This can happen if
       // more than one net is trained at a time per process, whether single
@@ -100,20 +304,35 @@ void DataReader::Body::InternalThreadEntry() {
   } catch (boost::thread_interrupted&) {
     // Interrupted exception is expected on shutdown
   }
+  shards_.clear();
 }
 
-void DataReader::Body::read_one(db::Cursor* cursor, QueuePair* qp) {
+void DataReader::Body::read_one(QueuePair* qp) {
   Datum* datum = qp->free_.pop();
-  // TODO deserialize in-place instead of copy?
-  datum->ParseFromString(cursor->value());
+  QueuePair& shard = shards_[shard_]->queue_pair_;
+  Datum* read = shard.full_.pop();
+  datum->Swap(read);
+  shard.free_.push(read);
+  shard_ = (shard_ + 1) % shards_.size();
   qp->full_.push(datum);
 
-  // go to the next iter
-  cursor->Next();
-  if (!cursor->valid()) {
-    DLOG(INFO) << "Restarting data prefetching from start.";
-    cursor->SeekToFirst();
+  // go to the next record, skipping records read by other processes
+  for (int i = 0; i < skip_; ++i) {
+    next();
   }
 }
 
+void DataReader::Body::next() {
+  QueuePair& shard = shards_[shard_]->queue_pair_;
+  shard.free_.push(shard.full_.pop());
+  shard_ = (shard_ + 1) % shards_.size();
+}
+
+void DataReader::Body::add_stats(const ReadStats& stats) {
+  boost::mutex::scoped_lock lock(*stats_mutex_);
+  stats_.records += stats.records;
+  stats_.bytes += stats.bytes;
+  stats_.seconds += stats.seconds;
+}
+
 }  // namespace caffe
@@ -1,12 +1,16 @@
+#include <boost/bind.hpp>
 #include <opencv2/core/core.hpp>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include "caffe/data_transformer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/raw_record.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/task_graph.hpp"
 
 namespace caffe {
 
@@ -38,7 +42,7 @@ DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
 
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const Datum& datum,
-                                       Dtype* transformed_data) {
+    Dtype* transformed_data, Caffe::RNG* rng) {
   const string& data = datum.data();
   const int datum_channels = datum.channels();
   const int datum_height = datum.height();
@@ -46,31 +50,25 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
 
   const int crop_size = param_.crop_size();
   const Dtype scale = param_.scale();
-  const bool do_mirror = param_.mirror() && Rand(2);
+  const bool do_mirror = param_.mirror() && Rand(2, rng);
   const bool has_mean_file = param_.has_mean_file();
-  const bool has_uint8 = data.size() > 0;
+  const bool has_uint8 = data.size() > 0 &&
+      datum.data_type() == Datum_DataType_UINT8;
   const bool has_mean_values = mean_values_.size() > 0;
 
   CHECK_GT(datum_channels, 0);
   CHECK_GE(datum_height, crop_size);
   CHECK_GE(datum_width, crop_size);
 
-  Dtype* mean = NULL;
+  const Dtype* mean = NULL;
   if (has_mean_file) {
     CHECK_EQ(datum_channels, data_mean_.channels());
     CHECK_EQ(datum_height, data_mean_.height());
     CHECK_EQ(datum_width, data_mean_.width());
-    mean = data_mean_.mutable_cpu_data();
+    mean = data_mean_.cpu_data();
   }
   if (has_mean_values) {
-    CHECK(mean_values_.size() == 1 || mean_values_.size() == datum_channels) <<
-     "Specify either 1 mean_value or as many as channels: " << datum_channels;
-    if (datum_channels > 1 && mean_values_.size() == 1) {
-      // Replicate the mean_value for simplicity
-      for (int c = 1; c < datum_channels; ++c) {
-        mean_values_.push_back(mean_values_[0]);
-      }
-    }
+    CheckMeanValues(datum_channels);
   }
 
   int height = datum_height;
@@ -83,14 +81,21 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
     width = crop_size;
     // We only do random crop when we do training.
     if (phase_ == TRAIN) {
-      h_off = Rand(datum_height - crop_size + 1);
-      w_off = Rand(datum_width - crop_size + 1);
+      h_off = Rand(datum_height - crop_size + 1, rng);
+      w_off = Rand(datum_width - crop_size + 1, rng);
     } else {
       h_off = (datum_height - crop_size) / 2;
       w_off = (datum_width - crop_size) / 2;
     }
   }
 
+  // Floats of raw records are converted once, before cropping
+  vector<float> raw_floats;
+  if (data.size() > 0 && !has_uint8) {
+    raw_floats.resize(datum_channels * datum_height * datum_width);
+    DatumToFloat(datum, &raw_floats[0]);
+  }
+
   Dtype datum_element;
   int top_index, data_index;
   for (int c = 0; c < datum_channels; ++c) {
@@ -105,6 +110,8 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
         if (has_uint8) {
           datum_element =
             static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
+        } else if (raw_floats.size()) {
+          datum_element = raw_floats[data_index];
         } else {
           datum_element = datum.float_data(data_index);
         }
@@ -127,6 +134,12 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const Datum& datum,
                                        Blob<Dtype>* transformed_blob) {
+  Transform(datum, transformed_blob, rng_.get());
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const Datum& datum,
+    Blob<Dtype>* transformed_blob, Caffe::RNG* rng) {
   // If datum is encoded, decoded and transform the cv::image.
   if (datum.encoded()) {
     CHECK(!(param_.force_color() && param_.force_gray()))
@@ -139,7 +152,7 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
       cv_img = DecodeDatumToCVMatNative(datum);
     }
     // Transform the cv::image into blob.
-    return Transform(cv_img, transformed_blob);
+    return Transform(cv_img, transformed_blob, rng);
   } else {
     if (param_.force_color() || param_.force_gray()) {
       LOG(ERROR) << "force_color and force_gray only for encoded datum";
@@ -171,7 +184,7 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
   }
 
   Dtype* transformed_data = transformed_blob->mutable_cpu_data();
-  Transform(datum, transformed_data);
+  Transform(datum, transformed_data, rng);
 }
 
 template<typename Dtype>
@@ -180,18 +193,14 @@ void DataTransformer<Dtype>::Transform(const vector<Datum> & datum_vector,
   const int datum_num = datum_vector.size();
   const int num = transformed_blob->num();
   const int channels = transformed_blob->channels();
-  const int height = transformed_blob->height();
-  const int width = transformed_blob->width();
 
   CHECK_GT(datum_num, 0) << "There is no datum to add";
   CHECK_LE(datum_num, num) <<
     "The size of datum_vector must be no greater than transformed_blob->num()";
-  Blob<Dtype> uni_blob(1, channels, height, width);
-  for (int item_id = 0; item_id < datum_num; ++item_id) {
-    int offset = transformed_blob->offset(item_id);
-    uni_blob.set_cpu_data(transformed_blob->mutable_cpu_data() + offset);
-    Transform(datum_vector[item_id], &uni_blob);
+  if (mean_values_.size()) {
+    CheckMeanValues(channels);
   }
+  TransformBatch(datum_vector, transformed_blob);
 }
 
 template<typename Dtype>
@@ -200,23 +209,71 @@ void DataTransformer<Dtype>::Transform(const vector<cv::Mat> & mat_vector,
   const int mat_num = mat_vector.size();
   const int num = transformed_blob->num();
   const int channels = transformed_blob->channels();
-  const int height = transformed_blob->height();
-  const int width = transformed_blob->width();
 
   CHECK_GT(mat_num, 0) << "There is no MAT to add";
   CHECK_EQ(mat_num, num) <<
     "The size of mat_vector must be equals to transformed_blob->num()";
-  Blob<Dtype> uni_blob(1, channels, height, width);
-  for (int item_id = 0; item_id < mat_num; ++item_id) {
-    int offset = transformed_blob->offset(item_id);
-    uni_blob.set_cpu_data(transformed_blob->mutable_cpu_data() + offset);
-    Transform(mat_vector[item_id], &uni_blob);
+  if (mean_values_.size()) {
+    CheckMeanValues(channels);
+  }
+  TransformBatch(mat_vector, transformed_blob);
+}
+
+template<typename Dtype>
+template <typename Input>
+void DataTransformer<Dtype>::TransformBatch(const vector<Input>& inputs,
+    Blob<Dtype>* transformed_blob) {
+  // Seeds are drawn in item order whatever thread transforms each item
+  vector<unsigned int> seeds(inputs.size());
+  if (rng_) {
+    caffe::rng_t* rng = static_cast<caffe::rng_t*>(rng_->generator());
+    for (int i = 0; i < seeds.size(); ++i) {
+      seeds[i] = (*rng)();
+    }
+  }
+  Dtype* transformed_data = transformed_blob->mutable_cpu_data();
+  const int chunks = std::min<int>(param_.batch_threads(), inputs.size());
+  if (chunks <= 1) {
+    TransformChunk(&inputs, transformed_blob, transformed_data, &seeds, 1, 0);
+    return;
+  }
+  TaskGraph& pool = TaskGraph::Shared();
+  const int count = std::min(chunks, pool.threads());
+  pool.ParallelFor(count, boost::bind(
+      &DataTransformer<Dtype>::template TransformChunk<Input>, this, &inputs,
+      transformed_blob, transformed_data, &seeds, count, _1));
+}
+
+template<typename Dtype>
+template <typename Input>
+void DataTransformer<Dtype>::TransformChunk(const vector<Input>* inputs,
+    Blob<Dtype>* transformed_blob, Dtype* transformed_data,
+    const vector<unsigned int>* seeds, int chunks, int chunk) {
+  Blob<Dtype> uni_blob(1, transformed_blob->channels(),
+      transformed_blob->height(), transformed_blob->width());
+  const int begin = chunk * inputs->size() / chunks;
+  const int end = (chunk + 1) * inputs->size() / chunks;
+  for (int item_id = begin; item_id < end; ++item_id) {
+    uni_blob.set_cpu_data(transformed_data +
+        transformed_blob->offset(item_id));
+    if (rng_) {
+      Caffe::RNG rng((*seeds)[item_id]);
+      Transform((*inputs)[item_id], &uni_blob, &rng);
+    } else {
+      Transform((*inputs)[item_id], &uni_blob, NULL);
+    }
   }
 }
 
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
                                        Blob<Dtype>* transformed_blob) {
+  Transform(cv_img, transformed_blob, rng_.get());
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
+    Blob<Dtype>* transformed_blob, Caffe::RNG* rng) {
   const int crop_size = param_.crop_size();
   const int img_channels = cv_img.channels();
   const int img_height = cv_img.rows;
@@ -236,7 +293,7 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
   CHECK(cv_img.depth() == CV_8U) << "Image data type must be unsigned byte";
 
   const Dtype scale = param_.scale();
-  const bool do_mirror = param_.mirror() && Rand(2);
+  const bool do_mirror = param_.mirror() && Rand(2, rng);
   const bool has_mean_file = param_.has_mean_file();
   const bool has_mean_values = mean_values_.size() > 0;
 
@@ -244,22 +301,15 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
   CHECK_GE(img_height, crop_size);
   CHECK_GE(img_width, crop_size);
 
-  Dtype* mean = NULL;
+  const Dtype* mean = NULL;
   if (has_mean_file) {
     CHECK_EQ(img_channels, data_mean_.channels());
     CHECK_EQ(img_height, data_mean_.height());
     CHECK_EQ(img_width, data_mean_.width());
-    mean = data_mean_.mutable_cpu_data();
+    mean = data_mean_.cpu_data();
   }
   if (has_mean_values) {
-    CHECK(mean_values_.size() == 1 || mean_values_.size() == img_channels) <<
-     "Specify either 1 mean_value or as many as channels: " << img_channels;
-    if (img_channels > 1 && mean_values_.size() == 1) {
-      // Replicate the mean_value for simplicity
-      for (int c = 1; c < img_channels; ++c) {
-        mean_values_.push_back(mean_values_[0]);
-      }
-    }
+    CheckMeanValues(img_channels);
   }
 
   int h_off = 0;
@@ -270,8 +320,8 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
     CHECK_EQ(crop_size, width);
     // We only do random crop when we do training.
     if (phase_ == TRAIN) {
-      h_off = Rand(img_height - crop_size + 1);
-      w_off = Rand(img_width - crop_size + 1);
+      h_off = Rand(img_height - crop_size + 1, rng);
+      w_off = Rand(img_width - crop_size + 1, rng);
     } else {
       h_off = (img_height - crop_size) / 2;
       w_off = (img_width - crop_size) / 2;
@@ -519,11 +569,28 @@ void DataTransformer<Dtype>::InitRand() {
 
 template <typename Dtype>
 int DataTransformer<Dtype>::Rand(int n) {
-  CHECK(rng_);
+  return Rand(n, rng_.get());
+}
+
+template <typename Dtype>
+int DataTransformer<Dtype>::Rand(int n, Caffe::RNG* rng) {
+  CHECK(rng);
   CHECK_GT(n, 0);
-  caffe::rng_t* rng =
-      static_cast<caffe::rng_t*>(rng_->generator());
-  return ((*rng)() % n);
+  caffe::rng_t* generator =
+      static_cast<caffe::rng_t*>(rng->generator());
+  return ((*generator)() % n);
+}
+
+template <typename Dtype>
+void DataTransformer<Dtype>::CheckMeanValues(int channels) {
+  CHECK(mean_values_.size() == 1 || mean_values_.size() == channels) <<
+      "Specify either 1 mean_value or as many as channels: " << channels;
+  if (channels > 1 && mean_values_.size() == 1) {
+    // Replicate the mean_value for simplicity
+    for (int c = 1; c < channels; ++c) {
+      mean_values_.push_back(mean_values_[0]);
+    }
+  }
 }
 
 INSTANTIATE_CLASS(DataTransformer);
@@ -29,17 +29,22 @@ void InternalThread::StartInternalThread() {
   int rand_seed = caffe_rng_rand();
   int solver_count = Caffe::solver_count();
   bool root_solver = Caffe::root_solver();
+  int process_count = Caffe::process_count();
+  int process_rank = Caffe::process_rank();
+  unsigned int process_seed = Caffe::process_seed();
 
   try {
     thread_.reset(new boost::thread(&InternalThread::entry, this, device, mode,
-          rand_seed, solver_count, root_solver));
+          rand_seed, solver_count, root_solver, process_count, process_rank,
+          process_seed));
   } catch (std::exception& e) {
     LOG(FATAL) << "Thread exception: " << e.what();
   }
 }
 
 void InternalThread::entry(int device, Caffe::Brew mode, int rand_seed,
-    int solver_count, bool root_solver) {
+    int solver_count, bool root_solver, int process_count, int process_rank,
+    unsigned int process_seed) {
 #ifndef CPU_ONLY
   CUDA_CHECK(cudaSetDevice(device));
 #endif
@@ -47,6 +52,9 @@ void InternalThread::entry(int device, Caffe::Brew mode, int rand_seed,
   Caffe::set_random_seed(rand_seed);
   Caffe::set_solver_count(solver_count);
   Caffe::set_root_solver(root_solver);
+  Caffe::set_process_count(process_count);
+  Caffe::set_process_rank(process_rank);
+  Caffe::set_process_seed(process_seed);
 
   InternalThreadEntry();
 }
@@ -72,6 +72,8 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // - blobs_[0] holds the filter weights
   // - blobs_[1] holds the biases (optional)
   bias_term_ = this->layer_param_.convolution_param().bias_term();
+  output_scale_ = this->layer_param_.convolution_param().output_scale();
+  output_shift_ = this->layer_param_.convolution_param().output_shift();
   if (this->blobs_.size() > 0) {
     LOG(INFO) << "Skipping parameter initialization";
   } else {
@@ -147,7 +149,7 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     col_buffer_.Reshape(1, kernel_dim_, height_out_, width_out_);
   }
   // Set up the all ones "bias multiplier" for adding biases by BLAS
-  if (bias_term_) {
+  if (bias_term_ || output_shift_ != 0) {
     vector<int> bias_multiplier_shape(1, height_out_ * width_out_);
     bias_multiplier_.Reshape(bias_multiplier_shape);
     caffe_set(bias_multiplier_.count(), Dtype(1),
@@ -158,18 +160,70 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
     const Dtype* weights, Dtype* output, bool skip_im2col) {
+  if (group_ > 1 && group_ == conv_in_channels_) {
+    forward_cpu_depthwise(input, weights, output);
+    return;
+  }
   const Dtype* col_buff = input;
   if (!is_1x1_) {
     if (!skip_im2col) {
-      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data_discard());
     }
     col_buff = col_buffer_.cpu_data();
   }
-  for (int g = 0; g < group_; ++g) {
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
-        group_, conv_out_spatial_dim_, kernel_dim_ / group_,
-        (Dtype)1., weights + weight_offset_ * g, col_buff + col_offset_ * g,
-        (Dtype)0., output + output_offset_ * g);
+  if (this->phase_ == TEST && group_ == 1) {
+    const SparseMatrix<Dtype>* sparse =
+        sparse_weights_.Get(*this->blobs_[0], conv_out_channels_, kernel_dim_);
+    if (sparse) {
+      sparse->Gemm(conv_out_spatial_dim_, col_buff, output);
+      if (output_scale_ != 1) {
+        caffe_scal(conv_out_channels_ * conv_out_spatial_dim_, output_scale_,
+            output);
+      }
+      return;
+    }
+  }
+  caffe_cpu_gemm_batched<Dtype>(CblasNoTrans, CblasNoTrans,
+      conv_out_channels_ / group_, conv_out_spatial_dim_, kernel_dim_ / group_,
+      output_scale_, weights, weight_offset_, col_buff, col_offset_,
+      (Dtype)0., output, output_offset_, group_);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_depthwise(const Dtype* input,
+    const Dtype* weights, Dtype* output) {
+  const int height_out =
+      (conv_in_height_ + 2 * pad_h_ - kernel_h_) / stride_h_ + 1;
+  const int width_out =
+      (conv_in_width_ + 2 * pad_w_ - kernel_w_) / stride_w_ + 1;
+  // Each input channel feeds multiplier consecutive output channels
+  const int multiplier = conv_out_channels_ / group_;
+  for (int c = 0; c < conv_out_channels_; ++c) {
+    const Dtype* image =
+        input + (c / multiplier) * conv_in_height_ * conv_in_width_;
+    const Dtype* kernel = weights + c * kernel_h_ * kernel_w_;
+    for (int h = 0; h < height_out; ++h) {
+      const int h_start = h * stride_h_ - pad_h_;
+      for (int w = 0; w < width_out; ++w) {
+        const int w_start = w * stride_w_ - pad_w_;
+        Dtype sum = 0;
+        for (int kh = 0; kh < kernel_h_; ++kh) {
+          const int h_in = h_start + kh;
+          if (h_in < 0 || h_in >= conv_in_height_) {
+            continue;
+          }
+          const Dtype* row = image + h_in * conv_in_width_;
+          const Dtype* kernel_row = kernel + kh * kernel_w_;
+          for (int kw = 0; kw < kernel_w_; ++kw) {
+            const int w_in = w_start + kw;
+            if (w_in >= 0 && w_in < conv_in_width_) {
+              sum += row[w_in] * kernel_row[kw];
+            }
+          }
+        }
+        *output++ = output_scale_ * sum;
+      }
+    }
   }
 }
 
@@ -184,16 +238,14 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
     const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_cpu_data();
-  if (is_1x1_) {
-    col_buff = input;
-  }
-  for (int g = 0; g < group_; ++g) {
-    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_ / group_,
-        conv_out_spatial_dim_, conv_out_channels_ / group_,
-        (Dtype)1., weights + weight_offset_ * g, output + output_offset_ * g,
-        (Dtype)0., col_buff + col_offset_ * g);
+  Dtype* col_buff = input;
+  if (!is_1x1_) {
+    col_buff = col_buffer_.mutable_cpu_data_discard();
   }
+  caffe_cpu_gemm_batched<Dtype>(CblasTrans, CblasNoTrans,
+      kernel_dim_ / group_, conv_out_spatial_dim_, conv_out_channels_ / group_,
+      output_scale_, weights, weight_offset_, output, output_offset_,
+      (Dtype)0., col_buff, col_offset_, group_);
   if (!is_1x1_) {
     conv_col2im_cpu(col_buff, input);
   }
@@ -204,22 +256,50 @@ void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
     const Dtype* output, Dtype* weights) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data_discard());
     col_buff = col_buffer_.cpu_data();
   }
-  for (int g = 0; g < group_; ++g) {
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
-        kernel_dim_ / group_, conv_out_spatial_dim_,
-        (Dtype)1., output + output_offset_ * g, col_buff + col_offset_ * g,
-        (Dtype)1., weights + weight_offset_ * g);
+  caffe_cpu_gemm_batched<Dtype>(CblasNoTrans, CblasTrans,
+      conv_out_channels_ / group_, kernel_dim_ / group_, conv_out_spatial_dim_,
+      output_scale_, output, output_offset_, col_buff, col_offset_,
+      (Dtype)1., weights, weight_offset_, group_);
+}
+
+template <typename Dtype>
+const Blob<Dtype>* BaseConvolutionLayer<Dtype>::output_bias() {
+  if (!bias_term_ && output_shift_ == 0) {
+    return NULL;
+  }
+  if (output_scale_ == 1 && output_shift_ == 0) {
+    return this->blobs_[1].get();
+  }
+  // Folded again only when the bias changes, not to copy it to the GPU at
+  // each forward
+  shared_ptr<SyncedMemory> source;
+  if (bias_term_) {
+    source = this->blobs_[1]->data();
+  }
+  if (output_bias_.count() && source == output_bias_source_ &&
+      (!source || source->version() == output_bias_version_)) {
+    return &output_bias_;
+  }
+  vector<int> bias_shape(1, num_output_);
+  output_bias_.Reshape(bias_shape);
+  Dtype* data = output_bias_.mutable_cpu_data_discard();
+  caffe_set(num_output_, output_shift_, data);
+  if (bias_term_) {
+    caffe_axpy(num_output_, output_scale_, this->blobs_[1]->cpu_data(), data);
   }
+  output_bias_source_ = source;
+  output_bias_version_ = source ? source->version() : 0;
+  return &output_bias_;
 }
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
     const Dtype* input) {
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, height_out_ * width_out_, 1.,
-      input, bias_multiplier_.cpu_data(), 1., bias);
+  caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, height_out_ * width_out_,
+      output_scale_, input, bias_multiplier_.cpu_data(), 1., bias);
 }
 
 #ifndef CPU_ONLY
@@ -237,7 +317,7 @@ void BaseConvolutionLayer<Dtype>::forward_gpu_gemm(const Dtype* input,
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
         group_, conv_out_spatial_dim_, kernel_dim_ / group_,
-        (Dtype)1., weights + weight_offset_ * g, col_buff + col_offset_ * g,
+        output_scale_, weights + weight_offset_ * g, col_buff + col_offset_ * g,
         (Dtype)0., output + output_offset_ * g);
   }
 }
@@ -260,8 +340,8 @@ void BaseConvolutionLayer<Dtype>::backward_gpu_gemm(const Dtype* output,
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_ / group_,
         conv_out_spatial_dim_, conv_out_channels_ / group_,
-        (Dtype)1., weights + weight_offset_ * g, output + output_offset_ * g,
-        (Dtype)0., col_buff + col_offset_ * g);
+        output_scale_, weights + weight_offset_ * g,
+        output + output_offset_ * g, (Dtype)0., col_buff + col_offset_ * g);
   }
   if (!is_1x1_) {
     conv_col2im_gpu(col_buff, input);
@@ -279,7 +359,7 @@ void BaseConvolutionLayer<Dtype>::weight_gpu_gemm(const Dtype* input,
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
         kernel_dim_ / group_, conv_out_spatial_dim_,
-        (Dtype)1., output + output_offset_ * g, col_buff + col_offset_ * g,
+        output_scale_, output + output_offset_ * g, col_buff + col_offset_ * g,
         (Dtype)1., weights + weight_offset_ * g);
   }
 }
@@ -287,8 +367,8 @@ void BaseConvolutionLayer<Dtype>::weight_gpu_gemm(const Dtype* input,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_gpu_bias(Dtype* bias,
     const Dtype* input) {
-  caffe_gpu_gemv<Dtype>(CblasNoTrans, num_output_, height_out_ * width_out_, 1.,
-      input, bias_multiplier_.gpu_data(), 1., bias);
+  caffe_gpu_gemv<Dtype>(CblasNoTrans, num_output_, height_out_ * width_out_,
+      output_scale_, input, bias_multiplier_.gpu_data(), 1., bias);
 }
 
 #endif  // !CPU_ONLY
@@ -109,14 +109,14 @@ void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
       batch->data_.height(), batch->data_.width());
   // Copy the data
   caffe_copy(batch->data_.count(), batch->data_.cpu_data(),
-             top[0]->mutable_cpu_data());
+             top[0]->mutable_cpu_data_discard());
   DLOG(INFO) << "Prefetch copied";
   if (this->output_labels_) {
     // Reshape to loaded labels.
     top[1]->ReshapeLike(batch->label_);
     // Copy the labels.
     caffe_copy(batch->label_.count(), batch->label_.cpu_data(),
-        top[1]->mutable_cpu_data());
+        top[1]->mutable_cpu_data_discard());
   }
 
   prefetch_free_.push(batch);
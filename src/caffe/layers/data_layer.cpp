@@ -105,6 +105,8 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  DLOG(INFO) << "     Read rate: "
+      << reader_.read_stats().megabytes_per_second() << " MB/s.";
 }
 
 INSTANTIATE_CLASS(DataLayer);
@@ -20,15 +20,16 @@ template <typename Dtype>
 void DeconvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Blob<Dtype>* bias = this->output_bias();
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
-    Dtype* top_data = top[i]->mutable_cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data_discard();
     for (int n = 0; n < this->num_; ++n) {
       this->backward_cpu_gemm(bottom_data + bottom[i]->offset(n), weight,
           top_data + top[i]->offset(n));
-      if (this->bias_term_) {
-        const Dtype* bias = this->blobs_[1]->cpu_data();
-        this->forward_cpu_bias(top_data + top[i]->offset(n), bias);
+      if (bias) {
+        this->forward_cpu_bias(top_data + top[i]->offset(n),
+            bias->cpu_data());
       }
     }
   }
@@ -14,6 +14,8 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const int num_output = this->layer_param_.inner_product_param().num_output();
   bias_term_ = this->layer_param_.inner_product_param().bias_term();
+  output_scale_ = this->layer_param_.inner_product_param().output_scale();
+  output_shift_ = this->layer_param_.inner_product_param().output_shift();
   N_ = num_output;
   const int axis = bottom[0]->CanonicalAxisIndex(
       this->layer_param_.inner_product_param().axis());
@@ -70,7 +72,7 @@ void InnerProductLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   top_shape[axis] = N_;
   top[0]->Reshape(top_shape);
   // Set up the bias multiplier
-  if (bias_term_) {
+  if (bias_term_ || output_shift_ != 0) {
     vector<int> bias_shape(1, M_);
     bias_multiplier_.Reshape(bias_shape);
     caffe_set(M_, Dtype(1), bias_multiplier_.mutable_cpu_data());
@@ -81,14 +83,127 @@ template <typename Dtype>
 void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data_discard();
+  if (this->phase_ == TEST) {
+    const SparseMatrix<Dtype>* sparse =
+        sparse_weights_.Get(*this->blobs_[0], N_, K_);
+    if (sparse) {
+      sparse->GemmTransposed(M_, bottom_data, top_data);
+      const Blob<Dtype>* bias = output_bias();
+      if (bias) {
+        for (int m = 0; m < M_; ++m) {
+          caffe_cpu_axpby<Dtype>(N_, (Dtype)1., bias->cpu_data(),
+              output_scale_, top_data + m * N_);
+        }
+      } else if (output_scale_ != 1) {
+        caffe_scal<Dtype>(M_ * N_, output_scale_, top_data);
+      }
+      return;
+    }
+    if (M_ <= kSmallBatch) {
+      Forward_cpu_small(bottom_data, top_data);
+      return;
+    }
+  }
   const Dtype* weight = this->blobs_[0]->cpu_data();
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, output_scale_,
       bottom_data, weight, (Dtype)0., top_data);
-  if (bias_term_) {
+  const Blob<Dtype>* bias = output_bias();
+  if (bias) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
-        bias_multiplier_.cpu_data(),
-        this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
+        bias_multiplier_.cpu_data(), bias->cpu_data(), (Dtype)1., top_data);
+  }
+}
+
+template <typename Dtype>
+const Blob<Dtype>* InnerProductLayer<Dtype>::output_bias() {
+  if (!bias_term_ && output_shift_ == 0) {
+    return NULL;
+  }
+  if (output_scale_ == 1 && output_shift_ == 0) {
+    return this->blobs_[1].get();
+  }
+  // Folded again only when the bias changes, not to copy it to the GPU at
+  // each forward
+  shared_ptr<SyncedMemory> source;
+  if (bias_term_) {
+    source = this->blobs_[1]->data();
+  }
+  if (output_bias_.count() && source == output_bias_source_ &&
+      (!source || source->version() == output_bias_version_)) {
+    return &output_bias_;
+  }
+  vector<int> bias_shape(1, N_);
+  output_bias_.Reshape(bias_shape);
+  Dtype* data = output_bias_.mutable_cpu_data_discard();
+  caffe_set(N_, output_shift_, data);
+  if (bias_term_) {
+    caffe_axpy(N_, output_scale_, this->blobs_[1]->cpu_data(), data);
+  }
+  output_bias_source_ = source;
+  output_bias_version_ = source ? source->version() : 0;
+  return &output_bias_;
+}
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::PackWeights() {
+  const int panels = (N_ + kPanel - 1) / kPanel;
+  vector<int> shape(3);
+  shape[0] = panels;
+  shape[1] = K_;
+  shape[2] = kPanel;
+  packed_weights_.Reshape(shape);
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* packed = packed_weights_.mutable_cpu_data_discard();
+  for (int p = 0; p < panels; ++p) {
+    for (int j = 0; j < kPanel; ++j) {
+      const int n = p * kPanel + j;
+      for (int k = 0; k < K_; ++k) {
+        packed[(p * K_ + k) * kPanel + j] = n < N_ ? weight[n * K_ + k] : 0;
+      }
+    }
+  }
+  packed_source_ = this->blobs_[0]->data();
+  packed_version_ = packed_source_->version();
+}
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::Forward_cpu_small(const Dtype* bottom_data,
+    Dtype* top_data) {
+  if (packed_source_ != this->blobs_[0]->data() ||
+      packed_version_ != packed_source_->version()) {
+    PackWeights();
+  }
+  const Blob<Dtype>* bias_blob = output_bias();
+  const Dtype* bias = bias_blob ? bias_blob->cpu_data() : NULL;
+  const Dtype* packed = packed_weights_.cpu_data();
+  const int panels = packed_weights_.shape(0);
+  Dtype sum[kSmallBatch][kPanel];
+  for (int p = 0; p < panels; ++p) {
+    const int n0 = p * kPanel;
+    const int outputs = N_ - n0 < kPanel ? N_ - n0 : kPanel;
+    for (int m = 0; m < M_; ++m) {
+      for (int j = 0; j < kPanel; ++j) {
+        sum[m][j] = 0;
+      }
+    }
+    const Dtype* panel = packed + p * K_ * kPanel;
+    for (int k = 0; k < K_; ++k) {
+      const Dtype* w = panel + k * kPanel;
+      for (int m = 0; m < M_; ++m) {
+        const Dtype x = bottom_data[m * K_ + k];
+        for (int j = 0; j < kPanel; ++j) {
+          sum[m][j] += x * w[j];
+        }
+      }
+    }
+    // Add the bias on the way out, fused instead of a second gemm
+    for (int m = 0; m < M_; ++m) {
+      for (int j = 0; j < outputs; ++j) {
+        top_data[m * N_ + n0 + j] =
+            output_scale_ * sum[m][j] + (bias ? bias[n0 + j] : 0);
+      }
+    }
   }
 }
 
@@ -100,22 +215,22 @@ void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     const Dtype* bottom_data = bottom[0]->cpu_data();
     // Gradient with respect to weight
-    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, N_, K_, M_, (Dtype)1.,
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, N_, K_, M_, output_scale_,
         top_diff, bottom_data, (Dtype)1., this->blobs_[0]->mutable_cpu_diff());
   }
   if (bias_term_ && this->param_propagate_down_[1]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     // Gradient with respect to bias
-    caffe_cpu_gemv<Dtype>(CblasTrans, M_, N_, (Dtype)1., top_diff,
+    caffe_cpu_gemv<Dtype>(CblasTrans, M_, N_, output_scale_, top_diff,
         bias_multiplier_.cpu_data(), (Dtype)1.,
         this->blobs_[1]->mutable_cpu_diff());
   }
   if (propagate_down[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     // Gradient with respect to bottom data
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, K_, N_, (Dtype)1.,
-        top_diff, this->blobs_[0]->cpu_data(), (Dtype)0.,
-        bottom[0]->mutable_cpu_diff());
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, K_, N_,
+        output_scale_, top_diff, this->blobs_[0]->cpu_data(), (Dtype)0.,
+        bottom[0]->mutable_cpu_diff_discard());
   }
 }
 
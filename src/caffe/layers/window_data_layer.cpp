@@ -279,18 +279,44 @@ void WindowDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
       pair<std::string, vector<int> > image =
           image_database_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
 
+      // Large JPEGs are decoded scaled down, as long as the window still
+      // covers at least crop_size x crop_size if the listed size is right
+      const int image_height = image.second[1];
+      const int image_width = image.second[2];
+      const int min_height = static_cast<int>(ceil(
+          static_cast<float>(crop_size) * image_height /
+          (window[WindowDataLayer<Dtype>::Y2] -
+          window[WindowDataLayer<Dtype>::Y1] + 1)));
+      const int min_width = static_cast<int>(ceil(
+          static_cast<float>(crop_size) * image_width /
+          (window[WindowDataLayer<Dtype>::X2] -
+          window[WindowDataLayer<Dtype>::X1] + 1)));
       cv::Mat cv_img;
+      int decode_scale = 1;
       if (this->cache_images_) {
         pair<std::string, Datum> image_cached =
           image_database_cache_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
-        cv_img = DecodeDatumToCVMat(image_cached.second, true);
+        cv_img = DecodeDatumToCVMat(image_cached.second, min_height,
+            min_width, true, &decode_scale);
       } else {
-        cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
+        Datum encoded;
+        if (ReadFileToDatum(image.first, 0, &encoded)) {
+          cv_img = DecodeDatumToCVMat(encoded, min_height, min_width, true,
+              &decode_scale);
+        }
         if (!cv_img.data) {
           LOG(ERROR) << "Could not open or find file " << image.first;
           return;
         }
       }
+      // Windows are given in the coordinates of the full size image, pixels
+      // of which the scaled decode divides by decode_scale
+      if (decode_scale > 1) {
+        window[WindowDataLayer<Dtype>::Y1] /= decode_scale;
+        window[WindowDataLayer<Dtype>::Y2] /= decode_scale;
+        window[WindowDataLayer<Dtype>::X1] /= decode_scale;
+        window[WindowDataLayer<Dtype>::X2] /= decode_scale;
+      }
       read_time += timer.MicroSeconds();
       timer.Start();
       const int channels = cv_img.channels();
@@ -5,6 +5,7 @@
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
 #include "hdf5.h"
 
 #include "caffe/common.hpp"
@@ -23,19 +24,35 @@ namespace caffe {
 
 template <typename Dtype>
 Net<Dtype>::Net(const NetParameter& param, const Net* root_net)
-    : root_net_(root_net) {
+    : root_net_(root_net), weights_net_(NULL) {
   Init(param);
 }
 
 template <typename Dtype>
 Net<Dtype>::Net(const string& param_file, Phase phase, const Net* root_net)
-    : root_net_(root_net) {
+    : root_net_(root_net), weights_net_(NULL) {
   NetParameter param;
   ReadNetParamsFromTextFileOrDie(param_file, &param);
   param.mutable_state()->set_phase(phase);
   Init(param);
 }
 
+template <typename Dtype>
+Net<Dtype>::Net(const NetParameter& param, const Net& weights_net)
+    : root_net_(NULL), weights_net_(&weights_net) {
+  // Bring the shared weights to a synced state now, as replicas then only
+  // read them and concurrent reads do not modify SyncedMemory.
+  for (int i = 0; i < weights_net.params_.size(); ++i) {
+    weights_net.params_[i]->cpu_data();
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      weights_net.params_[i]->gpu_data();
+    }
+#endif
+  }
+  Init(param);
+}
+
 template <typename Dtype>
 void Net<Dtype>::Init(const NetParameter& in_param) {
   CHECK(Caffe::root_solver() || root_net_)
@@ -46,6 +63,20 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   // the current NetState.
   NetParameter filtered_param;
   FilterNet(in_param, &filtered_param);
+  if (phase_ == TEST && filtered_param.fold_affine()) {
+    NetParameter folded_param;
+    FoldAffineLayers(filtered_param, &folded_param);
+    LOG(INFO) << "Folded " << filtered_param.layer_size() -
+        folded_param.layer_size() << " affine layers";
+    filtered_param.Swap(&folded_param);
+  }
+  if (filtered_param.output_size()) {
+    NetParameter pruned_param;
+    PruneNet(filtered_param, &pruned_param);
+    LOG(INFO) << "Pruned " << filtered_param.layer_size() -
+        pruned_param.layer_size() << " layers not computing the outputs";
+    filtered_param.Swap(&pruned_param);
+  }
   if (Caffe::root_solver()) {
     LOG(INFO) << "Initializing net from parameters: " << std::endl
               << filtered_param.DebugString();
@@ -105,6 +136,9 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     } else {
       layers_.push_back(LayerRegistry<Dtype>::CreateLayer(layer_param));
     }
+    if (weights_net_) {
+      ShareReplicaWeights(layer_id);
+    }
     layer_names_.push_back(layer_param.name());
     if (Caffe::root_solver()) {
       LOG(INFO) << "Creating Layer " << layer_param.name();
@@ -276,7 +310,12 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       }
     }
   }
-  // In the end, all remaining blobs are considered output blobs.
+  // In the end, all remaining blobs are considered output blobs, unless
+  // the outputs were given.
+  if (param.output_size()) {
+    available_blobs.clear();
+    available_blobs.insert(param.output().begin(), param.output().end());
+  }
   for (set<string>::iterator it = available_blobs.begin();
       it != available_blobs.end(); ++it) {
     if (Caffe::root_solver()) {
@@ -293,12 +332,34 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   }
   ShareWeights();
   debug_info_ = param.debug_info();
+  InitLayerGraph();
+  branch_threads_ = 1;
+  set_branch_threads(param.branch_threads());
   if (Caffe::root_solver()) {
     LOG(INFO) << "Network initialization done.";
     LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::ShareReplicaWeights(int layer_id) {
+  const string& layer_name = layers_[layer_id]->layer_param().name();
+  map<string, int>::const_iterator source =
+      weights_net_->layer_names_index_.find(layer_name);
+  if (source == weights_net_->layer_names_index_.end()) {
+    return;
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& source_blobs =
+      weights_net_->layers_[source->second]->blobs();
+  vector<shared_ptr<Blob<Dtype> > >& blobs = layers_[layer_id]->blobs();
+  // Layers skip parameter initialization when their blobs are already set.
+  blobs.resize(source_blobs.size());
+  for (int i = 0; i < source_blobs.size(); ++i) {
+    blobs[i].reset(new Blob<Dtype>(source_blobs[i]->shape()));
+    blobs[i]->ShareData(*source_blobs[i]);
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -400,6 +461,131 @@ bool Net<Dtype>::StateMeetsRule(const NetState& state,
   return true;
 }
 
+// Makes outputs scale * outputs + shift
+template <typename P>
+static void fold_output(P* param, float scale, float shift) {
+  param->set_output_shift(scale * param->output_shift() + shift);
+  param->set_output_scale(scale * param->output_scale());
+}
+
+template <typename Dtype>
+void Net<Dtype>::FoldAffineLayers(const NetParameter& param,
+    NetParameter* param_folded) {
+  NetParameter folded(param);
+  vector<bool> removed(folded.layer_size(), false);
+  for (int i = 0; i < folded.layer_size(); ++i) {
+    const LayerParameter& power = folded.layer(i);
+    if (power.type() != "Power" || power.power_param().power() != 1 ||
+        power.bottom_size() != 1 || power.top_size() != 1 ||
+        power.loss_weight_size()) {
+      continue;
+    }
+    const string& blob = power.bottom(0);
+    int producer = -1;
+    for (int j = i - 1; j >= 0 && producer < 0; --j) {
+      for (int k = 0; !removed[j] && k < folded.layer(j).top_size(); ++k) {
+        if (folded.layer(j).top(k) == blob) {
+          producer = j;
+        }
+      }
+    }
+    if (producer < 0) {
+      continue;
+    }
+    LayerParameter* layer = folded.mutable_layer(producer);
+    const bool is_conv = layer->type() == "Convolution" &&
+        layer->convolution_param().engine() !=
+        ConvolutionParameter_Engine_CUDNN;
+    if (!(is_conv || layer->type() == "InnerProduct") ||
+        layer->top_size() != 1) {
+      continue;
+    }
+    // No other layer may read the unscaled outputs: none between the two,
+    // and none after either unless the Power layer is in place. Requested
+    // outputs of the net read them after all layers.
+    const bool in_place = power.top(0) == blob;
+    bool shared = false;
+    for (int j = 0; j < folded.output_size() && !in_place; ++j) {
+      shared |= folded.output(j) == blob;
+    }
+    for (int j = producer + 1; j < folded.layer_size() && !shared; ++j) {
+      if (j == i || removed[j]) {
+        continue;
+      }
+      if (in_place && j > i) {
+        break;
+      }
+      const LayerParameter& other = folded.layer(j);
+      bool rewrites = false;
+      for (int k = 0; k < other.bottom_size(); ++k) {
+        shared |= other.bottom(k) == blob;
+      }
+      for (int k = 0; k < other.top_size(); ++k) {
+        rewrites |= other.top(k) == blob;
+      }
+      if (rewrites) {
+        break;
+      }
+    }
+    if (shared) {
+      continue;
+    }
+    const PowerParameter& affine = power.power_param();
+    if (is_conv) {
+      fold_output(layer->mutable_convolution_param(), affine.scale(),
+          affine.shift());
+    } else {
+      fold_output(layer->mutable_inner_product_param(), affine.scale(),
+          affine.shift());
+    }
+    layer->set_top(0, power.top(0));
+    removed[i] = true;
+    LOG(INFO) << "Folding " << power.name() << " into " << layer->name();
+  }
+  param_folded->CopyFrom(folded);
+  param_folded->clear_layer();
+  for (int i = 0; i < folded.layer_size(); ++i) {
+    if (!removed[i]) {
+      param_folded->add_layer()->CopyFrom(folded.layer(i));
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PruneNet(const NetParameter& param,
+    NetParameter* param_pruned) {
+  // Walk back from the outputs, keeping the layers computing needed blobs,
+  // whose inputs are then needed in turn
+  set<string> needed(param.output().begin(), param.output().end());
+  vector<bool> keep(param.layer_size(), false);
+  for (int i = param.layer_size() - 1; i >= 0; --i) {
+    const LayerParameter& layer = param.layer(i);
+    for (int j = 0; j < layer.top_size(); ++j) {
+      keep[i] = keep[i] || needed.count(layer.top(j));
+    }
+    if (!keep[i]) {
+      continue;
+    }
+    for (int j = 0; j < layer.top_size(); ++j) {
+      needed.erase(layer.top(j));
+    }
+    needed.insert(layer.bottom().begin(), layer.bottom().end());
+  }
+  for (int i = 0; i < param.input_size(); ++i) {
+    needed.erase(param.input(i));
+  }
+  CHECK(needed.empty()) << "Unknown output or input blob " << *needed.begin();
+  param_pruned->CopyFrom(param);
+  param_pruned->clear_layer();
+  for (int i = 0; i < param.layer_size(); ++i) {
+    if (keep[i]) {
+      param_pruned->add_layer()->CopyFrom(param.layer(i));
+    } else {
+      LOG(INFO) << "Pruning " << param.layer(i).name();
+    }
+  }
+}
+
 // Helper for Net::Init: add a new input or top blob to the net.  (Inputs have
 // layer_id == -1, tops have layer_id >= 0.)
 template <typename Dtype>
@@ -578,6 +764,9 @@ template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
+  if (task_graph_ && !debug_info_ && Caffe::mode() == Caffe::CPU) {
+    return ForwardConcurrent(start, end);
+  }
   Dtype loss = 0;
   if (debug_info_) {
     for (int i = 0; i < net_input_blobs_.size(); ++i) {
@@ -648,6 +837,10 @@ template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  if (task_graph_ && !debug_info_ && Caffe::mode() == Caffe::CPU) {
+    BackwardConcurrent(start, end);
+    return;
+  }
   for (int i = start; i >= end; --i) {
     if (layer_need_backward_[i]) {
       layers_[i]->Backward(
@@ -657,6 +850,164 @@ void Net<Dtype>::BackwardFromTo(int start, int end) {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::set_branch_threads(int threads) {
+  CHECK_GE(threads, 1);
+  branch_threads_ = threads;
+  if (threads > 1) {
+    task_graph_.reset(new TaskGraph(threads));
+  } else {
+    task_graph_.reset();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::InitLayerGraph() {
+  // Layers that alias their tops to their bottom, the data of all of them
+  // is then one resource
+  set<string> aliasing;
+  aliasing.insert("Split");
+  aliasing.insert("Flatten");
+  aliasing.insert("Reshape");
+  vector<int> root(blobs_.size());
+  for (int i = 0; i < blobs_.size(); ++i) {
+    root[i] = i;
+  }
+  for (int i = 0; i < layers_.size(); ++i) {
+    if (aliasing.count(layers_[i]->type()) && bottom_id_vecs_[i].size()) {
+      for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+        root[top_id_vecs_[i][j]] = root[bottom_id_vecs_[i][0]];
+      }
+    }
+  }
+  // Resources are blob roots, then parameters, written by all layers using
+  // them since backward accumulates their diffs
+  const int num_resources = blobs_.size() + params_.size();
+  vector<int> writer(num_resources, -1);
+  vector<vector<int> > readers(num_resources);
+  layer_dependents_.assign(layers_.size(), vector<int>());
+  layer_dependencies_.assign(layers_.size(), vector<int>());
+  for (int i = 0; i < layers_.size(); ++i) {
+    vector<int> reads;
+    vector<int> writes;
+    for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+      reads.push_back(root[bottom_id_vecs_[i][j]]);
+    }
+    for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+      writes.push_back(root[top_id_vecs_[i][j]]);
+    }
+    for (int j = 0; j < param_id_vecs_[i].size(); ++j) {
+      const int id = param_id_vecs_[i][j];
+      const int owner = param_owners_[id] < 0 ? id : param_owners_[id];
+      writes.push_back(blobs_.size() + owner);
+    }
+    set<int> deps;
+    for (int j = 0; j < reads.size(); ++j) {
+      if (writer[reads[j]] >= 0) {
+        deps.insert(writer[reads[j]]);
+      }
+    }
+    for (int j = 0; j < writes.size(); ++j) {
+      if (writer[writes[j]] >= 0) {
+        deps.insert(writer[writes[j]]);
+      }
+      deps.insert(readers[writes[j]].begin(), readers[writes[j]].end());
+    }
+    deps.erase(i);
+    for (set<int>::iterator it = deps.begin(); it != deps.end(); ++it) {
+      layer_dependents_[*it].push_back(i);
+      layer_dependencies_[i].push_back(*it);
+    }
+    for (int j = 0; j < reads.size(); ++j) {
+      readers[reads[j]].push_back(i);
+    }
+    for (int j = 0; j < writes.size(); ++j) {
+      writer[writes[j]] = i;
+      readers[writes[j]].clear();
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ForwardLayer(int start, int index, vector<Dtype>* losses) {
+  const int i = start + index;
+  (*losses)[index] = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+}
+
+template <typename Dtype>
+void Net<Dtype>::BackwardLayer(int end, int index) {
+  const int i = end + index;
+  if (layer_need_backward_[i]) {
+    layers_[i]->Backward(
+        top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+  }
+}
+
+// Task graph of layers start to end, edges[i] listing the layers to run
+// after layer i
+static void LayerTasks(const vector<vector<int> >& edges, int start, int end,
+    vector<vector<int> >* dependents, vector<int>* num_deps) {
+  dependents->assign(end - start + 1, vector<int>());
+  num_deps->assign(end - start + 1, 0);
+  for (int i = start; i <= end; ++i) {
+    for (int j = 0; j < edges[i].size(); ++j) {
+      if (edges[i][j] >= start && edges[i][j] <= end) {
+        (*dependents)[i - start].push_back(edges[i][j] - start);
+        ++(*num_deps)[edges[i][j] - start];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+Dtype Net<Dtype>::ForwardConcurrent(int start, int end) {
+  // Allocate inputs from outside the range first, as concurrent readers
+  // would race to allocate them. Tops are left to their layer, which may
+  // overwrite them without initializing them first.
+  vector<bool> produced(blobs_.size(), false);
+  for (int i = start; i <= end; ++i) {
+    for (int j = 0; j < bottom_vecs_[i].size(); ++j) {
+      if (!produced[bottom_id_vecs_[i][j]]) {
+        bottom_vecs_[i][j]->cpu_data();
+      }
+    }
+    for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+      produced[top_id_vecs_[i][j]] = true;
+    }
+  }
+  vector<vector<int> > dependents;
+  vector<int> num_deps;
+  LayerTasks(layer_dependents_, start, end, &dependents, &num_deps);
+  vector<Dtype> losses(end - start + 1);
+  task_graph_->Run(dependents, num_deps,
+      boost::bind(&Net<Dtype>::ForwardLayer, this, start, _1, &losses));
+  Dtype loss = 0;
+  for (int i = 0; i < losses.size(); ++i) {
+    loss += losses[i];
+  }
+  return loss;
+}
+
+template <typename Dtype>
+void Net<Dtype>::BackwardConcurrent(int start, int end) {
+  for (int i = end; i <= start; ++i) {
+    for (int j = 0; j < bottom_vecs_[i].size(); ++j) {
+      bottom_vecs_[i][j]->cpu_data();
+      bottom_vecs_[i][j]->cpu_diff();
+    }
+    for (int j = 0; j < top_vecs_[i].size(); ++j) {
+      top_vecs_[i][j]->cpu_data();
+      top_vecs_[i][j]->cpu_diff();
+    }
+  }
+  // Backward runs layers in the reverse order of forward
+  vector<vector<int> > dependents;
+  vector<int> num_deps;
+  LayerTasks(layer_dependencies_, end, start, &dependents, &num_deps);
+  task_graph_->Run(dependents, num_deps,
+      boost::bind(&Net<Dtype>::BackwardLayer, this, end, _1));
+}
+
 template <typename Dtype>
 void Net<Dtype>::InputDebugInfo(const int input_id) {
   const Blob<Dtype>& blob = *net_input_blobs_[input_id];
@@ -850,6 +1201,9 @@ void Net<Dtype>::CopyTrainedLayersFrom(const string trained_filename) {
   if (trained_filename.size() >= 3 &&
       trained_filename.compare(trained_filename.size() - 3, 3, ".h5") == 0) {
     CopyTrainedLayersFromHDF5(trained_filename);
+  } else if (trained_filename.size() >= 5 &&
+      trained_filename.compare(trained_filename.size() - 5, 5, ".mmap") == 0) {
+    CopyTrainedLayersFromMapped(trained_filename);
   } else {
     CopyTrainedLayersFromBinaryProto(trained_filename);
   }
@@ -913,6 +1267,42 @@ void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
   H5Fclose(file_hid);
 }
 
+template <typename Dtype>
+void Net<Dtype>::CopyTrainedLayersFromMapped(const string trained_filename) {
+  shared_ptr<MappedWeights> weights(new MappedWeights(trained_filename));
+  const NetParameter& param = weights->param();
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& source_layer = param.layer(i);
+    const string& source_layer_name = source_layer.name();
+    if (!layer_names_index_.count(source_layer_name)) {
+      DLOG(INFO) << "Ignoring source layer " << source_layer_name;
+      continue;
+    }
+    int target_layer_id = layer_names_index_[source_layer_name];
+    DLOG(INFO) << "Mapping source layer " << source_layer_name;
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layers_[target_layer_id]->blobs();
+    CHECK_EQ(target_blobs.size(), source_layer.blobs_size())
+        << "Incompatible number of blobs for layer " << source_layer_name;
+    for (int j = 0; j < target_blobs.size(); ++j) {
+      Blob<Dtype>* blob = target_blobs[j].get();
+      CHECK(blob->ShapeEquals(source_layer.blobs(j)))
+          << "Shape mismatch for blob " << j << " of layer "
+          << source_layer_name;
+      if (weights->value_size() == sizeof(Dtype)) {
+        blob->set_cpu_data(reinterpret_cast<Dtype*>(weights->data(i, j)));
+      } else if (weights->value_size() == sizeof(float)) {
+        const float* values = reinterpret_cast<float*>(weights->data(i, j));
+        std::copy(values, values + blob->count(), blob->mutable_cpu_data());
+      } else {
+        const double* values = reinterpret_cast<double*>(weights->data(i, j));
+        std::copy(values, values + blob->count(), blob->mutable_cpu_data());
+      }
+    }
+  }
+  mapped_weights_.push_back(weights);
+}
+
 template <typename Dtype>
 void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
   param->Clear();
@@ -991,6 +1381,13 @@ void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
   H5Fclose(file_hid);
 }
 
+template <typename Dtype>
+void Net<Dtype>::ToMappedWeights(const string& filename) const {
+  NetParameter param;
+  ToProto(&param, false);
+  WriteMappedWeights(param, filename);
+}
+
 template <typename Dtype>
 void Net<Dtype>::Update() {
   for (int i = 0; i < learnable_params_.size(); ++i) {
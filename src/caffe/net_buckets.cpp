@@ -0,0 +1,113 @@
+#include <vector>
+
+#include "caffe/net_buckets.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Copies src to the start of each axis of the larger dst
+template <typename Dtype>
+static void pad_copy(const Blob<Dtype>& src, const Dtype* src_data,
+    const Blob<Dtype>& dst, Dtype* dst_data, int axis) {
+  if (axis >= src.num_axes() - 1) {
+    caffe_copy(src.count(axis), src_data, dst_data);
+    return;
+  }
+  const int src_stride = src.count(axis + 1);
+  const int dst_stride = dst.count(axis + 1);
+  for (int i = 0; i < src.shape(axis); ++i) {
+    pad_copy(src, src_data + i * src_stride, dst, dst_data + i * dst_stride,
+        axis + 1);
+  }
+}
+
+template <typename Dtype>
+NetBuckets<Dtype>::NetBuckets(const NetParameter& param,
+    const Net<Dtype>& weights_net, const vector<vector<int> >& shapes)
+    : shapes_(shapes) {
+  CHECK_GT(param.input_size(), 0) << "Bucketed nets need an input";
+  NetParameter bucket_param(param);
+  if (param.input_dim_size() > 0) {
+    // Use input_shape for all inputs, to set the first one per bucket
+    bucket_param.clear_input_dim();
+    for (int i = 0; i < param.input_size(); ++i) {
+      BlobShape* shape = bucket_param.add_input_shape();
+      for (int j = 0; j < 4; ++j) {
+        shape->add_dim(param.input_dim(i * 4 + j));
+      }
+    }
+  }
+  for (int i = 0; i < shapes_.size(); ++i) {
+    BlobShape* shape = bucket_param.mutable_input_shape(0);
+    shape->clear_dim();
+    for (int j = 0; j < shapes_[i].size(); ++j) {
+      shape->add_dim(shapes_[i][j]);
+    }
+    nets_.push_back(shared_ptr<Net<Dtype> >(
+        new Net<Dtype>(bucket_param, weights_net)));
+    // Allocate all buffers now rather than on the first request
+    nets_[i]->ForwardPrefilled();
+    LOG(INFO) << "Bucket " << nets_[i]->input_blobs()[0]->shape_string()
+        << " uses " << memory_used(i) << " bytes";
+  }
+}
+
+template <typename Dtype>
+int NetBuckets<Dtype>::Find(const vector<int>& shape) const {
+  int best = -1;
+  size_t best_count = 0;
+  for (int i = 0; i < shapes_.size(); ++i) {
+    if (shapes_[i].size() != shape.size()) {
+      continue;
+    }
+    bool fits = true;
+    size_t count = 1;
+    for (int j = 0; j < shape.size(); ++j) {
+      fits &= shape[j] <= shapes_[i][j];
+      count *= shapes_[i][j];
+    }
+    if (fits && (best < 0 || count < best_count)) {
+      best = i;
+      best_count = count;
+    }
+  }
+  return best;
+}
+
+template <typename Dtype>
+const vector<Blob<Dtype>*>& NetBuckets<Dtype>::Forward(
+    const Blob<Dtype>& input, int* bucket) {
+  const int i = Find(input.shape());
+  CHECK_GE(i, 0) << "No bucket holds input " << input.shape_string();
+  if (bucket) {
+    *bucket = i;
+  }
+  Blob<Dtype>* blob = nets_[i]->input_blobs()[0];
+  if (input.shape() == blob->shape()) {
+    caffe_copy(input.count(), input.cpu_data(), blob->mutable_cpu_data());
+  } else {
+    Dtype* data = blob->mutable_cpu_data();
+    caffe_set(blob->count(), Dtype(0), data);
+    pad_copy(input, input.cpu_data(), *blob, data, 0);
+  }
+  return nets_[i]->ForwardPrefilled();
+}
+
+template <typename Dtype>
+size_t NetBuckets<Dtype>::memory_used(int i) const {
+  size_t bytes = 0;
+  const vector<shared_ptr<Blob<Dtype> > >& blobs = nets_[i]->blobs();
+  for (int j = 0; j < blobs.size(); ++j) {
+    if (blobs[j]->data()->head() != SyncedMemory::UNINITIALIZED) {
+      bytes += blobs[j]->data()->size();
+    }
+    if (blobs[j]->diff()->head() != SyncedMemory::UNINITIALIZED) {
+      bytes += blobs[j]->diff()->size();
+    }
+  }
+  return bytes;
+}
+
+INSTANTIATE_CLASS(NetBuckets);
+
+}  // namespace caffe
@@ -0,0 +1,270 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <set>
+#include <vector>
+
+#include "caffe/internal_thread.hpp"
+#include "caffe/net_pipeline.hpp"
+#include "caffe/util/benchmark.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class NetPipeline<Dtype>::Stage : public InternalThread {
+ public:
+  Stage(Net<Dtype>* net, int start, int end,
+      BlockingQueue<MicroBatch*>* in, BlockingQueue<MicroBatch*>* out)
+      : net_(net), start_(start), end_(end), in_(in), out_(out) {}
+  virtual ~Stage() {
+    StopInternalThread();
+  }
+
+  // Blobs copied from the micro-batch before running, and to it after.
+  // Copies rather than sharing the buffers, as layers like Split and
+  // Reshape share their tops' data with their bottoms.
+  vector<int> in_ids_;
+  vector<int> out_ids_;
+  vector<int> cores_;
+
+ protected:
+  virtual void InternalThreadEntry() {
+#ifdef __linux__
+    if (cores_.size()) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (int i = 0; i < cores_.size(); ++i) {
+        CPU_SET(cores_[i], &set);
+      }
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+    try {
+      while (!must_stop()) {
+        MicroBatch* batch = in_->pop();
+        for (int i = 0; i < in_ids_.size(); ++i) {
+          const int id = in_ids_[i];
+          net_->blobs()[id]->CopyFrom(*batch->blobs_[id]);
+        }
+        net_->ForwardFromTo(start_, end_);
+        for (int i = 0; i < out_ids_.size(); ++i) {
+          const int id = out_ids_[i];
+          batch->blobs_[id]->CopyFrom(*net_->blobs()[id]);
+        }
+        out_->push(batch);
+      }
+    } catch (boost::thread_interrupted&) {
+      // Interrupted exception is expected on shutdown
+    }
+  }
+
+  Net<Dtype>* net_;
+  const int start_;
+  const int end_;
+  BlockingQueue<MicroBatch*>* in_;
+  BlockingQueue<MicroBatch*>* out_;
+};
+
+template <typename Dtype>
+NetPipeline<Dtype>::NetPipeline(const NetParameter& param,
+    const Net<Dtype>& weights_net, int stages, bool pin_cores) {
+  // Profile on a first replica, then split the layers by cost
+  nets_.push_back(shared_ptr<Net<Dtype> >(
+      new Net<Dtype>(param, weights_net)));
+  starts_ = Partition(Profile(nets_[0].get(), 5), stages);
+  Init(param, weights_net, pin_cores);
+}
+
+template <typename Dtype>
+NetPipeline<Dtype>::NetPipeline(const NetParameter& param,
+    const Net<Dtype>& weights_net, const vector<int>& starts, bool pin_cores)
+    : starts_(starts) {
+  Init(param, weights_net, pin_cores);
+}
+
+template <typename Dtype>
+NetPipeline<Dtype>::~NetPipeline() {
+  // Stop the threads before their queues and nets go
+  for (int i = 0; i < stages_.size(); ++i) {
+    stages_[i]->StopInternalThread();
+  }
+}
+
+template <typename Dtype>
+void NetPipeline<Dtype>::Init(const NetParameter& param,
+    const Net<Dtype>& weights_net, bool pin_cores) {
+  const int num_stages = starts_.size();
+  CHECK_GT(num_stages, 0);
+  CHECK_EQ(starts_[0], 0);
+  while (nets_.size() < num_stages) {
+    nets_.push_back(shared_ptr<Net<Dtype> >(
+        new Net<Dtype>(param, weights_net)));
+  }
+  const Net<Dtype>& net = *nets_[0];
+  const int num_layers = net.layers().size();
+  vector<int> ends(num_stages);
+  for (int s = 0; s < num_stages; ++s) {
+    ends[s] = (s + 1 < num_stages ? starts_[s + 1] : num_layers) - 1;
+    CHECK_LE(starts_[s], ends[s]) << "Pipeline stages cannot be empty";
+  }
+
+  // Find the blobs passed between stages: consumed by a stage after the one
+  // which last wrote them. Inputs are written by the caller, stage -1.
+  vector<std::set<int> > in_ids(num_stages);
+  vector<std::set<int> > out_ids(num_stages);
+  std::set<int> batch_ids;
+  vector<int> writer(net.blobs().size(), -1);
+  for (int s = 0; s < num_stages; ++s) {
+    for (int i = starts_[s]; i <= ends[s]; ++i) {
+      for (int j = 0; j < net.bottom_ids(i).size(); ++j) {
+        const int id = net.bottom_ids(i)[j];
+        if (writer[id] < s) {
+          in_ids[s].insert(id);
+          batch_ids.insert(id);
+          if (writer[id] >= 0) {
+            out_ids[writer[id]].insert(id);
+          }
+        }
+      }
+      for (int j = 0; j < net.top_ids(i).size(); ++j) {
+        writer[net.top_ids(i)[j]] = s;
+      }
+    }
+  }
+  for (int i = 0; i < net.output_blob_indices().size(); ++i) {
+    const int id = net.output_blob_indices()[i];
+    batch_ids.insert(id);
+    if (writer[id] >= 0) {
+      out_ids[writer[id]].insert(id);
+    }
+  }
+  for (int i = 0; i < net.input_blob_indices().size(); ++i) {
+    batch_ids.insert(net.input_blob_indices()[i]);
+  }
+
+  // One micro-batch per stage, and one being filled or read by the caller
+  for (int b = 0; b <= num_stages; ++b) {
+    shared_ptr<MicroBatch> batch(new MicroBatch());
+    batch->blobs_.resize(net.blobs().size());
+    for (std::set<int>::iterator it = batch_ids.begin();
+         it != batch_ids.end(); ++it) {
+      batch->blobs_[*it].reset(new Blob<Dtype>(net.blobs()[*it]->shape()));
+    }
+    batches_.push_back(batch);
+    free_.push(batch.get());
+  }
+  for (int s = 0; s <= num_stages; ++s) {
+    queues_.push_back(shared_ptr<BlockingQueue<MicroBatch*> >(
+        new BlockingQueue<MicroBatch*>()));
+  }
+  const int cores = boost::thread::hardware_concurrency();
+  for (int s = 0; s < num_stages; ++s) {
+    shared_ptr<Stage> stage(new Stage(nets_[s].get(), starts_[s], ends[s],
+        queues_[s].get(), queues_[s + 1].get()));
+    stage->in_ids_.assign(in_ids[s].begin(), in_ids[s].end());
+    stage->out_ids_.assign(out_ids[s].begin(), out_ids[s].end());
+    if (pin_cores && cores > 0) {
+      const int first = s * cores / num_stages;
+      const int last = std::max((s + 1) * cores / num_stages, first + 1);
+      for (int c = first; c < last; ++c) {
+        stage->cores_.push_back(c % cores);
+      }
+    }
+    LOG(INFO) << "Pipeline stage " << s << ": layers "
+        << net.layer_names()[starts_[s]] << " to "
+        << net.layer_names()[ends[s]] << ", " << in_ids[s].size()
+        << " blobs in, " << out_ids[s].size() << " out";
+    stages_.push_back(stage);
+  }
+  for (int s = 0; s < num_stages; ++s) {
+    stages_[s]->StartInternalThread();
+  }
+}
+
+template <typename Dtype>
+void NetPipeline<Dtype>::Push(const vector<Blob<Dtype>*>& inputs) {
+  const Net<Dtype>& net = *nets_[0];
+  CHECK_EQ(inputs.size(), net.input_blob_indices().size());
+  MicroBatch* batch = free_.pop();
+  for (int i = 0; i < inputs.size(); ++i) {
+    Blob<Dtype>* blob = batch->blobs_[net.input_blob_indices()[i]].get();
+    CHECK(inputs[i]->shape() == blob->shape())
+        << "Pipeline inputs must have the shape of the net inputs, "
+        << blob->shape_string();
+    blob->CopyFrom(*inputs[i]);
+  }
+  queues_[0]->push(batch);
+}
+
+template <typename Dtype>
+void NetPipeline<Dtype>::Pop(const vector<Blob<Dtype>*>& outputs) {
+  const Net<Dtype>& net = *nets_[0];
+  CHECK_EQ(outputs.size(), net.output_blob_indices().size());
+  MicroBatch* batch = queues_.back()->pop();
+  for (int i = 0; i < outputs.size(); ++i) {
+    outputs[i]->CopyFrom(*batch->blobs_[net.output_blob_indices()[i]],
+        false, true);
+  }
+  free_.push(batch);
+}
+
+template <typename Dtype>
+vector<double> NetPipeline<Dtype>::Profile(Net<Dtype>* net,
+    int iterations) {
+  const int num_layers = net->layers().size();
+  vector<double> costs(num_layers, 0);
+  // Allocate everything first
+  net->ForwardPrefilled();
+  Timer timer;
+  for (int iter = 0; iter < iterations; ++iter) {
+    for (int i = 0; i < num_layers; ++i) {
+      timer.Start();
+      net->ForwardFromTo(i, i);
+      costs[i] += timer.MilliSeconds() / iterations;
+    }
+  }
+  return costs;
+}
+
+template <typename Dtype>
+vector<int> NetPipeline<Dtype>::Partition(const vector<double>& costs,
+    int stages) {
+  const int n = costs.size();
+  CHECK_GT(stages, 0);
+  CHECK_LE(stages, n) << "More pipeline stages than layers";
+  vector<double> sum(n + 1, 0);
+  for (int i = 0; i < n; ++i) {
+    sum[i + 1] = sum[i] + costs[i];
+  }
+  // best[s][i]: smallest largest cost splitting the first i layers in s
+  // stages, start[s][i]: the start of the last of these stages
+  const double kInf = std::numeric_limits<double>::max();
+  vector<vector<double> > best(stages + 1, vector<double>(n + 1, kInf));
+  vector<vector<int> > start(stages + 1, vector<int>(n + 1, 0));
+  best[0][0] = 0;
+  for (int s = 1; s <= stages; ++s) {
+    for (int i = s; i <= n; ++i) {
+      for (int j = s - 1; j < i; ++j) {
+        if (best[s - 1][j] == kInf) {
+          continue;
+        }
+        const double cost = std::max(best[s - 1][j], sum[i] - sum[j]);
+        if (cost < best[s][i]) {
+          best[s][i] = cost;
+          start[s][i] = j;
+        }
+      }
+    }
+  }
+  vector<int> starts(stages);
+  for (int s = stages, i = n; s > 0; --s) {
+    starts[s - 1] = start[s][i];
+    i = start[s][i];
+  }
+  return starts;
+}
+
+INSTANTIATE_CLASS(NetPipeline);
+
+}  // namespace caffe
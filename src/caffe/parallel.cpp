@@ -1,17 +1,31 @@
 #ifndef CPU_ONLY
 #include <cuda_runtime.h>
 #endif
+#include <errno.h>
 #include <glog/logging.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "boost/algorithm/string.hpp"
 #include "boost/thread.hpp"
 #include "caffe/caffe.hpp"
 #include "caffe/parallel.hpp"
@@ -118,6 +132,34 @@ void GPUParams<Dtype>::configure(Solver<Dtype>* solver) const {
   apply_buffers(net, diff_, size_, replace_gpu_diff);
 }
 
+template<typename Dtype>
+CPUParams<Dtype>::CPUParams(shared_ptr<Solver<Dtype> > root_solver)
+    : Params<Dtype>(root_solver) {
+  CaffeMallocHost(reinterpret_cast<void**>(&data_), size_ * sizeof(Dtype));
+
+  // Copy blob values
+  const vector<Blob<Dtype>*>& net =
+      root_solver->net()->learnable_params();
+  apply_buffers(net, data_, size_, copy);
+
+  CaffeMallocHost(reinterpret_cast<void**>(&diff_), size_ * sizeof(Dtype));
+  caffe_set(size_, Dtype(0), diff_);
+}
+
+template<typename Dtype>
+CPUParams<Dtype>::~CPUParams() {
+  CaffeFreeHost(data_);
+  CaffeFreeHost(diff_);
+}
+
+template<typename Dtype>
+void CPUParams<Dtype>::configure(Solver<Dtype>* solver) const {
+  const vector<Blob<Dtype>*>& net =
+      solver->net()->learnable_params();
+  apply_buffers(net, data_, size_, replace_cpu);
+  apply_buffers(net, diff_, size_, replace_cpu_diff);
+}
+
 void DevicePair::compute(const vector<int> devices, vector<DevicePair>* pairs) {
 #ifndef CPU_ONLY
   vector<int> remaining(devices);
@@ -434,8 +476,523 @@ void P2PSync<Dtype>::run(const vector<int>& gpus) {
   }
 }
 
+//
+
+// Seconds to keep retrying to connect to the next rank, which might not have
+// started listening yet.
+static const int kConnectTimeout = 120;
+
+// Splits "tcp://host:port" or "unix:path" into its components.
+static bool parse_endpoint(const string& endpoint, string* host, int* port,
+                           string* path) {
+  if (endpoint.compare(0, 6, "tcp://") == 0) {
+    size_t colon = endpoint.rfind(':');
+    CHECK(colon != string::npos && colon > 6)
+        << "Missing port in endpoint " << endpoint;
+    *host = endpoint.substr(6, colon - 6);
+    *port = atoi(endpoint.c_str() + colon + 1);
+    CHECK_GT(*port, 0) << "Invalid port in endpoint " << endpoint;
+    return true;
+  }
+  CHECK_EQ(endpoint.compare(0, 5, "unix:"), 0)
+      << "Unknown endpoint " << endpoint
+      << ", expected tcp://host:port or unix:path";
+  *path = endpoint.substr(5);
+  CHECK_LT(path->size(), sizeof(sockaddr_un().sun_path))
+      << "Socket path too long " << *path;
+  return false;
+}
+
+static void set_nodelay(int fd) {
+  int one = 1;
+  CHECK_EQ(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)), 0);
+}
+
+static void write_all(int fd, const void* data, size_t bytes) {
+  const char* ptr = reinterpret_cast<const char*>(data);
+  while (bytes) {
+    ssize_t n = send(fd, ptr, bytes, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(n, 0) << "Socket send failed: " << strerror(errno);
+    ptr += n;
+    bytes -= n;
+  }
+}
+
+static void read_all(int fd, void* data, size_t bytes) {
+  char* ptr = reinterpret_cast<char*>(data);
+  while (bytes) {
+    ssize_t n = recv(fd, ptr, bytes, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(n, 0) << "Socket receive failed: "
+        << (n ? strerror(errno) : "connection closed by peer");
+    ptr += n;
+    bytes -= n;
+  }
+}
+
+SocketRing::SocketRing(const vector<string>& endpoints, int rank)
+    : rank_(rank),
+      size_(endpoints.size()),
+      listen_(-1),
+      next_(-1),
+      prev_(-1),
+      unix_path_(),
+      buffer_(),
+      decoded_(),
+      half_(),
+      bytes_sent_(0) {
+  CHECK_GE(rank_, 0);
+  CHECK_LT(rank_, size_);
+  if (size_ == 1) {
+    return;
+  }
+  string host, path;
+  int port = 0;
+
+  // Listen on own endpoint
+  if (parse_endpoint(endpoints[rank_], &host, &port, &path)) {
+    listen_ = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(listen_, 0) << "Cannot create socket: " << strerror(errno);
+    int one = 1;
+    setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    caffe_memset(sizeof(addr), 0, &addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    int err = bind(listen_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    CHECK_EQ(err, 0)
+        << "Cannot bind " << endpoints[rank_] << ": " << strerror(errno);
+  } else {
+    listen_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK_GE(listen_, 0) << "Cannot create socket: " << strerror(errno);
+    sockaddr_un addr;
+    caffe_memset(sizeof(addr), 0, &addr);
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+    int err = bind(listen_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    CHECK_EQ(err, 0)
+        << "Cannot bind " << endpoints[rank_] << ": " << strerror(errno);
+    unix_path_ = path;
+  }
+  CHECK_EQ(listen(listen_, 1), 0) << "Cannot listen: " << strerror(errno);
+
+  // Connect to next rank, retrying until it listens
+  const string& next = endpoints[(rank_ + 1) % size_];
+  bool tcp = parse_endpoint(next, &host, &port, &path);
+  for (int attempt = 0; next_ < 0; ++attempt) {
+    CHECK_LT(attempt, kConnectTimeout * 10) << "Cannot connect to " << next;
+    int fd = -1;
+    bool connected = false;
+    if (tcp) {
+      addrinfo hints, *info = NULL;
+      caffe_memset(sizeof(hints), 0, &hints);
+      hints.ai_family = AF_INET;
+      hints.ai_socktype = SOCK_STREAM;
+      ostringstream service;
+      service << port;
+      int err = getaddrinfo(host.c_str(), service.str().c_str(), &hints, &info);
+      CHECK_EQ(err, 0) << "Cannot resolve " << host << ": "
+          << gai_strerror(err);
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      connected = connect(fd, info->ai_addr, info->ai_addrlen) == 0;
+      freeaddrinfo(info);
+    } else {
+      sockaddr_un addr;
+      caffe_memset(sizeof(addr), 0, &addr);
+      addr.sun_family = AF_UNIX;
+      strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      connected = connect(fd, reinterpret_cast<sockaddr*>(&addr),
+                          sizeof(addr)) == 0;
+    }
+    CHECK_GE(fd, 0) << "Cannot create socket: " << strerror(errno);
+    if (connected) {
+      next_ = fd;
+    } else {
+      close(fd);
+      usleep(100000);
+    }
+  }
+  if (tcp) {
+    set_nodelay(next_);
+  }
+  // Identify to the next rank
+  int32_t self = rank_;
+  write_all(next_, &self, sizeof(self));
+
+  // Accept previous rank
+  do {
+    prev_ = accept(listen_, NULL, NULL);
+  } while (prev_ < 0 && errno == EINTR);
+  CHECK_GE(prev_, 0) << "Cannot accept connection: " << strerror(errno);
+  if (!unix_path_.size()) {
+    set_nodelay(prev_);
+  }
+  int32_t peer;
+  read_all(prev_, &peer, sizeof(peer));
+  CHECK_EQ(peer, (rank_ + size_ - 1) % size_)
+      << "Unexpected connection from rank " << peer;
+  LOG(INFO) << "Rank " << rank_ << " of " << size_ << " connected to "
+      << next;
+}
+
+SocketRing::~SocketRing() {
+  if (next_ >= 0) {
+    close(next_);
+  }
+  if (prev_ >= 0) {
+    close(prev_);
+  }
+  if (listen_ >= 0) {
+    close(listen_);
+  }
+  if (unix_path_.size()) {
+    unlink(unix_path_.c_str());
+  }
+}
+
+void SocketRing::exchange(const void* send_data, size_t send_bytes,
+                          void* recv_data, size_t recv_bytes) {
+  const char* src = reinterpret_cast<const char*>(send_data);
+  char* dst = reinterpret_cast<char*>(recv_data);
+  size_t sent = 0;
+  size_t received = 0;
+  // Send and receive concurrently, as all ranks send at the same time and
+  // blocking sends could otherwise fill socket buffers around the ring.
+  while (sent < send_bytes || received < recv_bytes) {
+    pollfd fds[2];
+    int count = 0;
+    if (sent < send_bytes) {
+      fds[count].fd = next_;
+      fds[count].events = POLLOUT;
+      fds[count++].revents = 0;
+    }
+    if (received < recv_bytes) {
+      fds[count].fd = prev_;
+      fds[count].events = POLLIN;
+      fds[count++].revents = 0;
+    }
+    int ready = poll(fds, count, -1);
+    if (ready < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(ready, 0) << "Socket poll failed: " << strerror(errno);
+    for (int i = 0; i < count; ++i) {
+      if (!fds[i].revents) {
+        continue;
+      }
+      ssize_t n;
+      if (fds[i].events == POLLOUT) {
+        n = send(next_, src + sent, send_bytes - sent,
+                 MSG_DONTWAIT | MSG_NOSIGNAL);
+      } else {
+        n = recv(prev_, dst + received, recv_bytes - received, MSG_DONTWAIT);
+        CHECK_NE(n, 0) << "Connection closed by rank "
+            << (rank_ + size_ - 1) % size_;
+      }
+      if (n < 0) {
+        CHECK(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            << "Socket transfer failed: " << strerror(errno);
+        continue;
+      }
+      if (fds[i].events == POLLOUT) {
+        sent += n;
+        bytes_sent_ += n;
+      } else {
+        received += n;
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+void SocketRing::allreduce(Dtype* buffer, size_t count) {
+  if (size_ == 1) {
+    return;
+  }
+  // Chunk i spans [offsets[i], offsets[i + 1])
+  vector<size_t> offsets(size_ + 1);
+  for (int i = 0; i <= size_; ++i) {
+    offsets[i] = count * i / size_;
+  }
+  buffer_.resize((count / size_ + 1) * sizeof(Dtype));
+  Dtype* received = reinterpret_cast<Dtype*>(&buffer_[0]);
+
+  // Reduce-scatter: after size - 1 steps, rank r holds the complete sum of
+  // chunk r + 1.
+  for (int step = 0; step < size_ - 1; ++step) {
+    const int send_chunk = (rank_ - step + size_) % size_;
+    const int recv_chunk = (rank_ - step - 1 + size_) % size_;
+    const size_t send_count = offsets[send_chunk + 1] - offsets[send_chunk];
+    const size_t recv_count = offsets[recv_chunk + 1] - offsets[recv_chunk];
+    exchange(buffer + offsets[send_chunk], send_count * sizeof(Dtype),
+             received, recv_count * sizeof(Dtype));
+    Dtype* dst = buffer + offsets[recv_chunk];
+    if (recv_count) {
+      caffe_add<Dtype>(recv_count, received, dst, dst);
+    }
+  }
+  // All-gather: circulate the reduced chunks.
+  for (int step = 0; step < size_ - 1; ++step) {
+    const int send_chunk = (rank_ - step + 1 + size_) % size_;
+    const int recv_chunk = (rank_ - step + size_) % size_;
+    const size_t send_count = offsets[send_chunk + 1] - offsets[send_chunk];
+    const size_t recv_count = offsets[recv_chunk + 1] - offsets[recv_chunk];
+    exchange(buffer + offsets[send_chunk], send_count * sizeof(Dtype),
+             buffer + offsets[recv_chunk], recv_count * sizeof(Dtype));
+  }
+}
+
+template void SocketRing::allreduce<float>(float* buffer, size_t count);
+template void SocketRing::allreduce<double>(double* buffer, size_t count);
+
+template<typename Dtype>
+void SocketRing::allreduce_half(Dtype* buffer, size_t count) {
+  if (size_ == 1) {
+    return;
+  }
+  vector<size_t> offsets(size_ + 1);
+  for (int i = 0; i <= size_; ++i) {
+    offsets[i] = count * i / size_;
+  }
+  half_.resize(count);
+  buffer_.resize((count / size_ + 1) * sizeof(uint16_t));
+  decoded_.resize((count / size_ + 1) * sizeof(Dtype));
+  uint16_t* half = &half_[0];
+  uint16_t* received = reinterpret_cast<uint16_t*>(&buffer_[0]);
+  Dtype* values = reinterpret_cast<Dtype*>(&decoded_[0]);
+
+  // Reduce-scatter, same as allreduce but converting chunks on the wire
+  for (int step = 0; step < size_ - 1; ++step) {
+    const int send_chunk = (rank_ - step + size_) % size_;
+    const int recv_chunk = (rank_ - step - 1 + size_) % size_;
+    const size_t send_count = offsets[send_chunk + 1] - offsets[send_chunk];
+    const size_t recv_count = offsets[recv_chunk + 1] - offsets[recv_chunk];
+    caffe_cpu_to_half<Dtype>(send_count, buffer + offsets[send_chunk],
+                             half + offsets[send_chunk]);
+    exchange(half + offsets[send_chunk], send_count * sizeof(uint16_t),
+             received, recv_count * sizeof(uint16_t));
+    if (recv_count) {
+      caffe_cpu_from_half<Dtype>(recv_count, received, values);
+      Dtype* dst = buffer + offsets[recv_chunk];
+      caffe_add<Dtype>(recv_count, values, dst, dst);
+    }
+  }
+  // Convert the reduced chunk, then circulate chunks in half precision and
+  // convert them all back, so every rank ends up with the same values.
+  const int chunk = (rank_ + 1) % size_;
+  caffe_cpu_to_half<Dtype>(offsets[chunk + 1] - offsets[chunk],
+                           buffer + offsets[chunk], half + offsets[chunk]);
+  for (int step = 0; step < size_ - 1; ++step) {
+    const int send_chunk = (rank_ - step + 1 + size_) % size_;
+    const int recv_chunk = (rank_ - step + size_) % size_;
+    const size_t send_count = offsets[send_chunk + 1] - offsets[send_chunk];
+    const size_t recv_count = offsets[recv_chunk + 1] - offsets[recv_chunk];
+    exchange(half + offsets[send_chunk], send_count * sizeof(uint16_t),
+             half + offsets[recv_chunk], recv_count * sizeof(uint16_t));
+  }
+  caffe_cpu_from_half<Dtype>(count, half, buffer);
+}
+
+template void SocketRing::allreduce_half<float>(float* buffer, size_t count);
+template void SocketRing::allreduce_half<double>(double* buffer,
+                                                 size_t count);
+
+void SocketRing::allgather(const void* send, size_t bytes, void* recv) {
+  char* blocks = reinterpret_cast<char*>(recv);
+  memcpy(blocks + rank_ * bytes, send, bytes);  // NOLINT(caffe/alt_fn)
+  // Forward the block received at the previous step
+  for (int step = 0; step < size_ - 1; ++step) {
+    const int send_block = (rank_ - step + size_) % size_;
+    const int recv_block = (rank_ - step - 1 + size_) % size_;
+    exchange(blocks + send_block * bytes, bytes,
+             blocks + recv_block * bytes, bytes);
+  }
+}
+
+void SocketRing::broadcast(void* buffer, size_t bytes) {
+  if (size_ == 1) {
+    return;
+  }
+  if (rank_ != 0) {
+    read_all(prev_, buffer, bytes);
+  }
+  if (rank_ != size_ - 1) {
+    write_all(next_, buffer, bytes);
+    bytes_sent_ += bytes;
+  }
+}
+
+void SocketRing::expand(const string& spec, int count,
+                        vector<string>* endpoints) {
+  vector<string> list;
+  boost::split(list, spec, boost::is_any_of(","));
+  if (list.size() > 1) {
+    CHECK(count <= 0 || list.size() == count) << list.size()
+        << " endpoints given for " << count << " processes, give one per "
+        << "process or a single one";
+    *endpoints = list;
+    return;
+  }
+  if (count <= 0) {
+    count = 1;
+  }
+  string host, path;
+  int port = 0;
+  bool tcp = parse_endpoint(spec, &host, &port, &path);
+  endpoints->clear();
+  for (int i = 0; i < count; ++i) {
+    ostringstream s;
+    if (tcp) {
+      s << "tcp://" << host << ":" << port + i;
+    } else {
+      s << "unix:" << path << "." << i;
+    }
+    endpoints->push_back(s.str());
+  }
+}
+
+//
+
+// Gradient value sent by top-k compression
+struct SparseGradient {
+  int32_t index;
+  float value;
+};
+
+// Orders indices by decreasing magnitude of the values they point to
+template<typename Dtype>
+class MagnitudeGreater {
+ public:
+  explicit MagnitudeGreater(const Dtype* values)
+      : values_(values) {
+  }
+  inline bool operator()(int a, int b) const {
+    return std::fabs(values_[a]) > std::fabs(values_[b]);
+  }
+
+ protected:
+  const Dtype* values_;
+};
+
+template<typename Dtype>
+SocketSync<Dtype>::SocketSync(shared_ptr<Solver<Dtype> > root_solver,
+                              const vector<string>& endpoints, int rank)
+    : CPUParams<Dtype>(root_solver),
+      solver_(root_solver),
+      ring_(endpoints, rank),
+      compression_(root_solver->param().gradient_compression()),
+      reported_iter_(0),
+      reported_bytes_(0) {
+  CHECK(Caffe::mode() == Caffe::CPU)
+      << "Multi-process training is only supported in CPU mode";
+  if (compression_ == SolverParameter_GradientCompression_TOPK) {
+    const float ratio = solver_->param().gradient_topk_ratio();
+    CHECK_GT(ratio, 0) << "gradient_topk_ratio must be positive";
+    CHECK_LE(ratio, 1) << "gradient_topk_ratio must be at most 1";
+    CHECK_LE(size_, static_cast<size_t>(INT_MAX))
+        << "Too many parameters for top-k indices";
+    residual_.resize(size_);
+    indices_.resize(size_);
+    for (int i = 0; i < indices_.size(); ++i) {
+      indices_[i] = i;
+    }
+  }
+  this->configure(solver_.get());
+  solver_->add_callback(this);
+}
+
+template<typename Dtype>
+void SocketSync<Dtype>::run() {
+  // Start from the same weights on all processes
+  ring_.broadcast(data_, size_ * sizeof(Dtype));
+  reported_iter_ = solver_->iter();
+  reported_bytes_ = ring_.bytes_sent();
+
+  LOG(INFO)<< "Starting Optimization";
+  solver_->Solve();
+}
+
+template<typename Dtype>
+void SocketSync<Dtype>::on_start() {
+}
+
+template<typename Dtype>
+void SocketSync<Dtype>::on_gradients_ready() {
+  switch (compression_) {
+  case SolverParameter_GradientCompression_NONE:
+    ring_.allreduce(diff_, size_);
+    break;
+  case SolverParameter_GradientCompression_FP16:
+    ring_.allreduce_half(diff_, size_);
+    break;
+  case SolverParameter_GradientCompression_TOPK:
+    allreduce_topk();
+    break;
+  default:
+    LOG(FATAL) << "Unknown gradient compression: " << compression_;
+  }
+  // Loss functions divide gradients by the batch size, so to compensate
+  // for split batch, average over processes.
+  caffe_scal<Dtype>(size_, Dtype(1.0 / ring_.size()), diff_);
+
+  const int display = solver_->param().display();
+  if (display && solver_->iter() % display == 0) {
+    // Compare to the bytes an uncompressed ring all-reduce sends
+    const int iters = solver_->iter() + 1 - reported_iter_;
+    const double sent = static_cast<double>(ring_.bytes_sent()
+        - reported_bytes_) / iters;
+    const double dense = 2.0 * (ring_.size() - 1) / ring_.size()
+        * size_ * sizeof(Dtype);
+    LOG(INFO) << "Rank " << ring_.rank() << " sent " << sent / 1e6
+        << " MB/iter, " << 100.0 * sent / dense << "% of uncompressed";
+    reported_iter_ = solver_->iter() + 1;
+    reported_bytes_ = ring_.bytes_sent();
+  }
+}
+
+template<typename Dtype>
+void SocketSync<Dtype>::allreduce_topk() {
+  const size_t k = std::max<size_t>(1,
+      size_ * solver_->param().gradient_topk_ratio());
+  // Error feedback: add the values held back at previous iterations
+  Dtype* residual = &residual_[0];
+  caffe_add<Dtype>(size_, diff_, residual, residual);
+  if (k < size_) {
+    std::nth_element(indices_.begin(), indices_.begin() + k, indices_.end(),
+                     MagnitudeGreater<Dtype>(residual));
+  }
+  sparse_.resize(k * sizeof(SparseGradient));
+  SparseGradient* sparse = reinterpret_cast<SparseGradient*>(&sparse_[0]);
+  for (size_t i = 0; i < k; ++i) {
+    const int index = indices_[i];
+    sparse[i].index = index;
+    sparse[i].value = residual[index];
+    // Keeps the rounding error if Dtype is double
+    residual[index] -= sparse[i].value;
+  }
+  gathered_.resize(ring_.size() * sparse_.size());
+  ring_.allgather(sparse, sparse_.size(), &gathered_[0]);
+  // Sum in rank order so all ranks compute the same gradient
+  const SparseGradient* all =
+      reinterpret_cast<const SparseGradient*>(&gathered_[0]);
+  caffe_set<Dtype>(size_, Dtype(0), diff_);
+  for (size_t i = 0; i < k * ring_.size(); ++i) {
+    diff_[all[i].index] += all[i].value;
+  }
+}
+
 INSTANTIATE_CLASS(Params);
+INSTANTIATE_CLASS(CPUParams);
 INSTANTIATE_CLASS(GPUParams);
 INSTANTIATE_CLASS(P2PSync);
+INSTANTIATE_CLASS(SocketSync);
 
 }  // namespace caffe
@@ -6,6 +6,12 @@
 
 namespace caffe {
 
+#ifdef DEBUG
+bool SyncedMemory::poison_ = true;
+#else
+bool SyncedMemory::poison_ = false;
+#endif
+
 SyncedMemory::~SyncedMemory() {
   if (cpu_ptr_ && own_cpu_data_) {
     CaffeFreeHost(cpu_ptr_);
@@ -85,6 +91,7 @@ const void* SyncedMemory::cpu_data() {
 
 void SyncedMemory::set_cpu_data(void* data) {
   CHECK(data);
+  ++version_;
   if (own_cpu_data_) {
     CaffeFreeHost(cpu_ptr_);
   }
@@ -105,6 +112,7 @@ const void* SyncedMemory::gpu_data() {
 void SyncedMemory::set_gpu_data(void* data) {
 #ifndef CPU_ONLY
   CHECK(data);
+  ++version_;
   if (own_gpu_data_) {
     int initial_device;
     cudaGetDevice(&initial_device);
@@ -123,13 +131,37 @@ void SyncedMemory::set_gpu_data(void* data) {
 }
 
 void* SyncedMemory::mutable_cpu_data() {
+  ++version_;
   to_cpu();
   head_ = HEAD_AT_CPU;
   return cpu_ptr_;
 }
 
+void* SyncedMemory::mutable_cpu_data_discard() {
+  ++version_;
+  switch (head_) {
+  case UNINITIALIZED:
+  case HEAD_AT_GPU:
+    if (cpu_ptr_ == NULL) {
+      CaffeMallocHost(&cpu_ptr_, size_);
+      own_cpu_data_ = true;
+    }
+    break;
+  case HEAD_AT_CPU:
+  case SYNCED:
+    break;
+  }
+  if (poison_) {
+    // All bytes set is a NaN for both float and double
+    caffe_memset(size_, 0xFF, cpu_ptr_);
+  }
+  head_ = HEAD_AT_CPU;
+  return cpu_ptr_;
+}
+
 void* SyncedMemory::mutable_gpu_data() {
 #ifndef CPU_ONLY
+  ++version_;
   to_gpu();
   head_ = HEAD_AT_GPU;
   return gpu_ptr_;
@@ -35,6 +35,8 @@ int main(int argc, char** argv) {
   cout << "Current device id: " << device << endl;
   cudaGetDeviceProperties(&CAFFE_TEST_CUDA_PROP, device);
 #endif
+  // Catch layers reading memory they only asked to write
+  caffe::SyncedMemory::set_poison(true);
   // invoke the test.
   return RUN_ALL_TESTS();
 }
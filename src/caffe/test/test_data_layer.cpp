@@ -38,13 +38,18 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
 
   // Fill the DB with data: if unique_pixels, each pixel is unique but
   // all images are the same; else each image is unique but all pixels within
-  // an image are the same.
+  // an image are the same. Sharded DBs are filled in turn.
   void Fill(const bool unique_pixels, DataParameter_DB backend) {
     backend_ = backend;
     LOG(INFO) << "Using temporary dataset " << *filename_;
-    scoped_ptr<db::DB> db(db::GetDB(backend));
-    db->Open(*filename_, db::NEW);
-    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    const vector<string> shards = db::ShardNames(*filename_);
+    vector<shared_ptr<db::DB> > dbs;
+    vector<shared_ptr<db::Transaction> > txns;
+    for (int i = 0; i < shards.size(); ++i) {
+      dbs.push_back(shared_ptr<db::DB>(db::GetDB(backend)));
+      dbs[i]->Open(shards[i], db::NEW);
+      txns.push_back(shared_ptr<db::Transaction>(dbs[i]->NewTransaction()));
+    }
     for (int i = 0; i < 5; ++i) {
       Datum datum;
       datum.set_label(i);
@@ -60,13 +65,15 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
       ss << i;
       string out;
       CHECK(datum.SerializeToString(&out));
-      txn->Put(ss.str(), out);
+      txns[i % shards.size()]->Put(ss.str(), out);
+    }
+    for (int i = 0; i < shards.size(); ++i) {
+      txns[i]->Commit();
+      dbs[i]->Close();
     }
-    txn->Commit();
-    db->Close();
   }
 
-  void TestRead() {
+  void TestRead(int cache_size = 0) {
     const Dtype scale = 3;
     LayerParameter param;
     param.set_phase(TRAIN);
@@ -74,6 +81,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_cache_size(cache_size);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -104,6 +112,107 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Fill the DB with num records of 3 x 256 x 256 pixels, about 192 KB
+  // each, all equal to their label.
+  void FillLarge(int num, DataParameter_DB backend) {
+    backend_ = backend;
+    LOG(INFO) << "Using temporary dataset " << *filename_;
+    scoped_ptr<db::DB> db(db::GetDB(backend));
+    db->Open(*filename_, db::NEW);
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    for (int i = 0; i < num; ++i) {
+      Datum datum;
+      datum.set_label(i);
+      datum.set_channels(3);
+      datum.set_height(256);
+      datum.set_width(256);
+      datum.set_data(string(3 * 256 * 256, static_cast<char>(i)));
+      stringstream ss;
+      ss << i;
+      string out;
+      CHECK(datum.SerializeToString(&out));
+      txn->Put(ss.str(), out);
+    }
+    txn->Commit();
+    db->Close();
+  }
+
+  // Read passes over the num records of the source, one per batch, through
+  // a 1 MB cache, and check each has every record once, in stored order
+  // unless shuffled.
+  void TestReadCachePasses(int num, bool shuffle,
+      DataParameter_CacheOverflow overflow) {
+    Caffe::set_random_seed(seed_);
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(num);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_cache_size(1);
+    data_param->set_cache_overflow(overflow);
+    data_param->set_shuffle(shuffle);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    const int dim = 3 * 256 * 256;
+    bool reordered = false;
+    for (int pass = 0; pass < 4; ++pass) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      vector<bool> seen(num, false);
+      for (int i = 0; i < num; ++i) {
+        const int label = blob_top_label_->cpu_data()[i];
+        ASSERT_GE(label, 0);
+        ASSERT_LT(label, num);
+        EXPECT_FALSE(seen[label]) << "pass " << pass << " i " << i;
+        seen[label] = true;
+        EXPECT_EQ(label, blob_top_data_->cpu_data()[i * dim]);
+        EXPECT_EQ(label, blob_top_data_->cpu_data()[(i + 1) * dim - 1]);
+        if (!shuffle) {
+          EXPECT_EQ(i, label) << "pass " << pass;
+        }
+        reordered |= label != i;
+      }
+    }
+    EXPECT_EQ(shuffle, reordered);
+  }
+
+  // Read two passes over the num records of the source as each of two
+  // processes splitting it, with different random seeds, and check each
+  // pass between them has every record once.
+  void TestReadShuffledProcesses(int num) {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(num / 2);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shuffle(true);
+
+    vector<vector<int> > counts(2, vector<int>(num, 0));
+    Caffe::set_process_count(2);
+    for (int rank = 0; rank < 2; ++rank) {
+      Caffe::set_process_rank(rank);
+      Caffe::set_random_seed(seed_ + rank);
+      DataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+      for (int pass = 0; pass < 2; ++pass) {
+        layer.Forward(blob_bottom_vec_, blob_top_vec_);
+        for (int i = 0; i < num / 2; ++i) {
+          const int label = blob_top_label_->cpu_data()[i];
+          ++counts[pass][label];
+        }
+      }
+    }
+    Caffe::set_process_count(1);
+    Caffe::set_process_rank(0);
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int i = 0; i < num; ++i) {
+        EXPECT_EQ(1, counts[pass][i]) << "debug: pass " << pass << " i " << i;
+      }
+    }
+  }
+
   void TestReshape(DataParameter_DB backend) {
     const int num_inputs = 5;
     // Save data of varying shapes.
@@ -354,6 +463,33 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadShardedLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  // One record per shard, read back in order
+  *this->filename_ += "@5";
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReadCachedLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  // Passes after the first are read from memory
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestRead(1);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCacheOverflowLevelDB) {
+  // 5 records fit in the cache, the others are read again at each pass
+  this->FillLarge(8, DataParameter_DB_LEVELDB);
+  this->TestReadCachePasses(8, false, DataParameter_CacheOverflow_KEEP);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffledCachedLevelDB) {
+  // Passes after the first are shuffled from the cache
+  this->FillLarge(4, DataParameter_DB_LEVELDB);
+  this->TestReadCachePasses(4, true, DataParameter_CacheOverflow_KEEP);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLevelDB) {
   this->TestReshape(DataParameter_DB_LEVELDB);
 }
@@ -392,6 +528,32 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadShardedLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  // One record per shard, read back in order
+  *this->filename_ += "@5";
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReadCachedLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  // Passes after the first are read from memory
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(1);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCacheOverflowLMDB) {
+  this->FillLarge(8, DataParameter_DB_LMDB);
+  this->TestReadCachePasses(8, false, DataParameter_CacheOverflow_KEEP);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCacheOverflowDropLMDB) {
+  // The cache is dropped, all records are read at each pass
+  this->FillLarge(8, DataParameter_DB_LMDB);
+  this->TestReadCachePasses(8, false, DataParameter_CacheOverflow_DROP);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
@@ -424,4 +586,25 @@ TYPED_TEST(DataLayerTest, TestReadCropTestLMDB) {
   this->TestReadCrop(TEST);
 }
 
+TYPED_TEST(DataLayerTest, TestReadCacheOverflowPacked) {
+  this->FillLarge(8, DataParameter_DB_PACKED);
+  this->TestReadCachePasses(8, false, DataParameter_CacheOverflow_KEEP);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffledCachedPacked) {
+  this->FillLarge(4, DataParameter_DB_PACKED);
+  this->TestReadCachePasses(4, true, DataParameter_CacheOverflow_KEEP);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffledCacheOverflowPacked) {
+  // The cache is dropped, records are shuffled from the index
+  this->FillLarge(8, DataParameter_DB_PACKED);
+  this->TestReadCachePasses(8, true, DataParameter_CacheOverflow_KEEP);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffledProcessesPacked) {
+  this->FillLarge(8, DataParameter_DB_PACKED);
+  this->TestReadShuffledProcesses(8);
+}
+
 }  // namespace caffe
@@ -10,6 +10,7 @@
 #include "caffe/filler.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
+#include "caffe/util/raw_record.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -104,6 +105,37 @@ TYPED_TEST(DataTransformTest, TestEmptyTransform) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestRawRecord) {
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(3);
+  transform_param.set_scale(0.5);
+  const int channels = 2;
+  const int height = 4;
+  const int width = 5;
+
+  // The same floats as float_data, and as a raw record
+  Datum datum;
+  datum.set_channels(channels);
+  datum.set_height(height);
+  datum.set_width(width);
+  for (int j = 0; j < channels * height * width; ++j) {
+    datum.add_float_data(j * 0.5 - 3);
+  }
+  string record;
+  DatumToRawRecord(datum, Datum_DataType_FLOAT16, &record);
+  Datum raw_datum;
+  RawRecordToDatum(record, &raw_datum);
+  Blob<TypeParam> blob(1, channels, 3, 3);
+  Blob<TypeParam> raw_blob(1, channels, 3, 3);
+  DataTransformer<TypeParam> transformer(transform_param, TEST);
+  transformer.InitRand();
+  transformer.Transform(datum, &blob);
+  transformer.Transform(raw_datum, &raw_blob);
+  for (int j = 0; j < blob.count(); ++j) {
+    EXPECT_EQ(blob.cpu_data()[j], raw_blob.cpu_data()[j]);
+  }
+}
+
 TYPED_TEST(DataTransformTest, TestEmptyTransformUniquePixels) {
   TransformationParameter transform_param;
   const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
@@ -267,6 +299,37 @@ TYPED_TEST(DataTransformTest, TestCropMirrorTest) {
 }
 
 
+TYPED_TEST(DataTransformTest, TestBatchThreads) {
+  TransformationParameter transform_param;
+  const bool unique_pixels = true;
+  const int num = 8;
+  const int channels = 3;
+  const int height = 4;
+  const int width = 5;
+  transform_param.set_crop_size(3);
+  transform_param.set_mirror(true);
+  transform_param.add_mean_value(1);
+  vector<Datum> datums(num);
+  for (int i = 0; i < num; ++i) {
+    FillDatum(i, channels, height, width, unique_pixels, &datums[i]);
+  }
+  // Items are transformed alike whatever the number of threads
+  vector<vector<TypeParam> > results;
+  for (int threads = 1; threads <= 4; threads += 3) {
+    transform_param.set_batch_threads(threads);
+    DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+    Caffe::set_random_seed(this->seed_);
+    transformer.InitRand();
+    Blob<TypeParam> blob(num, channels, 3, 3);
+    transformer.Transform(datums, &blob);
+    results.push_back(vector<TypeParam>(blob.cpu_data(),
+        blob.cpu_data() + blob.count()));
+  }
+  for (int j = 0; j < results[0].size(); ++j) {
+    EXPECT_EQ(results[0][j], results[1][j]);
+  }
+}
+
 TYPED_TEST(DataTransformTest, TestMeanValue) {
   TransformationParameter transform_param;
   const bool unique_pixels = false;  // pixels are equal to label
@@ -0,0 +1,92 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/datum_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DatumCacheTest : public ::testing::Test {
+ protected:
+  // A 3 x 4 x 5 datum of uint8 values, or floats
+  void MakeDatum(int label, bool floats, Datum* datum) {
+    datum->Clear();
+    datum->set_label(label);
+    datum->set_channels(3);
+    datum->set_height(4);
+    datum->set_width(5);
+    for (int i = 0; i < 60; ++i) {
+      if (floats) {
+        datum->add_float_data(label + i / 8.);
+      } else {
+        datum->mutable_data()->push_back(static_cast<char>(label + i));
+      }
+    }
+  }
+};
+
+TEST_F(DatumCacheTest, TestAddGet) {
+  DatumCache cache(1 << 20);
+  Datum datum;
+  for (int i = 0; i < 10; ++i) {
+    MakeDatum(i, i % 2, &datum);
+    EXPECT_TRUE(cache.Add(datum));
+  }
+  Datum encoded;
+  encoded.set_label(10);
+  encoded.set_data("not an image");
+  encoded.set_encoded(true);
+  EXPECT_TRUE(cache.Add(encoded));
+  ASSERT_EQ(cache.size(), 11);
+  for (int i = 0; i < 10; ++i) {
+    cache.Get(i, &datum);
+    EXPECT_EQ(datum.label(), i);
+    EXPECT_EQ(datum.channels(), 3);
+    EXPECT_EQ(datum.height(), 4);
+    EXPECT_EQ(datum.width(), 5);
+    EXPECT_FALSE(datum.encoded());
+    // Floats come back as raw float32 data
+    if (i % 2) {
+      EXPECT_EQ(datum.data_type(), Datum_DataType_FLOAT32);
+      ASSERT_EQ(datum.data().size(), 60 * 4);
+      const float* values = reinterpret_cast<const float*>(datum.data().data());
+      for (int j = 0; j < 60; ++j) {
+        EXPECT_EQ(values[j], i + j / 8.);
+      }
+    } else {
+      EXPECT_EQ(datum.data_type(), Datum_DataType_UINT8);
+      ASSERT_EQ(datum.data().size(), 60);
+      for (int j = 0; j < 60; ++j) {
+        EXPECT_EQ(datum.data()[j], static_cast<char>(i + j));
+      }
+    }
+  }
+  cache.Get(10, &datum);
+  EXPECT_TRUE(datum.encoded());
+  EXPECT_EQ(datum.label(), 10);
+  EXPECT_EQ(datum.data(), "not an image");
+}
+
+TEST_F(DatumCacheTest, TestCapacity) {
+  // Room for 3 uint8 datums of 24 + 60 bytes
+  DatumCache cache(3 * 84 + 10);
+  Datum datum;
+  MakeDatum(0, false, &datum);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(cache.Add(datum));
+    EXPECT_EQ(cache.bytes(i), 84);
+  }
+  EXPECT_FALSE(cache.Add(datum));
+  EXPECT_EQ(cache.size(), 3);
+  EXPECT_LE(cache.allocated(), 3 * 84 + 10);
+  cache.Clear();
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(cache.allocated(), 0);
+  EXPECT_TRUE(cache.Add(datum));
+}
+
+}  // namespace caffe
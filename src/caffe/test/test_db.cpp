@@ -6,6 +6,7 @@
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/db_packed.hpp"
 #include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -56,8 +57,13 @@ struct TypeLMDB {
 };
 DataParameter_DB TypeLMDB::backend = DataParameter_DB_LMDB;
 
+struct TypePacked {
+  static DataParameter_DB backend;
+};
+DataParameter_DB TypePacked::backend = DataParameter_DB_PACKED;
+
 // typedef ::testing::Types<TypeLmdb> TestTypes;
-typedef ::testing::Types<TypeLevelDB, TypeLMDB> TestTypes;
+typedef ::testing::Types<TypeLevelDB, TypeLMDB, TypePacked> TestTypes;
 
 TYPED_TEST_CASE(DBTest, TestTypes);
 
@@ -116,6 +122,29 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestReadahead) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  // Hints do not change what is read, even with a window below a record
+  cursor->set_readahead(4096);
+  for (int pass = 0; pass < 2; ++pass) {
+    ASSERT_TRUE(cursor->valid());
+    EXPECT_EQ(cursor->key(), "cat.jpg");
+    cursor->Next();
+    ASSERT_TRUE(cursor->valid());
+    EXPECT_EQ(cursor->key(), "fish-bike.jpg");
+    Datum datum;
+    datum.ParseFromString(cursor->value());
+    EXPECT_EQ(datum.height(), 323);
+    cursor->Next();
+    EXPECT_FALSE(cursor->valid());
+    cursor->SeekToFirst();
+  }
+  cursor->set_readahead(0);
+  EXPECT_EQ(cursor->key(), "cat.jpg");
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
@@ -131,4 +160,46 @@ TYPED_TEST(DBTest, TestWrite) {
   txn->Commit();
 }
 
+TEST(PackedDBTest, TestSeek) {
+  string source;
+  MakeTempDir(&source);
+  source += "/db";
+  db::PackedDB db;
+  db.Open(source, db::NEW);
+  scoped_ptr<db::Transaction> txn(db.NewTransaction());
+  for (int i = 0; i < 10; ++i) {
+    txn->Put(string(1, 'a' + i), string(i, 'x'));
+    // Records are only visible once committed
+    if (i == 4) {
+      txn->Commit();
+    }
+  }
+  scoped_ptr<db::PackedCursor> cursor(db.NewCursor());
+  EXPECT_EQ(cursor->size(), 5);
+  txn->Commit();
+  db.Close();
+
+  db.Open(source, db::READ);
+  cursor.reset(db.NewCursor());
+  ASSERT_EQ(cursor->size(), 10);
+  const int records[] = {7, 2, 3, 9, 0, 10};
+  for (int i = 0; i < 6; ++i) {
+    cursor->Seek(records[i]);
+    EXPECT_EQ(cursor->record(), records[i]);
+    ASSERT_EQ(cursor->valid(), records[i] < 10);
+    if (cursor->valid()) {
+      EXPECT_EQ(cursor->key(), string(1, 'a' + records[i]));
+      EXPECT_EQ(cursor->value(), string(records[i], 'x'));
+    }
+  }
+  // In order again after the jumps
+  int count = 0;
+  for (cursor->Seek(6); cursor->valid(); cursor->Next()) {
+    EXPECT_EQ(cursor->key(), string(1, 'a' + 6 + count));
+    EXPECT_EQ(cursor->value(), string(6 + count, 'x'));
+    ++count;
+  }
+  EXPECT_EQ(count, 4);
+}
+
 }  // namespace caffe
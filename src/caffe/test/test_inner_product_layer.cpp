@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -36,6 +37,42 @@ class InnerProductLayerTest : public MultiDeviceTest<TypeParam> {
     delete blob_bottom_nobatch_;
     delete blob_top_;
   }
+
+  // A TEST phase layer of 10 outputs with uniform weights, set up on
+  // blob_bottom_
+  shared_ptr<InnerProductLayer<Dtype> > TestPhaseLayer() {
+    blob_bottom_vec_.push_back(blob_bottom_);
+    LayerParameter layer_param;
+    layer_param.set_phase(TEST);
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->mutable_weight_filler()->set_type("uniform");
+    inner_product_param->mutable_bias_filler()->set_type("uniform");
+    shared_ptr<InnerProductLayer<Dtype> > layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    layer->SetUp(blob_bottom_vec_, blob_top_vec_);
+    return layer;
+  }
+
+  // Runs Forward and checks the top against a dense gemm of the weights
+  void CheckForwardAgainstGemm(InnerProductLayer<Dtype>* layer) {
+    const int M = 2;
+    const int N = 10;
+    const int K = 60;
+    layer->Forward(blob_bottom_vec_, blob_top_vec_);
+    vector<Dtype> expected(M * N);
+    for (int m = 0; m < M; ++m) {
+      caffe_copy(N, layer->blobs()[1]->cpu_data(), &expected[m * N]);
+    }
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M, N, K, (Dtype)1.,
+        blob_bottom_->cpu_data(), layer->blobs()[0]->cpu_data(),
+        (Dtype)1., &expected[0]);
+    for (int i = 0; i < M * N; ++i) {
+      EXPECT_NEAR(expected[i], blob_top_->cpu_data()[i], 1e-4);
+    }
+  }
+
   Blob<Dtype>* const blob_bottom_;
   Blob<Dtype>* const blob_bottom_nobatch_;
   Blob<Dtype>* const blob_top_;
@@ -92,6 +129,35 @@ TYPED_TEST(InnerProductLayerTest, TestForward) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestForwardOutputBiasUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  // In both phases, TEST running the small batch kernel
+  for (int phase = TRAIN; phase <= TEST; ++phase) {
+    LayerParameter layer_param;
+    layer_param.set_phase(static_cast<Phase>(phase));
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->set_output_scale(2);
+    inner_product_param->set_output_shift(1);
+    inner_product_param->mutable_weight_filler()->set_type("uniform");
+    inner_product_param->mutable_bias_filler()->set_type("uniform");
+    InnerProductLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const int count = this->blob_top_->count();
+    vector<Dtype> before(this->blob_top_->cpu_data(),
+        this->blob_top_->cpu_data() + count);
+    // The folded bias follows changes of the bias
+    caffe_add_scalar(10, Dtype(1), layer.blobs()[1]->mutable_cpu_data());
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < count; ++i) {
+      EXPECT_NEAR(before[i] + 2, this->blob_top_->cpu_data()[i], 1e-4);
+    }
+  }
+}
+
 TYPED_TEST(InnerProductLayerTest, TestForwardNoBatch) {
   typedef typename TypeParam::Dtype Dtype;
   this->blob_bottom_vec_.push_back(this->blob_bottom_nobatch_);
@@ -123,6 +189,31 @@ TYPED_TEST(InnerProductLayerTest, TestForwardNoBatch) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestForwardSmallBatch) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Small test batches use packed weights, check them against gemm
+  shared_ptr<InnerProductLayer<Dtype> > layer = this->TestPhaseLayer();
+  this->CheckForwardAgainstGemm(layer.get());
+  // Changed weights must be repacked
+  Blob<Dtype>* weights = layer->blobs()[0].get();
+  caffe_scal<Dtype>(weights->count(), -2, weights->mutable_cpu_data());
+  this->CheckForwardAgainstGemm(layer.get());
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardSparse) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Pruned weights are multiplied sparsely at test time
+  shared_ptr<InnerProductLayer<Dtype> > layer = this->TestPhaseLayer();
+  Blob<Dtype>* weights = layer->blobs()[0].get();
+  Dtype* data = weights->mutable_cpu_data();
+  for (int i = 0; i < weights->count(); ++i) {
+    if (i % 16) {
+      data[i] = 0;
+    }
+  }
+  this->CheckForwardAgainstGemm(layer.get());
+}
+
 TYPED_TEST(InnerProductLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   this->blob_bottom_vec_.push_back(this->blob_bottom_);
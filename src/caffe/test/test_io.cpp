@@ -319,6 +319,41 @@ TEST_F(IOTest, TestDecodeDatumToCVMat) {
   EXPECT_EQ(cv_img.cols, 480);
 }
 
+TEST_F(IOTest, TestDecodeDatumToCVMatScaled) {
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  Datum datum;
+  EXPECT_TRUE(ReadFileToDatum(filename, &datum));
+  // Halved, the largest reduction at least 100 x 100
+  int scale;
+  cv::Mat cv_img = DecodeDatumToCVMat(datum, 100, 100, true, &scale);
+  EXPECT_EQ(scale, 2);
+  EXPECT_EQ(cv_img.channels(), 3);
+  EXPECT_EQ(cv_img.rows, 180);
+  EXPECT_EQ(cv_img.cols, 240);
+  // Close to the whole image resized, in the same channel order
+  cv::Mat cv_img_ref;
+  cv::resize(DecodeDatumToCVMat(datum, true), cv_img_ref, cv_img.size(), 0,
+      0, cv::INTER_AREA);
+  EXPECT_LT(cv::norm(cv_img, cv_img_ref, cv::NORM_L1) / cv_img.total() / 3,
+      8);
+  cv_img = DecodeDatumToCVMat(datum, 40, 40, false, &scale);
+  EXPECT_EQ(scale, 8);
+  EXPECT_EQ(cv_img.channels(), 1);
+  EXPECT_EQ(cv_img.rows, 45);
+  EXPECT_EQ(cv_img.cols, 60);
+  // Not scaled when it would be too small
+  cv_img = DecodeDatumToCVMat(datum, 200, 200, true, &scale);
+  EXPECT_EQ(scale, 1);
+  EXPECT_EQ(cv_img.rows, 360);
+  EXPECT_EQ(cv_img.cols, 480);
+  // Nor when it is not a JPEG
+  EXPECT_TRUE(ReadImageToDatum(filename, 0, std::string("png"), &datum));
+  cv_img = DecodeDatumToCVMat(datum, 100, 100, true, &scale);
+  EXPECT_EQ(scale, 1);
+  EXPECT_EQ(cv_img.rows, 360);
+  EXPECT_EQ(cv_img.cols, 480);
+}
+
 TEST_F(IOTest, TestDecodeDatumToCVMatContent) {
   string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
   Datum datum;
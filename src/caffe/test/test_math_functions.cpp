@@ -3,6 +3,7 @@
 #include <climits>
 #include <cmath>  // for std::fabs
 #include <cstdlib>  // for rand_r
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -150,6 +151,73 @@ TYPED_TEST(CPUMathFunctionsTest, TestCopy) {
   }
 }
 
+TYPED_TEST(CPUMathFunctionsTest, TestHalfKnownValues) {
+  const TypeParam x[] = {0, 1, -2, 0.5, 65504, 65520, 1e-8, 5.9604645e-8,
+      6.1035156e-5, 1.00048828125, 1.00146484375, -2.5, 0.1, -1.00136e-5};
+  const uint16_t expected[] = {0x0000, 0x3c00, 0xc000, 0x3800, 0x7bff, 0x7c00,
+      0x0000, 0x0001, 0x0400, 0x3c00, 0x3c02, 0xc100, 0x2e66, 0x80a8};
+  const int n = sizeof(x) / sizeof(x[0]);
+  vector<uint16_t> y(n);
+  caffe_cpu_to_half<TypeParam>(n, x, &y[0]);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_EQ(expected[i], y[i]) << "for " << x[i];
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestHalfRoundTrip) {
+  // Every finite half value converts back to itself
+  const int n = 0x7c00;
+  vector<uint16_t> half(n);
+  for (int i = 0; i < n; ++i) {
+    half[i] = i;
+  }
+  vector<TypeParam> x(n);
+  vector<uint16_t> y(n);
+  caffe_cpu_from_half<TypeParam>(n, &half[0], &x[0]);
+  caffe_cpu_to_half<TypeParam>(n, &x[0], &y[0]);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_EQ(half[i], y[i]);
+  }
+  // Relative error is at most 2^-11 in the normal range
+  const int count = this->blob_bottom_->count();
+  const TypeParam* data = this->blob_bottom_->cpu_data();
+  y.resize(count);
+  x.resize(count);
+  caffe_cpu_to_half<TypeParam>(count, data, &y[0]);
+  caffe_cpu_from_half<TypeParam>(count, &y[0], &x[0]);
+  for (int i = 0; i < count; ++i) {
+    if (std::fabs(data[i]) > 6.1035156e-5) {
+      EXPECT_LE(std::fabs(x[i] - data[i]), std::fabs(data[i]) / 2048);
+    }
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestGemmBatched) {
+  // A small batch sharing A, and one large enough to be split in threads
+  const int M[] = {3, 64};
+  const int N[] = {5, 64};
+  const int K[] = {4, 64};
+  const int batch[] = {7, 16};
+  const TypeParam* a = this->blob_top_->cpu_data();
+  const TypeParam* b = this->blob_bottom_->cpu_data();
+  for (int t = 0; t < 2; ++t) {
+    const int stride_b = K[t] * N[t];
+    const int stride_c = M[t] * N[t];
+    const int count = stride_c * batch[t];
+    vector<TypeParam> c(b, b + count);
+    vector<TypeParam> expected(c);
+    caffe_cpu_gemm_batched<TypeParam>(CblasNoTrans, CblasTrans, M[t], N[t],
+        K[t], 2., a, 0, b, stride_b, 0.5, &c[0], stride_c, batch[t]);
+    for (int i = 0; i < batch[t]; ++i) {
+      caffe_cpu_gemm<TypeParam>(CblasNoTrans, CblasTrans, M[t], N[t], K[t],
+          2., a, b + i * stride_b, 0.5, &expected[i * stride_c]);
+    }
+    for (int i = 0; i < count; ++i) {
+      EXPECT_NEAR(expected[i], c[i], 1e-4);
+    }
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
@@ -1,7 +1,11 @@
+#include <stdint.h>
+
+#include <cstdio>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/thread.hpp"
 #include "google/protobuf/text_format.h"
 
 #include "gtest/gtest.h"
@@ -9,6 +13,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
+#include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -1226,6 +1231,402 @@ TYPED_TEST(NetTest, TestSharedWeightsResume) {
   }
 }
 
+TYPED_TEST(NetTest, TestMappedWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitTinyNet();
+  vector<shared_ptr<Blob<Dtype> > > params;
+  const bool kCopyDiff = false;
+  this->CopyNetParams(kCopyDiff, &params);
+  string temp_filename;
+  MakeTempFilename(&temp_filename);
+  const string filename = temp_filename + ".mmap";
+  this->net_->ToMappedWeights(filename);
+
+  // Initialize with different weights, then map the saved ones.
+  Caffe::set_random_seed(this->seed_ + 1);
+  this->InitTinyNet();
+  this->net_->CopyTrainedLayersFrom(filename);
+  const vector<shared_ptr<Blob<Dtype> > >& mapped = this->net_->params();
+  ASSERT_EQ(params.size(), mapped.size());
+  for (int i = 0; i < params.size(); ++i) {
+    const Dtype* data = mapped[i]->cpu_data();
+    // Blobs point to page-aligned mapped values
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(data) % 4096);
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(params[i]->cpu_data()[j], data[j]);
+    }
+  }
+  vector<Blob<Dtype>*> bottom;
+  this->net_->Forward(bottom);
+
+  // Writing to mapped blobs does not change the file.
+  caffe_set(mapped[0]->count(), Dtype(1), mapped[0]->mutable_cpu_data());
+  Caffe::set_random_seed(this->seed_ + 1);
+  this->InitTinyNet();
+  this->net_->CopyTrainedLayersFrom(filename);
+  for (int j = 0; j < params[0]->count(); ++j) {
+    EXPECT_EQ(params[0]->cpu_data()[j], this->net_->params()[0]->cpu_data()[j]);
+  }
+  remove(filename.c_str());
+  remove(temp_filename.c_str());
+}
+
+TYPED_TEST(NetTest, TestMappedWeightsFromProto) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Weights written from a NetParameter, as by convert_model_mmap, in the
+  // other precision are converted when loaded.
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet();
+  Blob<Dtype> weights;
+  weights.CopyFrom(*this->net_->layers()[1]->blobs()[0], false, true);
+  NetParameter net_param;
+  this->net_->ToProto(&net_param);
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    for (int j = 0; j < net_param.layer(i).blobs_size(); ++j) {
+      BlobProto* blob = net_param.mutable_layer(i)->mutable_blobs(j);
+      if (blob->double_data_size()) {
+        for (int k = 0; k < blob->double_data_size(); ++k) {
+          blob->add_data(blob->double_data(k));
+        }
+        blob->clear_double_data();
+      } else {
+        for (int k = 0; k < blob->data_size(); ++k) {
+          blob->add_double_data(blob->data(k));
+        }
+        blob->clear_data();
+      }
+    }
+  }
+  string temp_filename;
+  MakeTempFilename(&temp_filename);
+  const string filename = temp_filename + ".mmap";
+  WriteMappedWeights(net_param, filename);
+
+  Caffe::set_random_seed(this->seed_ + 1);
+  this->InitDiffDataSharedWeightsNet();
+  this->net_->CopyTrainedLayersFrom(filename);
+  Blob<Dtype>* ip1_weights = this->net_->layers()[1]->blobs()[0].get();
+  Blob<Dtype>* ip2_weights = this->net_->layers()[2]->blobs()[0].get();
+  EXPECT_EQ(ip1_weights->cpu_data(), ip2_weights->cpu_data());
+  for (int i = 0; i < weights.count(); ++i) {
+    EXPECT_FLOAT_EQ(weights.cpu_data()[i], ip1_weights->cpu_data()[i]);
+  }
+  remove(filename.c_str());
+  remove(temp_filename.c_str());
+}
+
+template <typename Dtype>
+static void ForwardReplica(Caffe::Brew mode, Net<Dtype>* net,
+                           const Blob<Dtype>* input, Blob<Dtype>* output) {
+  Caffe::set_mode(mode);
+  for (int i = 0; i < 10; ++i) {
+    net->input_blobs()[0]->CopyFrom(*input);
+    net->ForwardPrefilled();
+  }
+  output->CopyFrom(*net->output_blobs()[0], false, true);
+}
+
+TYPED_TEST(NetTest, TestReplicas) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "input: 'data' "
+      "input_shape { dim: 4 dim: 10 } "
+      "layer { "
+      "  name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      "  inner_product_param { "
+      "    num_output: 8 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "} "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'ip1' top: 'ip1' } "
+      "layer { "
+      "  name: 'ip2' type: 'InnerProduct' bottom: 'ip1' top: 'ip2' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> weights_net(param);
+  Blob<Dtype> input(weights_net.input_blobs()[0]->shape());
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&input);
+  Blob<Dtype> expected;
+  ForwardReplica(Caffe::mode(), &weights_net, &input, &expected);
+
+  const int kNumReplicas = 4;
+  vector<shared_ptr<Net<Dtype> > > replicas(kNumReplicas);
+  for (int i = 0; i < kNumReplicas; ++i) {
+    replicas[i].reset(new Net<Dtype>(param, weights_net));
+    // Weights are shared, activations and gradients are not.
+    const vector<shared_ptr<Blob<Dtype> > >& params = replicas[i]->params();
+    ASSERT_EQ(weights_net.params().size(), params.size());
+    for (int j = 0; j < params.size(); ++j) {
+      EXPECT_EQ(weights_net.params()[j]->cpu_data(), params[j]->cpu_data());
+      EXPECT_NE(weights_net.params()[j]->cpu_diff(), params[j]->cpu_diff());
+    }
+    EXPECT_NE(weights_net.blobs()[1]->cpu_data(),
+              replicas[i]->blobs()[1]->cpu_data());
+  }
+
+  // Run all replicas concurrently.
+  vector<shared_ptr<Blob<Dtype> > > outputs(kNumReplicas);
+  boost::thread_group threads;
+  for (int i = 0; i < kNumReplicas; ++i) {
+    outputs[i].reset(new Blob<Dtype>());
+    threads.create_thread(boost::bind(&ForwardReplica<Dtype>, Caffe::mode(),
+        replicas[i].get(), &input, outputs[i].get()));
+  }
+  threads.join_all();
+  for (int i = 0; i < kNumReplicas; ++i) {
+    ASSERT_EQ(expected.count(), outputs[i]->count());
+    for (int j = 0; j < expected.count(); ++j) {
+      EXPECT_EQ(expected.cpu_data()[j], outputs[i]->cpu_data()[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestBranchThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Independent branches, two sharing weights, and an in-place layer on a
+  // reshaped split blob, which must wait for the other readers of the blob.
+  const string conv =
+      "  convolution_param { "
+      "    num_output: 4 kernel_size: 3 pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "    bias_filler { type: 'gaussian' std: 0.1 } "
+      "  } ";
+  const string proto =
+      "force_backward: true "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 6 dim: 6 } "
+      "layer { name: 'c1' type: 'Convolution' bottom: 'data' top: 'c1' "
+      + conv + "} "
+      "layer { name: 'r1' type: 'ReLU' bottom: 'c1' top: 'c1' } "
+      "layer { name: 'c2a' type: 'Convolution' bottom: 'data' top: 'c2a' "
+      + conv + "} "
+      "layer { name: 'c2b' type: 'Convolution' bottom: 'c2a' top: 'c2b' "
+      + conv + "} "
+      "layer { name: 'c3' type: 'Convolution' bottom: 'c2a' top: 'c3' "
+      "  param { name: 'w' } param { name: 'b' } "
+      + conv + "} "
+      "layer { name: 'c4' type: 'Convolution' bottom: 'c1' top: 'c4' "
+      "  param { name: 'w' } param { name: 'b' } "
+      + conv + "} "
+      "layer { name: 'rs' type: 'Reshape' bottom: 'c2a' top: 'rs' "
+      "  reshape_param { shape { dim: 0 dim: -1 } } "
+      "} "
+      "layer { name: 'rr' type: 'ReLU' bottom: 'rs' top: 'rs' } "
+      "layer { name: 'concat' type: 'Concat' bottom: 'c1' bottom: 'c2b' "
+      "  bottom: 'c3' bottom: 'c4' bottom: 'data' top: 'concat' } "
+      "layer { name: 'ip' type: 'InnerProduct' bottom: 'concat' top: 'ip' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { name: 'loss' type: 'Reduction' bottom: 'ip' top: 'loss' "
+      "  reduction_param { operation: SUMSQ } loss_weight: 1 "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Blob<Dtype> input(2, 3, 6, 6);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&input);
+
+  vector<shared_ptr<Net<Dtype> > > nets(2);
+  vector<Dtype> losses(2);
+  for (int n = 0; n < 2; ++n) {
+    Caffe::set_random_seed(this->seed_);
+    param.set_branch_threads(n ? 4 : 1);
+    nets[n].reset(new Net<Dtype>(param));
+    EXPECT_EQ(nets[n]->branch_threads(), n ? 4 : 1);
+    nets[n]->input_blobs()[0]->CopyFrom(input);
+    nets[n]->ForwardPrefilled(&losses[n]);
+    nets[n]->Backward();
+  }
+  EXPECT_NEAR(losses[0], losses[1], 1e-4 * fabs(losses[0]));
+  const vector<shared_ptr<Blob<Dtype> > >& blobs = nets[0]->blobs();
+  for (int i = 0; i < blobs.size(); ++i) {
+    const Blob<Dtype>& other = *nets[1]->blobs()[i];
+    for (int j = 0; j < blobs[i]->count(); ++j) {
+      EXPECT_NEAR(blobs[i]->cpu_data()[j], other.cpu_data()[j], 1e-4);
+      EXPECT_NEAR(blobs[i]->cpu_diff()[j], other.cpu_diff()[j], 1e-4);
+    }
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& params = nets[0]->params();
+  for (int i = 0; i < params.size(); ++i) {
+    const Blob<Dtype>& other = *nets[1]->params()[i];
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_NEAR(params[i]->cpu_diff()[j], other.cpu_diff()[j], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestFoldAffineLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A chain of Power layers after c1, one in place after ip, and one after
+  // c2 which stays as the concat also reads c2.
+  const string conv =
+      "  convolution_param { "
+      "    num_output: 4 kernel_size: 3 pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "    bias_filler { type: 'gaussian' std: 0.1 } "
+      "  } ";
+  const string proto =
+      "state { phase: TEST } "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 6 dim: 6 } "
+      "layer { name: 'c1' type: 'Convolution' bottom: 'data' top: 'c1' "
+      + conv + "} "
+      "layer { name: 'p1' type: 'Power' bottom: 'c1' top: 'p1' "
+      "  power_param { scale: 2 shift: 0.5 } "
+      "} "
+      "layer { name: 'p2' type: 'Power' bottom: 'p1' top: 'p1' "
+      "  power_param { scale: -0.5 shift: 1 } "
+      "} "
+      "layer { name: 'ip' type: 'InnerProduct' bottom: 'p1' top: 'ip' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "    bias_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { name: 'p3' type: 'Power' bottom: 'ip' top: 'ip' "
+      "  power_param { scale: 3 shift: -1 } "
+      "} "
+      "layer { name: 'c2' type: 'Convolution' bottom: 'data' top: 'c2' "
+      + conv + "} "
+      "layer { name: 'p4' type: 'Power' bottom: 'c2' top: 'p4' "
+      "  power_param { scale: 2 } "
+      "} "
+      "layer { name: 'concat' type: 'Concat' bottom: 'c2' bottom: 'p4' "
+      "  top: 'concat' } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Blob<Dtype> input(2, 3, 6, 6);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&input);
+
+  Net<Dtype> net(param);
+  param.set_fold_affine(true);
+  Net<Dtype> folded(param);
+  EXPECT_EQ(folded.layers().size(), net.layers().size() - 3);
+  EXPECT_FALSE(folded.has_layer("p1"));
+  EXPECT_FALSE(folded.has_layer("p3"));
+  EXPECT_TRUE(folded.has_layer("p4"));
+  NetParameter weights;
+  net.ToProto(&weights);
+  folded.CopyTrainedLayersFrom(weights);
+  net.input_blobs()[0]->CopyFrom(input);
+  folded.input_blobs()[0]->CopyFrom(input);
+  net.ForwardPrefilled();
+  folded.ForwardPrefilled();
+  const char* outputs[] = {"p1", "ip", "concat"};
+  for (int i = 0; i < 3; ++i) {
+    const Blob<Dtype>& expected = *net.blob_by_name(outputs[i]);
+    const Blob<Dtype>& result = *folded.blob_by_name(outputs[i]);
+    ASSERT_EQ(expected.shape(), result.shape());
+    for (int j = 0; j < expected.count(); ++j) {
+      EXPECT_NEAR(expected.cpu_data()[j], result.cpu_data()[j], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestFoldAffineLayersOutputs) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The unscaled ip1 is requested as an output, so p1 stays, while p2
+  // folds into ip2
+  const string ip =
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } ";
+  const string proto =
+      "state { phase: TEST } "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 4 dim: 4 } "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      + ip + "} "
+      "layer { name: 'p1' type: 'Power' bottom: 'ip1' top: 'p1' "
+      "  power_param { scale: 2 shift: 0.5 } "
+      "} "
+      "layer { name: 'ip2' type: 'InnerProduct' bottom: 'data' top: 'ip2' "
+      + ip + "} "
+      "layer { name: 'p2' type: 'Power' bottom: 'ip2' top: 'p2' "
+      "  power_param { scale: 3 } "
+      "} "
+      "fold_affine: true "
+      "output: 'ip1' output: 'p1' output: 'p2' ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> net(param);
+  EXPECT_TRUE(net.has_layer("p1"));
+  EXPECT_FALSE(net.has_layer("p2"));
+  ASSERT_EQ(net.output_blobs().size(), 3);
+  EXPECT_EQ(net.output_blobs()[0], net.blob_by_name("ip1").get());
+  EXPECT_EQ(net.output_blobs()[1], net.blob_by_name("p1").get());
+  EXPECT_EQ(net.output_blobs()[2], net.blob_by_name("p2").get());
+}
+
+TYPED_TEST(NetTest, TestPruneNet) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string ip =
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } ";
+  const string proto =
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 4 dim: 4 } "
+      "layer { name: 'c1' type: 'Convolution' bottom: 'data' top: 'c1' "
+      "  convolution_param { "
+      "    num_output: 4 kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { name: 'r1' type: 'ReLU' bottom: 'c1' top: 'c1' } "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'c1' top: 'ip1' "
+      + ip + "} "
+      "layer { name: 'ip2' type: 'InnerProduct' bottom: 'ip1' top: 'ip2' "
+      + ip + "} "
+      "layer { name: 'ip3' type: 'InnerProduct' bottom: 'data' top: 'ip3' "
+      + ip + "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> net(param);
+  param.add_output("ip1");
+  param.add_output("c1");
+  Net<Dtype> pruned(param);
+  ASSERT_EQ(pruned.layers().size(), 3);
+  EXPECT_TRUE(pruned.has_layer("r1"));
+  EXPECT_FALSE(pruned.has_layer("ip2"));
+  EXPECT_FALSE(pruned.has_layer("ip3"));
+  ASSERT_EQ(pruned.output_blobs().size(), 2);
+  EXPECT_EQ(pruned.output_blobs()[0], pruned.blob_by_name("c1").get());
+  EXPECT_EQ(pruned.output_blobs()[1], pruned.blob_by_name("ip1").get());
+  NetParameter weights;
+  net.ToProto(&weights);
+  pruned.CopyTrainedLayersFrom(weights);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(net.input_blobs()[0]);
+  pruned.input_blobs()[0]->CopyFrom(*net.input_blobs()[0]);
+  net.ForwardPrefilled();
+  pruned.ForwardPrefilled();
+  const Blob<Dtype>& expected = *net.blob_by_name("ip1");
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], pruned.output_blobs()[1]->cpu_data()[i]);
+  }
+}
+
 TYPED_TEST(NetTest, TestParamPropagateDown) {
   typedef typename TypeParam::Dtype Dtype;
   vector<Blob<Dtype>*> bottom;
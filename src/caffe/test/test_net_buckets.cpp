@@ -0,0 +1,106 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/net_buckets.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class NetBucketsTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  NetBucketsTest() {
+    // Fully convolutional, output has the shape of the input
+    const string proto =
+        "input: 'data' "
+        "input_dim: 1 input_dim: 2 input_dim: 4 input_dim: 4 "
+        "layer { "
+        "  name: 'conv' type: 'Convolution' bottom: 'data' top: 'conv' "
+        "  convolution_param { "
+        "    num_output: 3 kernel_size: 3 pad: 1 "
+        "    weight_filler { type: 'gaussian' } "
+        "    bias_filler { type: 'gaussian' } "
+        "  } "
+        "} "
+        "layer { name: 'relu' type: 'ReLU' bottom: 'conv' top: 'conv' } ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param_));
+    Caffe::set_random_seed(1701);
+    net_.reset(new Net<Dtype>(param_));
+    shapes_.resize(2, vector<int>(4));
+    shapes_[0][0] = 1; shapes_[0][1] = 2; shapes_[0][2] = 8; shapes_[0][3] = 8;
+    shapes_[1][0] = 1; shapes_[1][1] = 2; shapes_[1][2] = 8;
+    shapes_[1][3] = 16;
+  }
+
+  NetParameter param_;
+  shared_ptr<Net<Dtype> > net_;
+  vector<vector<int> > shapes_;
+};
+
+TYPED_TEST_CASE(NetBucketsTest, TestDtypesAndDevices);
+
+TYPED_TEST(NetBucketsTest, TestFind) {
+  typedef typename TypeParam::Dtype Dtype;
+  NetBuckets<Dtype> buckets(this->param_, *this->net_, this->shapes_);
+  ASSERT_EQ(buckets.size(), 2);
+  vector<int> shape(this->shapes_[0]);
+  EXPECT_EQ(buckets.Find(shape), 0);
+  shape[2] = 5;
+  shape[3] = 7;
+  EXPECT_EQ(buckets.Find(shape), 0);
+  shape[3] = 9;
+  EXPECT_EQ(buckets.Find(shape), 1);
+  shape[2] = 9;
+  EXPECT_EQ(buckets.Find(shape), -1);
+  shape.resize(3);
+  EXPECT_EQ(buckets.Find(shape), -1);
+  EXPECT_LT(buckets.memory_used(0), buckets.memory_used(1));
+}
+
+TYPED_TEST(NetBucketsTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  NetBuckets<Dtype> buckets(this->param_, *this->net_, this->shapes_);
+  const int sizes[][2] = {{8, 8}, {3, 5}, {8, 11}, {6, 16}};
+  for (int s = 0; s < 4; ++s) {
+    Blob<Dtype> input(1, 2, sizes[s][0], sizes[s][1]);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&input);
+    // Reference from a net reshaped to the input
+    Blob<Dtype>* net_input = this->net_->input_blobs()[0];
+    net_input->ReshapeLike(input);
+    net_input->CopyFrom(input);
+    this->net_->Reshape();
+    const Blob<Dtype>& expected = *this->net_->ForwardPrefilled()[0];
+
+    int bucket = -1;
+    const Blob<Dtype>& output = *buckets.Forward(input, &bucket)[0];
+    EXPECT_EQ(bucket, sizes[s][1] > 8 ? 1 : 0);
+    // Bucket shapes never change
+    EXPECT_EQ(buckets.net(bucket)->input_blobs()[0]->shape(),
+              this->shapes_[bucket]);
+    ASSERT_EQ(output.channels(), 3);
+    ASSERT_EQ(output.height(), 8);
+    for (int c = 0; c < 3; ++c) {
+      for (int h = 0; h < expected.height(); ++h) {
+        for (int w = 0; w < expected.width(); ++w) {
+          EXPECT_NEAR(expected.data_at(0, c, h, w),
+                      output.data_at(0, c, h, w), 1e-4);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace caffe
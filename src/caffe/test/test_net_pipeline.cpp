@@ -0,0 +1,137 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/net_pipeline.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class NetPipelineTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  NetPipelineTest() {
+    // 'data' is used by the first and last layers, 'ip2' is split
+    const string proto =
+        "input: 'data' "
+        "input_shape { dim: 2 dim: 6 } "
+        "layer { "
+        "  name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 8 "
+        "    weight_filler { type: 'gaussian' } "
+        "    bias_filler { type: 'gaussian' } "
+        "  } "
+        "} "
+        "layer { name: 'relu1' type: 'ReLU' bottom: 'ip1' top: 'ip1' } "
+        "layer { "
+        "  name: 'ip2' type: 'InnerProduct' bottom: 'ip1' top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 6 "
+        "    weight_filler { type: 'gaussian' } "
+        "  } "
+        "} "
+        "layer { name: 'tanh' type: 'TanH' bottom: 'ip2' top: 'tanh' } "
+        "layer { "
+        "  name: 'sum' type: 'Eltwise' bottom: 'tanh' bottom: 'ip2' "
+        "  bottom: 'data' top: 'sum' "
+        "} ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param_));
+    Caffe::set_random_seed(1701);
+    net_.reset(new Net<Dtype>(param_));
+  }
+
+  // Runs micro-batches through the pipeline and compares with the net
+  void TestForward(NetPipeline<Dtype>* pipeline) {
+    const int kBatches = 7;
+    vector<shared_ptr<Blob<Dtype> > > inputs(kBatches);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    for (int b = 0; b < kBatches; ++b) {
+      inputs[b].reset(new Blob<Dtype>(net_->input_blobs()[0]->shape()));
+      filler.Fill(inputs[b].get());
+    }
+    // Keep several micro-batches in flight
+    Blob<Dtype> output;
+    vector<Blob<Dtype>*> outputs(1, &output);
+    int popped = 0;
+    for (int b = 0; b < kBatches; ++b) {
+      pipeline->Push(vector<Blob<Dtype>*>(1, inputs[b].get()));
+      if (b >= 2) {
+        pipeline->Pop(outputs);
+        Check(*inputs[popped++], output);
+      }
+    }
+    while (popped < kBatches) {
+      pipeline->Pop(outputs);
+      Check(*inputs[popped++], output);
+    }
+  }
+
+  void Check(const Blob<Dtype>& input, const Blob<Dtype>& output) {
+    net_->input_blobs()[0]->CopyFrom(input);
+    const Blob<Dtype>& expected = *net_->ForwardPrefilled()[0];
+    ASSERT_EQ(expected.shape(), output.shape());
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_NEAR(expected.cpu_data()[i], output.cpu_data()[i], 1e-5);
+    }
+  }
+
+  NetParameter param_;
+  shared_ptr<Net<Dtype> > net_;
+};
+
+TYPED_TEST_CASE(NetPipelineTest, TestDtypesAndDevices);
+
+TYPED_TEST(NetPipelineTest, TestPartition) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<double> costs(4, 1);
+  vector<int> starts = NetPipeline<Dtype>::Partition(costs, 2);
+  ASSERT_EQ(starts.size(), 2);
+  EXPECT_EQ(starts[0], 0);
+  EXPECT_EQ(starts[1], 2);
+  costs[0] = 5;
+  costs.push_back(1);
+  starts = NetPipeline<Dtype>::Partition(costs, 2);
+  EXPECT_EQ(starts[1], 1);
+  starts = NetPipeline<Dtype>::Partition(costs, 5);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(starts[i], i);
+  }
+  costs[0] = 1;
+  costs[4] = 3;
+  starts = NetPipeline<Dtype>::Partition(costs, 3);
+  EXPECT_EQ(starts[1], 2);
+  EXPECT_EQ(starts[2], 4);
+}
+
+TYPED_TEST(NetPipelineTest, TestForwardStarts) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Splits in-place ReLU from its input
+  vector<int> starts;
+  starts.push_back(0);
+  starts.push_back(1);
+  starts.push_back(3);
+  NetPipeline<Dtype> pipeline(this->param_, *this->net_, starts);
+  EXPECT_EQ(pipeline.stages(), 3);
+  this->TestForward(&pipeline);
+}
+
+TYPED_TEST(NetPipelineTest, TestForwardProfiled) {
+  typedef typename TypeParam::Dtype Dtype;
+  NetPipeline<Dtype> pipeline(this->param_, *this->net_, 2, true);
+  EXPECT_EQ(pipeline.stages(), 2);
+  this->TestForward(&pipeline);
+}
+
+}  // namespace caffe
@@ -0,0 +1,350 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/thread.hpp"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/solver.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class SocketRingTest : public ::testing::Test {
+ protected:
+  SocketRingTest() : count_(1001) {}
+
+  // Fills rank r's buffer with r + i, so the sum over n ranks is
+  // n * i + n * (n - 1) / 2.
+  void Fill(int rank, vector<Dtype>* buffer) {
+    buffer->resize(count_);
+    for (int i = 0; i < count_; ++i) {
+      (*buffer)[i] = rank + i;
+    }
+  }
+
+  void Allreduce(const vector<string>* endpoints, int rank,
+                 vector<Dtype>* buffer) {
+    SocketRing ring(*endpoints, rank);
+    Fill(rank, buffer);
+    ring.allreduce(&(*buffer)[0], buffer->size());
+  }
+
+  void AllreduceHalf(const vector<string>* endpoints, int rank,
+                     vector<Dtype>* buffer) {
+    SocketRing ring(*endpoints, rank);
+    Fill(rank, buffer);
+    ring.allreduce_half(&(*buffer)[0], buffer->size());
+    // Two bytes per value, over 2 * (size - 1) chunks
+    EXPECT_LE(ring.bytes_sent(),
+              (count_ / ring.size() + 1) * 2 * (ring.size() - 1) * 2);
+  }
+
+  void Check(int size, const vector<Dtype>& buffer) {
+    ASSERT_EQ(count_, buffer.size());
+    for (int i = 0; i < count_; ++i) {
+      EXPECT_EQ(size * i + size * (size - 1) / 2, buffer[i]);
+    }
+  }
+
+  void RunThreads(const string& spec, int size) {
+    vector<string> endpoints;
+    SocketRing::expand(spec, size, &endpoints);
+    vector<vector<Dtype> > buffers(size);
+    boost::thread_group threads;
+    for (int rank = 0; rank < size; ++rank) {
+      threads.create_thread(boost::bind(&SocketRingTest::Allreduce, this,
+          &endpoints, rank, &buffers[rank]));
+    }
+    threads.join_all();
+    for (int rank = 0; rank < size; ++rank) {
+      Check(size, buffers[rank]);
+    }
+  }
+
+  void RunThreadsHalf(const string& spec, int size) {
+    vector<string> endpoints;
+    SocketRing::expand(spec, size, &endpoints);
+    vector<vector<Dtype> > buffers(size);
+    boost::thread_group threads;
+    for (int rank = 0; rank < size; ++rank) {
+      threads.create_thread(boost::bind(&SocketRingTest::AllreduceHalf, this,
+          &endpoints, rank, &buffers[rank]));
+    }
+    threads.join_all();
+    for (int i = 0; i < count_; ++i) {
+      const Dtype expected = size * i + size * (size - 1) / 2;
+      EXPECT_NEAR(expected, buffers[0][i], expected / 2048);
+      // All ranks must end up with the same values
+      for (int rank = 1; rank < size; ++rank) {
+        EXPECT_EQ(buffers[0][i], buffers[rank][i]);
+      }
+    }
+  }
+
+  string UnixSpec() {
+    std::ostringstream spec;
+    spec << "unix:/tmp/caffe_test_ring_" << getpid();
+    return spec.str();
+  }
+
+  const int count_;
+};
+
+TYPED_TEST_CASE(SocketRingTest, TestDtypes);
+
+TYPED_TEST(SocketRingTest, TestExpand) {
+  vector<string> endpoints;
+  SocketRing::expand("tcp://localhost:5000", 3, &endpoints);
+  ASSERT_EQ(3, endpoints.size());
+  EXPECT_EQ("tcp://localhost:5000", endpoints[0]);
+  EXPECT_EQ("tcp://localhost:5002", endpoints[2]);
+  SocketRing::expand("unix:/tmp/ring", 2, &endpoints);
+  ASSERT_EQ(2, endpoints.size());
+  EXPECT_EQ("unix:/tmp/ring.1", endpoints[1]);
+  SocketRing::expand("tcp://a:1,tcp://b:2", 2, &endpoints);
+  ASSERT_EQ(2, endpoints.size());
+  EXPECT_EQ("tcp://b:2", endpoints[1]);
+  // Without a count, one process per endpoint
+  SocketRing::expand("tcp://a:1,tcp://b:2,tcp://c:3", 0, &endpoints);
+  ASSERT_EQ(3, endpoints.size());
+  SocketRing::expand("tcp://a:1", 0, &endpoints);
+  ASSERT_EQ(1, endpoints.size());
+}
+
+TYPED_TEST(SocketRingTest, TestSingleRank) {
+  vector<string> endpoints(1, this->UnixSpec());
+  vector<TypeParam> buffer;
+  this->Allreduce(&endpoints, 0, &buffer);
+  this->Check(1, buffer);
+}
+
+TYPED_TEST(SocketRingTest, TestAllreduceUnix) {
+  this->RunThreads(this->UnixSpec(), 2);
+  this->RunThreads(this->UnixSpec(), 3);
+}
+
+TYPED_TEST(SocketRingTest, TestAllreduceHalf) {
+  this->RunThreadsHalf(this->UnixSpec(), 2);
+  this->RunThreadsHalf(this->UnixSpec(), 3);
+}
+
+TYPED_TEST(SocketRingTest, TestAllreduceTCP) {
+  std::ostringstream spec;
+  spec << "tcp://localhost:" << 20000 + getpid() % 20000;
+  this->RunThreads(spec.str(), 4);
+}
+
+TYPED_TEST(SocketRingTest, TestAllreduceProcesses) {
+  const int size = 3;
+  vector<string> endpoints;
+  SocketRing::expand(this->UnixSpec(), size, &endpoints);
+  vector<pid_t> children;
+  for (int rank = 1; rank < size; ++rank) {
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+      vector<TypeParam> buffer;
+      this->Allreduce(&endpoints, rank, &buffer);
+      bool ok = true;
+      for (int i = 0; i < this->count_; ++i) {
+        ok &= buffer[i] == size * i + size * (size - 1) / 2;
+      }
+      _exit(ok ? 0 : 1);
+    }
+    children.push_back(pid);
+  }
+  vector<TypeParam> buffer;
+  this->Allreduce(&endpoints, 0, &buffer);
+  this->Check(size, buffer);
+  for (int i = 0; i < children.size(); ++i) {
+    int status;
+    ASSERT_EQ(children[i], waitpid(children[i], &status, 0));
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+  }
+}
+
+class SocketRingBroadcastTest : public ::testing::Test {
+ protected:
+  static void Broadcast(const vector<string>* endpoints, int rank,
+                        vector<int>* buffer) {
+    SocketRing ring(*endpoints, rank);
+    buffer->assign(100, rank == 0 ? 7 : 0);
+    ring.broadcast(&(*buffer)[0], buffer->size() * sizeof(int));
+  }
+
+  static void Allgather(const vector<string>* endpoints, int rank,
+                        vector<int>* buffer) {
+    SocketRing ring(*endpoints, rank);
+    vector<int> send(10, rank);
+    buffer->resize(send.size() * ring.size());
+    ring.allgather(&send[0], send.size() * sizeof(int), &(*buffer)[0]);
+  }
+};
+
+TEST_F(SocketRingBroadcastTest, TestBroadcast) {
+  const int size = 3;
+  std::ostringstream spec;
+  spec << "unix:/tmp/caffe_test_broadcast_" << getpid();
+  vector<string> endpoints;
+  SocketRing::expand(spec.str(), size, &endpoints);
+  vector<vector<int> > buffers(size);
+  boost::thread_group threads;
+  for (int rank = 0; rank < size; ++rank) {
+    threads.create_thread(boost::bind(&SocketRingBroadcastTest::Broadcast,
+        &endpoints, rank, &buffers[rank]));
+  }
+  threads.join_all();
+  for (int rank = 0; rank < size; ++rank) {
+    for (int i = 0; i < buffers[rank].size(); ++i) {
+      EXPECT_EQ(7, buffers[rank][i]);
+    }
+  }
+}
+
+TEST_F(SocketRingBroadcastTest, TestAllgather) {
+  const int size = 3;
+  std::ostringstream spec;
+  spec << "unix:/tmp/caffe_test_allgather_" << getpid();
+  vector<string> endpoints;
+  SocketRing::expand(spec.str(), size, &endpoints);
+  vector<vector<int> > buffers(size);
+  boost::thread_group threads;
+  for (int rank = 0; rank < size; ++rank) {
+    threads.create_thread(boost::bind(&SocketRingBroadcastTest::Allgather,
+        &endpoints, rank, &buffers[rank]));
+  }
+  threads.join_all();
+  for (int rank = 0; rank < size; ++rank) {
+    ASSERT_EQ(10 * size, buffers[rank].size());
+    for (int i = 0; i < buffers[rank].size(); ++i) {
+      EXPECT_EQ(i / 10, buffers[rank][i]);
+    }
+  }
+}
+
+template <typename Dtype>
+class SocketSyncTest : public ::testing::Test {
+ protected:
+  // Fits a linear regression to random data, different on each rank.
+  void Train(const vector<string>* endpoints, int rank,
+             SolverParameter_GradientCompression compression, float ratio,
+             vector<Dtype>* weights, Dtype* initial_loss, Dtype* loss) {
+    Caffe::set_random_seed(1701 + rank);
+    const string proto =
+        "base_lr: 0.005 lr_policy: 'fixed' momentum: 0.9 max_iter: 200 "
+        "display: 0 snapshot_after_train: false "
+        "net_param { "
+        "  layer { "
+        "    name: 'data' type: 'DummyData' top: 'data' top: 'target' "
+        "    dummy_data_param { "
+        "      shape { dim: 8 dim: 20 } shape { dim: 8 dim: 1 } "
+        "      data_filler { type: 'gaussian' } "
+        "      data_filler { type: 'constant' value: 1 } "
+        "    } "
+        "  } "
+        "  layer { "
+        "    name: 'ip' type: 'InnerProduct' bottom: 'data' top: 'ip' "
+        "    inner_product_param { "
+        "      num_output: 1 weight_filler { type: 'gaussian' } "
+        "    } "
+        "  } "
+        "  layer { "
+        "    name: 'loss' type: 'EuclideanLoss' "
+        "    bottom: 'ip' bottom: 'target' top: 'loss' "
+        "  } "
+        "} ";
+    SolverParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.set_gradient_compression(compression);
+    param.set_gradient_topk_ratio(ratio);
+    shared_ptr<Solver<Dtype> > solver(new SGDSolver<Dtype>(param));
+    SocketSync<Dtype> sync(solver, *endpoints, rank);
+    // Rank 0's weights are broadcast, so they are the initial ones
+    *initial_loss = Loss(solver->net().get());
+    sync.run();
+    *loss = Loss(solver->net().get());
+    weights->assign(sync.data(), sync.data() + sync.size());
+  }
+
+  Dtype Loss(Net<Dtype>* net) {
+    Dtype total = 0;
+    for (int i = 0; i < 10; ++i) {
+      Dtype loss;
+      net->ForwardPrefilled(&loss);
+      total += loss;
+    }
+    return total / 10;
+  }
+
+  // Trains on 'size' ranks and returns rank 0's weights, after checking all
+  // ranks got the same ones and the loss went down.
+  void Run(int size, SolverParameter_GradientCompression compression,
+           float ratio, vector<Dtype>* weights) {
+    std::ostringstream spec;
+    spec << "unix:/tmp/caffe_test_sync_" << getpid();
+    vector<string> endpoints;
+    SocketRing::expand(spec.str(), size, &endpoints);
+    vector<vector<Dtype> > results(size);
+    vector<Dtype> initial_loss(size), loss(size);
+    boost::thread_group threads;
+    for (int rank = 0; rank < size; ++rank) {
+      threads.create_thread(boost::bind(&SocketSyncTest::Train, this,
+          &endpoints, rank, compression, ratio, &results[rank],
+          &initial_loss[rank], &loss[rank]));
+    }
+    threads.join_all();
+    for (int rank = 1; rank < size; ++rank) {
+      ASSERT_EQ(results[0].size(), results[rank].size());
+      for (int i = 0; i < results[0].size(); ++i) {
+        EXPECT_EQ(results[0][i], results[rank][i]);
+      }
+    }
+    EXPECT_LT(loss[0], initial_loss[0] / 10);
+    *weights = results[0];
+  }
+};
+
+TYPED_TEST_CASE(SocketSyncTest, TestDtypes);
+
+TYPED_TEST(SocketSyncTest, TestNone) {
+  vector<TypeParam> weights;
+  this->Run(2, SolverParameter_GradientCompression_NONE, 0, &weights);
+}
+
+TYPED_TEST(SocketSyncTest, TestFP16) {
+  vector<TypeParam> reference, weights;
+  this->Run(2, SolverParameter_GradientCompression_NONE, 0, &reference);
+  this->Run(2, SolverParameter_GradientCompression_FP16, 0, &weights);
+  for (int i = 0; i < weights.size(); ++i) {
+    EXPECT_NEAR(reference[i], weights[i], 1e-2);
+  }
+}
+
+TYPED_TEST(SocketSyncTest, TestTopkAll) {
+  // Sending all values is the same as no compression, up to summation order
+  vector<TypeParam> reference, weights;
+  this->Run(3, SolverParameter_GradientCompression_NONE, 0, &reference);
+  this->Run(3, SolverParameter_GradientCompression_TOPK, 1, &weights);
+  for (int i = 0; i < weights.size(); ++i) {
+    EXPECT_NEAR(reference[i], weights[i], 1e-4);
+  }
+}
+
+TYPED_TEST(SocketSyncTest, TestTopk) {
+  // Converges with one value of 21 per rank, thanks to error feedback
+  vector<TypeParam> weights;
+  this->Run(2, SolverParameter_GradientCompression_TOPK, 0.05, &weights);
+}
+
+}  // namespace caffe
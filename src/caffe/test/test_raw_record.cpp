@@ -0,0 +1,78 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/raw_record.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class RawRecordTest : public ::testing::Test {
+ protected:
+  RawRecordTest() {
+    datum_.set_label(7);
+    datum_.set_channels(2);
+    datum_.set_height(3);
+    datum_.set_width(4);
+    for (int i = 0; i < 24; ++i) {
+      datum_.mutable_data()->push_back(static_cast<char>(i * 10));
+      float_datum_.add_float_data(i * 0.25 - 2);
+    }
+    float_datum_.set_label(-1);
+    float_datum_.set_channels(2);
+    float_datum_.set_height(3);
+    float_datum_.set_width(4);
+  }
+
+  Datum datum_;
+  Datum float_datum_;
+};
+
+TEST_F(RawRecordTest, TestUint8) {
+  string record;
+  DatumToRawRecord(datum_, Datum_DataType_UINT8, &record);
+  EXPECT_EQ(record.size(), kRawRecordHeaderSize + 24);
+  ASSERT_TRUE(IsRawRecord(record));
+  Datum datum;
+  RawRecordToDatum(record, &datum);
+  EXPECT_EQ(datum.label(), 7);
+  EXPECT_EQ(datum.channels(), 2);
+  EXPECT_EQ(datum.height(), 3);
+  EXPECT_EQ(datum.width(), 4);
+  EXPECT_EQ(datum.data_type(), Datum_DataType_UINT8);
+  EXPECT_EQ(datum.data(), datum_.data());
+}
+
+TEST_F(RawRecordTest, TestFloat) {
+  const Datum::DataType types[] = {Datum_DataType_FLOAT32,
+      Datum_DataType_FLOAT16};
+  for (int t = 0; t < 2; ++t) {
+    string record;
+    DatumToRawRecord(float_datum_, types[t], &record);
+    EXPECT_EQ(record.size(), kRawRecordHeaderSize + 24 * (t ? 2 : 4));
+    Datum datum;
+    RawRecordToDatum(record, &datum);
+    EXPECT_EQ(datum.label(), -1);
+    EXPECT_EQ(datum.data_type(), types[t]);
+    // Quarters in [-2, 4) are exact in half precision
+    vector<float> values(24);
+    DatumToFloat(datum, &values[0]);
+    for (int i = 0; i < 24; ++i) {
+      EXPECT_EQ(values[i], float_datum_.float_data(i));
+    }
+  }
+}
+
+TEST_F(RawRecordTest, TestNotRawRecord) {
+  string value;
+  datum_.SerializeToString(&value);
+  EXPECT_FALSE(IsRawRecord(value));
+  float_datum_.SerializeToString(&value);
+  EXPECT_FALSE(IsRawRecord(value));
+}
+
+}  // namespace caffe
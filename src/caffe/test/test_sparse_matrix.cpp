@@ -0,0 +1,102 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/sparse_matrix.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class SparseMatrixTest : public ::testing::Test {
+ protected:
+  SparseMatrixTest() : weights_(7, 5, 1, 1), input_(5, 6, 1, 1) {
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&weights_);
+    filler.Fill(&input_);
+    // Keep about a quarter, none in the third row
+    Dtype* data = weights_.mutable_cpu_data();
+    for (int i = 0; i < weights_.count(); ++i) {
+      if (i % 4 || i / 5 == 2) {
+        data[i] = 0;
+      }
+    }
+  }
+
+  Blob<Dtype> weights_;
+  Blob<Dtype> input_;
+};
+
+TYPED_TEST_CASE(SparseMatrixTest, TestDtypes);
+
+TYPED_TEST(SparseMatrixTest, TestGemm) {
+  SparseMatrix<TypeParam> sparse;
+  sparse.FromDense(7, 5, this->weights_.cpu_data());
+  EXPECT_EQ(sparse.nnz(), 8);
+  vector<TypeParam> expected(7 * 6);
+  vector<TypeParam> result(7 * 6);
+  caffe_cpu_gemm<TypeParam>(CblasNoTrans, CblasNoTrans, 7, 6, 5, 1.,
+      this->weights_.cpu_data(), this->input_.cpu_data(), 0., &expected[0]);
+  sparse.Gemm(6, this->input_.cpu_data(), &result[0]);
+  for (int i = 0; i < expected.size(); ++i) {
+    EXPECT_NEAR(expected[i], result[i], 1e-5);
+  }
+}
+
+TYPED_TEST(SparseMatrixTest, TestGemmTransposed) {
+  SparseMatrix<TypeParam> sparse;
+  sparse.FromDense(7, 5, this->weights_.cpu_data());
+  // The input as 6 rows of 5
+  vector<TypeParam> expected(6 * 7);
+  vector<TypeParam> result(6 * 7);
+  caffe_cpu_gemm<TypeParam>(CblasNoTrans, CblasTrans, 6, 7, 5, 1.,
+      this->input_.cpu_data(), this->weights_.cpu_data(), 0., &expected[0]);
+  sparse.GemmTransposed(6, this->input_.cpu_data(), &result[0]);
+  for (int i = 0; i < expected.size(); ++i) {
+    EXPECT_NEAR(expected[i], result[i], 1e-5);
+  }
+}
+
+TYPED_TEST(SparseMatrixTest, TestSparseWeights) {
+  SparseWeights<TypeParam> sparse_weights;
+  const double max_density = sparse_max_density();
+  set_sparse_max_density(0.3);
+  const SparseMatrix<TypeParam>* sparse =
+      sparse_weights.Get(this->weights_, 7, 5);
+  ASSERT_TRUE(sparse != NULL);
+  EXPECT_EQ(sparse->nnz(), 8);
+  // Rebuilt when the weights change, and given up when they are dense
+  this->weights_.mutable_cpu_data()[1] = 1;
+  EXPECT_EQ(sparse_weights.Get(this->weights_, 7, 5)->nnz(), 9);
+  caffe_set(this->weights_.count(), TypeParam(1),
+      this->weights_.mutable_cpu_data());
+  EXPECT_TRUE(sparse_weights.Get(this->weights_, 7, 5) == NULL);
+  set_sparse_max_density(max_density);
+}
+
+TYPED_TEST(SparseMatrixTest, TestBlobProto) {
+  BlobProto proto;
+  this->weights_.ToProto(&proto);
+  SparsifyBlobProto(&proto);
+  EXPECT_EQ(proto.sparse_index_size(), 8);
+  EXPECT_EQ(proto.data_size() + proto.double_data_size(), 8);
+  Blob<TypeParam> blob;
+  blob.FromProto(proto);
+  ASSERT_EQ(blob.shape(), this->weights_.shape());
+  for (int i = 0; i < blob.count(); ++i) {
+    EXPECT_EQ(this->weights_.cpu_data()[i], blob.cpu_data()[i]);
+  }
+  // Dense blobs are left alone
+  this->input_.ToProto(&proto);
+  SparsifyBlobProto(&proto);
+  EXPECT_EQ(proto.sparse_index_size(), 0);
+}
+
+}  // namespace caffe
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstring>
 #include <vector>
 
@@ -6,6 +7,7 @@
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/device_alternate.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -68,6 +70,34 @@ TEST_F(SyncedMemoryTest, TestCPUWrite) {
   }
 }
 
+TEST_F(SyncedMemoryTest, TestCPUWriteDiscard) {
+  SyncedMemory mem(10 * sizeof(float));
+  float* cpu_data = static_cast<float*>(mem.mutable_cpu_data_discard());
+  EXPECT_EQ(mem.head(), SyncedMemory::HEAD_AT_CPU);
+  for (int i = 0; i < 10; ++i) {
+    cpu_data[i] = i;
+  }
+  EXPECT_EQ(mem.cpu_data(), cpu_data);
+  EXPECT_EQ(static_cast<const float*>(mem.cpu_data())[9], 9);
+}
+
+TEST_F(SyncedMemoryTest, TestCPUWriteDiscardPoison) {
+  const bool poison = SyncedMemory::poison();
+  SyncedMemory::set_poison(true);
+  SyncedMemory mem(10 * sizeof(double));
+  caffe_memset(mem.size(), 0, mem.mutable_cpu_data());
+  // Written values are lost, unwritten ones are NaNs
+  const double* data = static_cast<double*>(mem.mutable_cpu_data_discard());
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(isnan(data[i]));
+  }
+  const float* data_float = static_cast<float*>(mem.mutable_cpu_data_discard());
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_TRUE(isnan(data_float[i]));
+  }
+  SyncedMemory::set_poison(poison);
+}
+
 #ifndef CPU_ONLY  // GPU test
 
 TEST_F(SyncedMemoryTest, TestGPURead) {
@@ -100,6 +130,22 @@ TEST_F(SyncedMemoryTest, TestGPURead) {
   delete[] recovered_value;
 }
 
+TEST_F(SyncedMemoryTest, TestGPUWriteCPUDiscard) {
+  SyncedMemory mem(10);
+  void* gpu_data = mem.mutable_gpu_data();
+  caffe_gpu_memset(mem.size(), 1, gpu_data);
+  // Not copied from the GPU
+  void* cpu_data = mem.mutable_cpu_data_discard();
+  EXPECT_EQ(mem.head(), SyncedMemory::HEAD_AT_CPU);
+  caffe_memset(mem.size(), 2, cpu_data);
+  char* recovered_value = new char[10];
+  caffe_gpu_memcpy(10, mem.gpu_data(), recovered_value);
+  for (int i = 0; i < mem.size(); ++i) {
+    EXPECT_EQ(recovered_value[i], 2);
+  }
+  delete[] recovered_value;
+}
+
 TEST_F(SyncedMemoryTest, TestGPUWrite) {
   SyncedMemory mem(10);
   void* gpu_data = mem.mutable_gpu_data();
@@ -123,4 +169,131 @@ TEST_F(SyncedMemoryTest, TestGPUWrite) {
 
 #endif
 
+class HostAllocatorTest : public ::testing::Test {
+ protected:
+  HostAllocatorTest() {
+    allocator_.set_cache_limit(1 << 20);
+  }
+
+  HostAllocator allocator_;
+};
+
+TEST_F(HostAllocatorTest, TestSizeClass) {
+  EXPECT_EQ(HostAllocator::size_class(0), 64);
+  EXPECT_EQ(HostAllocator::size_class(1), 64);
+  EXPECT_EQ(HostAllocator::size_class(64), 64);
+  EXPECT_EQ(HostAllocator::size_class(65), 128);
+  EXPECT_EQ(HostAllocator::size_class(256), 256);
+  EXPECT_EQ(HostAllocator::size_class(257), 320);
+  EXPECT_EQ(HostAllocator::size_class(1000), 1024);
+  EXPECT_EQ(HostAllocator::size_class(1025), 1280);
+  for (size_t size = 1; size < 100000; size = size * 3 / 2 + 1) {
+    const size_t bytes = HostAllocator::size_class(size);
+    EXPECT_GE(bytes, size);
+    EXPECT_LE(bytes, std::max(size * 5 / 4, static_cast<size_t>(64)) + 63);
+    EXPECT_EQ(bytes % HostAllocator::kAlignment, 0);
+  }
+}
+
+TEST_F(HostAllocatorTest, TestAlignment) {
+  vector<void*> ptrs;
+  for (size_t size = 1; size < 100000; size = size * 2 + 1) {
+    void* ptr = allocator_.Allocate(size);
+    EXPECT_EQ(reinterpret_cast<size_t>(ptr) % HostAllocator::kAlignment, 0);
+    caffe_memset(size, 1, ptr);
+    ptrs.push_back(ptr);
+  }
+  for (int i = 0; i < ptrs.size(); ++i) {
+    allocator_.Free(ptrs[i]);
+  }
+}
+
+TEST_F(HostAllocatorTest, TestReuse) {
+  void* ptr = allocator_.Allocate(1000);
+  allocator_.Free(ptr);
+  // Same size class
+  EXPECT_EQ(allocator_.Allocate(1020), ptr);
+  EXPECT_EQ(allocator_.stats().allocations, 2);
+  EXPECT_EQ(allocator_.stats().cache_hits, 1);
+  void* other = allocator_.Allocate(1000);
+  EXPECT_NE(other, ptr);
+  allocator_.Free(ptr);
+  allocator_.Free(other);
+}
+
+TEST_F(HostAllocatorTest, TestStats) {
+  void* a = allocator_.Allocate(1000);
+  void* b = allocator_.Allocate(64);
+  EXPECT_EQ(allocator_.stats().live_bytes, 1024 + 64);
+  EXPECT_EQ(allocator_.stats().peak_bytes, 1024 + 64);
+  EXPECT_EQ(allocator_.stats().cached_bytes, 0);
+  allocator_.Free(a);
+  EXPECT_EQ(allocator_.stats().live_bytes, 64);
+  EXPECT_EQ(allocator_.stats().peak_bytes, 1024 + 64);
+  EXPECT_EQ(allocator_.stats().cached_bytes, 1024);
+  allocator_.Free(b);
+  EXPECT_EQ(allocator_.stats().live_bytes, 0);
+  EXPECT_EQ(allocator_.stats().cached_bytes, 1024 + 64);
+  allocator_.Release();
+  EXPECT_EQ(allocator_.stats().cached_bytes, 0);
+}
+
+TEST_F(HostAllocatorTest, TestCacheLimit) {
+  allocator_.set_cache_limit(1024);
+  void* a = allocator_.Allocate(1024);
+  void* b = allocator_.Allocate(1024);
+  allocator_.Free(a);
+  allocator_.Free(b);
+  EXPECT_EQ(allocator_.stats().cached_bytes, 1024);
+  allocator_.set_cache_limit(0);
+  EXPECT_EQ(allocator_.stats().cached_bytes, 0);
+  allocator_.Free(allocator_.Allocate(64));
+  EXPECT_EQ(allocator_.stats().cached_bytes, 0);
+  EXPECT_EQ(allocator_.stats().cache_hits, 0);
+}
+
+TEST_F(HostAllocatorTest, TestHugePages) {
+  allocator_.set_huge_pages(true);
+  const size_t size = 3 << 20;
+  char* ptr = static_cast<char*>(allocator_.Allocate(size));
+  EXPECT_EQ(reinterpret_cast<size_t>(ptr) % HostAllocator::kAlignment, 0);
+  caffe_memset(size, 3, ptr);
+  EXPECT_EQ(ptr[size - 1], 3);
+  allocator_.Free(ptr);
+  EXPECT_EQ(allocator_.Allocate(size), ptr);
+  allocator_.Free(ptr);
+}
+
+TEST_F(HostAllocatorTest, TestUncached) {
+  allocator_.set_cache_limit(0);
+  void* a = allocator_.Allocate(1000);
+  EXPECT_EQ(reinterpret_cast<size_t>(a) % HostAllocator::kAlignment, 0);
+  caffe_memset(1000, 1, a);
+  EXPECT_EQ(allocator_.stats().allocations, 0);
+  EXPECT_EQ(allocator_.stats().live_bytes, 0);
+  // Blocks from before the cache was enabled are returned to the system
+  allocator_.set_cache_limit(1 << 20);
+  void* b = allocator_.Allocate(1000);
+  allocator_.Free(a);
+  EXPECT_EQ(allocator_.stats().cached_bytes, 0);
+  EXPECT_EQ(allocator_.stats().live_bytes, 1024);
+  allocator_.Free(b);
+  EXPECT_EQ(allocator_.stats().cached_bytes, 1024);
+}
+
+TEST_F(HostAllocatorTest, TestSyncedMemory) {
+  HostAllocator& allocator = HostAllocator::Get();
+  const size_t cache_limit = allocator.cache_limit();
+  allocator.set_cache_limit(1 << 20);
+  const HostAllocator::Stats before = allocator.stats();
+  {
+    SyncedMemory mem(1000);
+    EXPECT_EQ(reinterpret_cast<size_t>(mem.cpu_data())
+              % HostAllocator::kAlignment, 0);
+    EXPECT_EQ(allocator.stats().live_bytes, before.live_bytes + 1024);
+  }
+  EXPECT_EQ(allocator.stats().live_bytes, before.live_bytes);
+  allocator.set_cache_limit(cache_limit);
+}
+
 }  // namespace caffe
@@ -0,0 +1,75 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/task_graph.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class TaskGraphTest : public ::testing::Test {
+ protected:
+  TaskGraphTest() : graph_(4), done_(8, 0), count_(0) {}
+
+  // A task recording the order in which tasks finish
+  boost::function<void(int)> Record() {
+    return boost::bind(&TaskGraphTest::Done, this, 0, 1, _1);
+  }
+
+  // A task running a nested loop of two tasks on the same pool
+  boost::function<void(int)> Nested() {
+    return boost::bind(&TaskGraphTest::RunNested, this, _1);
+  }
+
+  void Done(int offset, int stride, int i) {
+    boost::mutex::scoped_lock lock(mutex_);
+    done_[offset + stride * i] = ++count_;
+  }
+
+  void RunNested(int i) {
+    graph_.ParallelFor(2, boost::bind(&TaskGraphTest::Done, this, i, 4, _1));
+  }
+
+  TaskGraph graph_;
+  vector<int> done_;
+  int count_;
+  boost::mutex mutex_;
+};
+
+TEST_F(TaskGraphTest, TestRun) {
+  // A chain 0 -> 1 -> 2, and 3 independent of it
+  vector<vector<int> > dependents(4);
+  dependents[0].push_back(1);
+  dependents[1].push_back(2);
+  int deps[] = {0, 1, 1, 0};
+  vector<int> num_deps(deps, deps + 4);
+  graph_.Run(dependents, num_deps, Record());
+  EXPECT_EQ(count_, 4);
+  EXPECT_LT(done_[0], done_[1]);
+  EXPECT_LT(done_[1], done_[2]);
+  EXPECT_GT(done_[3], 0);
+}
+
+TEST_F(TaskGraphTest, TestParallelFor) {
+  graph_.ParallelFor(8, Record());
+  EXPECT_EQ(count_, 8);
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_GT(done_[i], 0);
+  }
+}
+
+TEST_F(TaskGraphTest, TestNestedParallelFor) {
+  // The pool is busy with the outer loop, the inner ones run in place
+  graph_.ParallelFor(4, Nested());
+  EXPECT_EQ(count_, 8);
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_GT(done_[i], 0);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/util/datum_cache.hpp"
+#include "caffe/util/raw_record.hpp"
+
+namespace caffe {
+
+// Blocks are allocated this large, or smaller to stay within the capacity
+static const size_t kBlockSize = 64 << 20;
+
+DatumCache::DatumCache(size_t capacity)
+    : capacity_(capacity), block_used_(0), allocated_(0) {
+}
+
+bool DatumCache::Add(const Datum& datum) {
+  if (datum.encoded()) {
+    datum.SerializeToString(&record_);
+  } else {
+    DatumToRawRecord(datum, datum.data().size() ? datum.data_type() :
+        Datum_DataType_FLOAT32, &record_);
+  }
+  const size_t size = record_.size();
+  if (!blocks_.size() || block_used_ + size > blocks_.back()->size()) {
+    const size_t block = std::min(std::max(size, kBlockSize),
+        capacity_ - allocated_);
+    if (block < size) {
+      return false;
+    }
+    blocks_.push_back(shared_ptr<vector<char> >(new vector<char>(block)));
+    block_used_ = 0;
+    allocated_ += block;
+  }
+  char* data = &(*blocks_.back())[block_used_];
+  memcpy(data, record_.data(), size);  // NOLINT(caffe/alt_fn)
+  block_used_ += size;
+  const Record record = {data, size};
+  records_.push_back(record);
+  return true;
+}
+
+void DatumCache::Get(size_t i, Datum* datum) const {
+  const Record& record = records_[i];
+  if (IsRawRecord(record.data, record.size)) {
+    RawRecordToDatum(record.data, record.size, datum);
+  } else {
+    CHECK(datum->ParseFromArray(record.data, record.size));
+  }
+}
+
+void DatumCache::Clear() {
+  blocks_.clear();
+  records_.clear();
+  block_used_ = 0;
+  allocated_ = 0;
+}
+
+}  // namespace caffe
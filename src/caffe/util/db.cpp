@@ -1,8 +1,12 @@
 #include "caffe/util/db.hpp"
 #include "caffe/util/db_leveldb.hpp"
 #include "caffe/util/db_lmdb.hpp"
+#include "caffe/util/db_packed.hpp"
 
+#include <cstdio>
+#include <cstdlib>
 #include <string>
+#include <vector>
 
 namespace caffe { namespace db {
 
@@ -12,6 +16,8 @@ DB* GetDB(DataParameter::DB backend) {
     return new LevelDB();
   case DataParameter_DB_LMDB:
     return new LMDB();
+  case DataParameter_DB_PACKED:
+    return new PackedDB();
   default:
     LOG(FATAL) << "Unknown database backend";
   }
@@ -22,10 +28,29 @@ DB* GetDB(const string& backend) {
     return new LevelDB();
   } else if (backend == "lmdb") {
     return new LMDB();
+  } else if (backend == "packed") {
+    return new PackedDB();
   } else {
     LOG(FATAL) << "Unknown database backend";
   }
 }
 
+vector<string> ShardNames(const string& source) {
+  const size_t at = source.rfind('@');
+  if (at == string::npos || at + 1 == source.size() ||
+      source.find_first_not_of("0123456789", at + 1) != string::npos) {
+    return vector<string>(1, source);
+  }
+  const int shards = atoi(source.c_str() + at + 1);
+  CHECK_GT(shards, 0) << "No shards in " << source;
+  vector<string> names;
+  for (int i = 0; i < shards; ++i) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-%05d-of-%05d", i, shards);
+    names.push_back(source.substr(0, at) + suffix);
+  }
+  return names;
+}
+
 }  // namespace db
 }  // namespace caffe
@@ -1,7 +1,10 @@
 #include "caffe/util/db_lmdb.hpp"
 
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <string>
 
 namespace caffe { namespace db {
@@ -22,6 +25,41 @@ void LMDB::Open(const string& source, Mode mode) {
   LOG(INFO) << "Opened lmdb " << source;
 }
 
+void LMDBCursor::set_readahead(size_t bytes) {
+  MDB_env* mdb_env = mdb_txn_env(mdb_txn_);
+  MDB_envinfo info;
+  MDB_stat stat;
+  MDB_CHECK(mdb_env_info(mdb_env, &info));
+  MDB_CHECK(mdb_env_stat(mdb_env, &stat));
+  readahead_ = bytes;
+  map_end_ = static_cast<char*>(info.me_mapaddr) +
+      (info.me_last_pgno + 1) * stat.ms_psize;
+  advised_begin_ = advised_end_ = NULL;
+  if (readahead_ && valid_) {
+    Advise();
+  }
+}
+
+void LMDBCursor::Advise() {
+  // Records put in key order are laid out mostly in order in the map, so
+  // the pages following a value are the next ones read. Advise again once
+  // half the window is consumed, or when the cursor jumps out of it.
+  char* value = static_cast<char*>(mdb_value_.mv_data);
+  if (value >= advised_begin_ && value < advised_end_ &&
+      (value + readahead_ / 2 < advised_end_ || advised_end_ == map_end_)) {
+    return;
+  }
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  char* begin = value - reinterpret_cast<size_t>(value) % page_size;
+  char* end = std::min(begin + readahead_, map_end_);
+  if (begin < end) {
+    // Only a hint, failures leave the default paging
+    madvise(begin, end - begin, MADV_WILLNEED);
+  }
+  advised_begin_ = begin;
+  advised_end_ = end;
+}
+
 LMDBCursor* LMDB::NewCursor() {
   MDB_txn* mdb_txn;
   MDB_cursor* mdb_cursor;
@@ -0,0 +1,216 @@
+#include "caffe/util/db_packed.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+namespace caffe { namespace db {
+
+// Buffers this much of the data when cursors move sequentially
+static const size_t kReadBufferSize = 4 << 20;
+
+static void put_uint(uint64_t value, int bytes, string* s) {
+  for (int i = 0; i < bytes; ++i) {
+    s->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+static uint64_t get_uint(const unsigned char* bytes, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; ++i) {
+    value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+  }
+  return value;
+}
+
+PackedCursor::PackedCursor(const string& data,
+    const shared_ptr<const vector<uint64_t> >& offsets)
+    : offsets_(offsets), record_(0), position_(0), data_size_(0),
+      readahead_(0), advised_begin_(0), advised_end_(0) {
+  file_ = fopen(data.c_str(), "rb");
+  CHECK(file_) << "Cannot open " << data;
+  CHECK_EQ(setvbuf(file_, NULL, _IOFBF, kReadBufferSize), 0);
+  struct stat data_stat;
+  CHECK_EQ(fstat(fileno(file_), &data_stat), 0) << "Cannot open " << data;
+  data_size_ = data_stat.st_size;
+  SeekToFirst();
+}
+
+PackedCursor::~PackedCursor() {
+  fclose(file_);
+}
+
+void PackedCursor::Seek(size_t record) {
+  const bool next = record == record_ + 1;
+  record_ = record;
+  if (!valid()) {
+    return;
+  }
+  // Records in order are read through the stream buffer, which moves to a
+  // new position when the cursor starts moving in order from it. Others,
+  // e.g. shuffled, are read alone, as a buffer refill would mostly be
+  // thrown away.
+  const uint64_t offset = (*offsets_)[record];
+  if (position_ != offset && next) {
+    CHECK_EQ(fseeko(file_, offset, SEEK_SET), 0);
+    position_ = offset;
+  }
+  if (position_ != offset) {
+    ReadRecord(offset);
+    return;
+  }
+  ReadString(&key_);
+  ReadString(&value_);
+  if (readahead_) {
+    Advise();
+  }
+}
+
+void PackedCursor::set_readahead(size_t bytes) {
+  // Only hints, failures leave the default readahead
+  readahead_ = bytes;
+  advised_begin_ = advised_end_ = 0;
+  posix_fadvise(fileno(file_), 0, 0,
+      bytes ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+  if (readahead_ && valid()) {
+    Advise();
+  }
+}
+
+void PackedCursor::Advise() {
+  // Advise again once half the window is consumed, or after a jump
+  if (position_ >= advised_begin_ &&
+      position_ + readahead_ / 2 < advised_end_) {
+    return;
+  }
+  posix_fadvise(fileno(file_), position_, readahead_, POSIX_FADV_WILLNEED);
+  advised_begin_ = position_;
+  advised_end_ = position_ + readahead_;
+}
+
+void PackedCursor::ReadRecord(uint64_t offset) {
+  const uint64_t end = record_ + 1 < offsets_->size() ?
+      (*offsets_)[record_ + 1] : data_size_;
+  CHECK_GE(end, offset + 8) << "Truncated packed db";
+  record_buffer_.resize(end - offset);
+  size_t done = 0;
+  while (done < record_buffer_.size()) {
+    const ssize_t n = pread(fileno(file_), &record_buffer_[done],
+        record_buffer_.size() - done, offset + done);
+    CHECK_GT(n, 0) << "Truncated packed db";
+    done += n;
+  }
+  const unsigned char* bytes =
+      reinterpret_cast<const unsigned char*>(record_buffer_.data());
+  const uint64_t key_size = get_uint(bytes, 4);
+  CHECK_LE(8 + key_size, record_buffer_.size()) << "Truncated packed db";
+  const uint64_t value_size = get_uint(bytes + 4 + key_size, 4);
+  CHECK_EQ(8 + key_size + value_size, record_buffer_.size())
+      << "Truncated packed db";
+  key_.assign(record_buffer_, 4, key_size);
+  value_.assign(record_buffer_, 8 + key_size, value_size);
+}
+
+void PackedCursor::ReadString(string* s) {
+  unsigned char size[4];
+  CHECK_EQ(fread(size, 1, 4, file_), 4) << "Truncated packed db";
+  s->resize(get_uint(size, 4));
+  if (s->size()) {
+    CHECK_EQ(fread(&(*s)[0], 1, s->size(), file_), s->size())
+        << "Truncated packed db";
+  }
+  position_ += 4 + s->size();
+}
+
+void PackedTransaction::Put(const string& key, const string& value) {
+  offsets_.push_back(records_.size());
+  put_uint(key.size(), 4, &records_);
+  records_ += key;
+  put_uint(value.size(), 4, &records_);
+  records_ += value;
+}
+
+void PackedTransaction::Commit() {
+  db_->Append(records_, offsets_);
+  records_.clear();
+  offsets_.clear();
+}
+
+void PackedDB::Open(const string& source, Mode mode) {
+  source_ = source;
+  if (mode == NEW) {
+    CHECK_EQ(mkdir(source.c_str(), 0744), 0) << "mkdir " << source
+        << " failed";
+  }
+  // Load the index, and check it matches the data
+  offsets_.reset(new vector<uint64_t>());
+  const string index = source + "/index";
+  const string data = source + "/data";
+  if (mode != NEW) {
+    FILE* file = fopen(index.c_str(), "rb");
+    CHECK(file) << "Cannot open " << index;
+    unsigned char bytes[8];
+    while (fread(bytes, 1, 8, file) == 8) {
+      offsets_->push_back(get_uint(bytes, 8));
+    }
+    fclose(file);
+    struct stat data_stat;
+    CHECK_EQ(stat(data.c_str(), &data_stat), 0) << "Cannot open " << data;
+    data_size_ = data_stat.st_size;
+    CHECK(offsets_->empty() || offsets_->back() < data_size_)
+        << "Index of " << source << " does not match its data";
+  }
+  if (mode != READ) {
+    const char* flags = mode == NEW ? "wb" : "ab";
+    data_ = fopen(data.c_str(), flags);
+    CHECK(data_) << "Cannot create " << data;
+    index_ = fopen(index.c_str(), flags);
+    CHECK(index_) << "Cannot create " << index;
+  }
+  LOG(INFO) << "Opened packed db " << source << " of " << offsets_->size()
+      << " records";
+}
+
+void PackedDB::Close() {
+  if (data_) {
+    CHECK_EQ(fclose(data_), 0);
+    CHECK_EQ(fclose(index_), 0);
+    data_ = index_ = NULL;
+  }
+}
+
+PackedCursor* PackedDB::NewCursor() {
+  // Readers share the index, writable dbs give the records committed so far
+  if (!data_) {
+    return new PackedCursor(source_ + "/data", offsets_);
+  }
+  CHECK_EQ(fflush(data_), 0);
+  return new PackedCursor(source_ + "/data",
+      shared_ptr<const vector<uint64_t> >(new vector<uint64_t>(*offsets_)));
+}
+
+PackedTransaction* PackedDB::NewTransaction() {
+  CHECK(data_) << "Packed db " << source_ << " is read only";
+  return new PackedTransaction(this);
+}
+
+void PackedDB::Append(const string& records, const vector<uint64_t>& offsets) {
+  CHECK(data_) << "Packed db " << source_ << " is read only";
+  string index;
+  for (int i = 0; i < offsets.size(); ++i) {
+    offsets_->push_back(data_size_ + offsets[i]);
+    put_uint(offsets_->back(), 8, &index);
+  }
+  CHECK_EQ(fwrite(records.data(), 1, records.size(), data_), records.size());
+  CHECK_EQ(fwrite(index.data(), 1, index.size(), index_), index.size());
+  CHECK_EQ(fflush(data_), 0);
+  CHECK_EQ(fflush(index_), 0);
+  data_size_ += records.size();
+}
+
+}  // namespace db
+}  // namespace caffe
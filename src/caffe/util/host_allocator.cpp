@@ -0,0 +1,180 @@
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "caffe/util/host_allocator.hpp"
+
+namespace caffe {
+
+static const size_t kHugePageSize = 2 << 20;
+
+static size_t round_up(size_t size, size_t multiple) {
+  return (size + multiple - 1) / multiple * multiple;
+}
+
+HostAllocator::HostAllocator()
+    : cache_limit_(0), huge_pages_(false), tracked_(false) {
+  stats_.live_bytes = 0;
+  stats_.peak_bytes = 0;
+  stats_.cached_bytes = 0;
+  stats_.allocations = 0;
+  stats_.cache_hits = 0;
+}
+
+HostAllocator::~HostAllocator() {
+  Release();
+}
+
+HostAllocator& HostAllocator::Get() {
+  // Never destroyed, so that blobs freed during static destruction still
+  // find their allocator
+  static HostAllocator* allocator = new HostAllocator();
+  return *allocator;
+}
+
+size_t HostAllocator::size_class(size_t size) {
+  if (size <= 4 * kAlignment) {
+    return round_up(std::max(size, static_cast<size_t>(1)), kAlignment);
+  }
+  size_t power = 4 * kAlignment;
+  while (power * 2 <= size) {
+    power *= 2;
+  }
+  return round_up(size, power / 4);
+}
+
+void* HostAllocator::Allocate(size_t size) {
+  if (!cache_limit_ && !huge_pages_) {
+    // Nothing to reuse or map, skip size classes and bookkeeping
+    void* ptr = NULL;
+    const size_t bytes = std::max(size, static_cast<size_t>(1));
+    CHECK(!posix_memalign(&ptr, kAlignment, bytes))
+        << "host allocation of size " << size << " failed";
+    return ptr;
+  }
+  const size_t bytes = size_class(size);
+  boost::mutex::scoped_lock lock(mutex_);
+  void* ptr = NULL;
+  Block block;
+  block.size = bytes;
+  std::map<size_t, vector<std::pair<void*, Block> > >::iterator it =
+      cache_.find(bytes);
+  if (it != cache_.end() && it->second.size()) {
+    ptr = it->second.back().first;
+    block = it->second.back().second;
+    it->second.pop_back();
+    stats_.cached_bytes -= bytes;
+    ++stats_.cache_hits;
+  } else {
+    ptr = SystemAllocate(bytes, &block.mapped);
+    CHECK(ptr) << "host allocation of size " << size << " failed";
+  }
+  live_[ptr] = block;
+  tracked_ = true;
+  ++stats_.allocations;
+  stats_.live_bytes += bytes;
+  stats_.peak_bytes = std::max(stats_.peak_bytes, stats_.live_bytes);
+  return ptr;
+}
+
+void HostAllocator::Free(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+  if (!tracked_) {
+    free(ptr);
+    return;
+  }
+  boost::mutex::scoped_lock lock(mutex_);
+  std::map<void*, Block>::iterator it = live_.find(ptr);
+  if (it == live_.end()) {
+    // Allocated while neither caching nor huge pages were enabled
+    free(ptr);
+    return;
+  }
+  const Block block = it->second;
+  live_.erase(it);
+  tracked_ = live_.size() || cache_limit_ || huge_pages_;
+  stats_.live_bytes -= block.size;
+  if (stats_.cached_bytes + block.size <= cache_limit_) {
+    cache_[block.size].push_back(std::make_pair(ptr, block));
+    stats_.cached_bytes += block.size;
+  } else {
+    SystemFree(ptr, block);
+  }
+}
+
+void HostAllocator::Release() {
+  boost::mutex::scoped_lock lock(mutex_);
+  Trim(0);
+}
+
+HostAllocator::Stats HostAllocator::stats() const {
+  boost::mutex::scoped_lock lock(mutex_);
+  return stats_;
+}
+
+void HostAllocator::set_cache_limit(size_t bytes) {
+  boost::mutex::scoped_lock lock(mutex_);
+  cache_limit_ = bytes;
+  Trim(bytes);
+}
+
+void HostAllocator::set_huge_pages(bool huge_pages) {
+  boost::mutex::scoped_lock lock(mutex_);
+  if (huge_pages != huge_pages_) {
+    // Cached blocks have the previous backing
+    Trim(0);
+  }
+  huge_pages_ = huge_pages;
+}
+
+void* HostAllocator::SystemAllocate(size_t size, bool* mapped) {
+  *mapped = false;
+#ifdef MADV_HUGEPAGE
+  if (huge_pages_ && size >= kHugePageSize) {
+    // Anonymous mappings are page aligned, ask the kernel to back them with
+    // huge pages, fewer page faults and TLB misses on large blobs
+    void* ptr = mmap(NULL, round_up(size, kHugePageSize),
+                     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+    if (ptr != MAP_FAILED) {
+      madvise(ptr, round_up(size, kHugePageSize), MADV_HUGEPAGE);
+      *mapped = true;
+      return ptr;
+    }
+  }
+#endif
+  void* ptr = NULL;
+  if (posix_memalign(&ptr, kAlignment, size)) {
+    return NULL;
+  }
+  return ptr;
+}
+
+void HostAllocator::SystemFree(void* ptr, const Block& block) {
+  if (block.mapped) {
+    munmap(ptr, round_up(block.size, kHugePageSize));
+  } else {
+    free(ptr);
+  }
+}
+
+void HostAllocator::Trim(size_t limit) {
+  // Largest blocks first, they are the cheapest to allocate again per byte
+  std::map<size_t, vector<std::pair<void*, Block> > >::reverse_iterator it;
+  for (it = cache_.rbegin();
+       it != cache_.rend() && stats_.cached_bytes > limit; ++it) {
+    while (it->second.size() && stats_.cached_bytes > limit) {
+      SystemFree(it->second.back().first, it->second.back().second);
+      stats_.cached_bytes -= it->first;
+      it->second.pop_back();
+    }
+  }
+}
+
+}  // namespace caffe
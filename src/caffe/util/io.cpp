@@ -6,7 +6,11 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/highgui/highgui_c.h>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <setjmp.h>
 #include <stdint.h>
+#include <stdio.h>
+// jpeglib.h needs stdio.h
+#include <jpeglib.h>  // NOLINT(build/include_alpha)
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
@@ -72,7 +76,18 @@ cv::Mat ReadImageToCVMat(const string& filename,
   cv::Mat cv_img;
   int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
     CV_LOAD_IMAGE_GRAYSCALE);
-  cv::Mat cv_img_origin = cv::imread(filename, cv_read_flag);
+  cv::Mat cv_img_origin;
+  if (height > 0 && width > 0) {
+    // Large JPEGs are decoded near the size they are resized to
+    Datum datum;
+    int scale;
+    if (ReadFileToDatum(filename, 0, &datum)) {
+      cv_img_origin = DecodeImageToCVMat(datum.data(), height, width,
+          is_color, &scale);
+    }
+  } else {
+    cv_img_origin = cv::imread(filename, cv_read_flag);
+  }
   if (!cv_img_origin.data) {
     LOG(ERROR) << "Could not open or find file " << filename;
     return cv_img_origin;
@@ -181,6 +196,95 @@ cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color) {
   return cv_img;
 }
 
+// libjpeg reports errors to error_exit, which must not return
+struct JpegError {
+  jpeg_error_mgr manager;
+  jmp_buf jump;
+};
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+  longjmp(reinterpret_cast<JpegError*>(cinfo->err)->jump, 1);
+}
+
+// Decodes a JPEG scaled down by the smallest of 1/8, 1/4 or 1/2 that keeps
+// it at least min_height x min_width, and sets scale to its denominator.
+// False if it is not a JPEG, cannot be scaled or fails to decode, leaving
+// cv_img to be released.
+static bool decode_jpeg_scaled(const string& data, const int min_height,
+    const int min_width, const bool is_color, cv::Mat* cv_img, int* scale) {
+  const unsigned char* bytes =
+      reinterpret_cast<const unsigned char*>(data.data());
+  if (data.size() < 3 || bytes[0] != 0xff || bytes[1] != 0xd8 ||
+      bytes[2] != 0xff) {
+    return false;
+  }
+  jpeg_decompress_struct cinfo;
+  JpegError error;
+  cinfo.err = jpeg_std_error(&error.manager);
+  error.manager.error_exit = jpeg_error_exit;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, const_cast<unsigned char*>(bytes), data.size());
+  jpeg_read_header(&cinfo, TRUE);
+  int denom = 8;
+  while (denom > 1 && (cinfo.image_height / denom < min_height ||
+      cinfo.image_width / denom < min_width)) {
+    denom /= 2;
+  }
+  if (denom == 1) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = denom;
+  cinfo.out_color_space = is_color ? JCS_RGB : JCS_GRAYSCALE;
+  jpeg_start_decompress(&cinfo);
+  cv_img->create(cinfo.output_height, cinfo.output_width,
+      is_color ? CV_8UC3 : CV_8UC1);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = cv_img->ptr<uchar>(cinfo.output_scanline);
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  if (is_color) {
+    cv::cvtColor(*cv_img, *cv_img, CV_RGB2BGR);
+  }
+  *scale = denom;
+  return true;
+}
+
+cv::Mat DecodeImageToCVMat(const string& data, const int min_height,
+    const int min_width, const bool is_color, int* scale) {
+  cv::Mat cv_img;
+  if (min_height > 0 && min_width > 0 && decode_jpeg_scaled(data,
+      min_height, min_width, is_color, &cv_img, scale)) {
+    return cv_img;
+  }
+  cv_img.release();
+  *scale = 1;
+  // Wraps the data without copying it
+  cv::Mat encoded(1, data.size(), CV_8UC1,
+      const_cast<char*>(data.data()));
+  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
+    CV_LOAD_IMAGE_GRAYSCALE);
+  return cv::imdecode(encoded, cv_read_flag);
+}
+
+cv::Mat DecodeDatumToCVMat(const Datum& datum, const int min_height,
+    const int min_width, const bool is_color, int* scale) {
+  CHECK(datum.encoded()) << "Datum not encoded";
+  cv::Mat cv_img = DecodeImageToCVMat(datum.data(), min_height, min_width,
+      is_color, scale);
+  if (!cv_img.data) {
+    LOG(ERROR) << "Could not decode datum ";
+  }
+  return cv_img;
+}
+
 // If Datum is encoded will decoded using DecodeDatumToCVMat and CVMatToDatum
 // If Datum is not encoded will do nothing
 bool DecodeDatumNative(Datum* datum) {
@@ -0,0 +1,169 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/util/mapped_weights.hpp"
+
+namespace caffe {
+
+static const char kMagic[8] = {'C', 'A', 'F', 'F', 'E', 'M', 'A', 'P'};
+static const uint32_t kVersion = 1;
+static const uint32_t kAlignment = 4096;
+
+// Fixed size part at the start of the file
+struct MappedWeightsHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t value_size;
+  uint32_t alignment;
+  uint32_t reserved;
+  uint64_t param_size;
+};
+
+static size_t align(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Number of values of a blob, from its shape or legacy dimensions
+static size_t blob_count(const BlobProto& blob) {
+  size_t count = 1;
+  if (blob.has_shape()) {
+    for (int i = 0; i < blob.shape().dim_size(); ++i) {
+      count *= blob.shape().dim(i);
+    }
+  } else {
+    count = static_cast<size_t>(blob.num()) * blob.channels()
+        * blob.height() * blob.width();
+  }
+  return count;
+}
+
+MappedWeights::MappedWeights(const string& filename)
+    : filename_(filename), value_size_(0), mapped_(NULL), mapped_size_(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_NE(fd, -1) << "File not found: " << filename;
+  struct stat st;
+  CHECK_EQ(fstat(fd, &st), 0) << "Cannot stat " << filename;
+  mapped_size_ = st.st_size;
+  CHECK_GE(mapped_size_, sizeof(MappedWeightsHeader))
+      << "Invalid weights file " << filename;
+  // Private and writable, so blobs can be modified, copying only the
+  // pages written to.
+  void* mapped = mmap(NULL, mapped_size_, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, fd, 0);
+  close(fd);
+  CHECK(mapped != MAP_FAILED) << "Cannot map " << filename;
+  mapped_ = reinterpret_cast<char*>(mapped);
+
+  MappedWeightsHeader header;
+  memcpy(&header, mapped_, sizeof(header));  // NOLINT(caffe/alt_fn)
+  CHECK_EQ(memcmp(header.magic, kMagic, sizeof(kMagic)), 0)
+      << "Invalid weights file " << filename;
+  CHECK_EQ(header.version, kVersion)
+      << "Unsupported weights file version in " << filename;
+  CHECK(header.value_size == sizeof(float) ||
+        header.value_size == sizeof(double))
+      << "Invalid value size in " << filename;
+  CHECK_GT(header.alignment, 0);
+  CHECK_LE(sizeof(header) + header.param_size, mapped_size_)
+      << "Truncated weights file " << filename;
+  value_size_ = header.value_size;
+  CHECK(param_.ParseFromArray(mapped_ + sizeof(header), header.param_size))
+      << "Invalid weights file " << filename;
+
+  size_t offset = align(sizeof(header) + header.param_size, header.alignment);
+  offsets_.resize(param_.layer_size());
+  for (int i = 0; i < param_.layer_size(); ++i) {
+    const LayerParameter& layer = param_.layer(i);
+    for (int j = 0; j < layer.blobs_size(); ++j) {
+      const size_t bytes = blob_count(layer.blobs(j)) * value_size_;
+      CHECK_LE(offset + bytes, mapped_size_)
+          << "Truncated weights file " << filename;
+      offsets_[i].push_back(offset);
+      offset = align(offset + bytes, header.alignment);
+    }
+  }
+}
+
+MappedWeights::~MappedWeights() {
+  if (mapped_) {
+    munmap(mapped_, mapped_size_);
+  }
+}
+
+void WriteMappedWeights(const NetParameter& param, const string& filename) {
+  // Keep layer names and blob shapes only
+  NetParameter shapes;
+  bool is_double = false;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& source = param.layer(i);
+    if (!source.blobs_size()) {
+      continue;
+    }
+    LayerParameter* layer = shapes.add_layer();
+    layer->set_name(source.name());
+    for (int j = 0; j < source.blobs_size(); ++j) {
+      BlobProto* blob = layer->add_blobs();
+      blob->CopyFrom(source.blobs(j));
+      blob->clear_data();
+      blob->clear_diff();
+      blob->clear_double_data();
+      blob->clear_double_diff();
+      is_double |= source.blobs(j).double_data_size() > 0;
+    }
+  }
+  string serialized;
+  CHECK(shapes.SerializeToString(&serialized));
+
+  MappedWeightsHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));  // NOLINT(caffe/alt_fn)
+  header.version = kVersion;
+  header.value_size = is_double ? sizeof(double) : sizeof(float);
+  header.alignment = kAlignment;
+  header.reserved = 0;
+  header.param_size = serialized.size();
+
+  std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary |
+                    std::ios::trunc);
+  CHECK(out.is_open()) << "Cannot create " << filename;
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(serialized.data(), serialized.size());
+  size_t offset = sizeof(header) + serialized.size();
+  const vector<char> padding(kAlignment, 0);
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& source = param.layer(i);
+    for (int j = 0; j < source.blobs_size(); ++j) {
+      const BlobProto& blob = source.blobs(j);
+      const size_t count = blob_count(blob);
+      CHECK_EQ(blob.sparse_index_size(), 0) << "Sparse weights for layer "
+          << source.name() << " cannot be mapped, load them in a net and "
+          << "save it to make them dense";
+      const size_t aligned = align(offset, kAlignment);
+      out.write(&padding[0], aligned - offset);
+      offset = aligned;
+      if (is_double) {
+        CHECK_EQ(count, blob.double_data_size())
+            << "Missing double data for layer " << source.name();
+        out.write(reinterpret_cast<const char*>(blob.double_data().data()),
+                  count * sizeof(double));
+        offset += count * sizeof(double);
+      } else {
+        CHECK_EQ(count, blob.data_size())
+            << "Missing data for layer " << source.name();
+        out.write(reinterpret_cast<const char*>(blob.data().data()),
+                  count * sizeof(float));
+        offset += count * sizeof(float);
+      }
+    }
+  }
+  CHECK(out.good()) << "Error writing " << filename;
+}
+
+}  // namespace caffe
@@ -1,11 +1,14 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <limits>
 
 #include "caffe/common.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/task_graph.hpp"
 
 namespace caffe {
 
@@ -31,6 +34,70 @@ void caffe_cpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
       ldb, beta, C, N);
 }
 
+namespace {
+
+// The arguments of caffe_cpu_gemm_batched, run in chunks of the batch
+template <typename Dtype>
+struct GemmBatch {
+  CBLAS_TRANSPOSE trans_a, trans_b;
+  int M, N, K;
+  Dtype alpha, beta;
+  const Dtype* A;
+  const Dtype* B;
+  Dtype* C;
+  int stride_a, stride_b, stride_c;
+  int batch, chunks;
+
+  // Runs the gemms of the given chunk of the batch
+  void operator()(int chunk) const {
+    const int end = batch * (chunk + 1) / chunks;
+    for (int i = batch * chunk / chunks; i < end; ++i) {
+      caffe_cpu_gemm<Dtype>(trans_a, trans_b, M, N, K, alpha,
+          A + i * stride_a, B + i * stride_b, beta, C + i * stride_c);
+    }
+  }
+};
+
+}  // namespace
+
+template <typename Dtype>
+void caffe_cpu_gemm_batched(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, const int stride_a, const Dtype* B,
+    const int stride_b, const Dtype beta, Dtype* C, const int stride_c,
+    const int batch) {
+  // Threads only pay off with enough work each, small gemms are run by
+  // BLAS on the calling thread. Gemms large enough for BLAS to thread
+  // themselves are run one at a time, several at once would run a BLAS
+  // thread per core from each pool thread.
+  const double kWorkPerThread = 1 << 20;
+  const double kBlasThreadedWork = 1 << 18;
+  const double work = static_cast<double>(M) * N * K;
+  const int chunks = work > kBlasThreadedWork ? 1 :
+      std::min(batch, static_cast<int>(work * batch / kWorkPerThread));
+  GemmBatch<Dtype> gemm = {TransA, TransB, M, N, K, alpha, beta,
+      A, B, C, stride_a, stride_b, stride_c, batch, 1};
+  if (chunks <= 1) {
+    gemm(0);
+    return;
+  }
+  // The shared pool runs the chunks, or this thread alone if it is busy
+  TaskGraph& pool = TaskGraph::Shared();
+  gemm.chunks = std::min(chunks, pool.threads());
+  pool.ParallelFor(gemm.chunks, gemm);
+}
+
+template void caffe_cpu_gemm_batched<float>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const float alpha, const float* A, const int stride_a, const float* B,
+    const int stride_b, const float beta, float* C, const int stride_c,
+    const int batch);
+template void caffe_cpu_gemm_batched<double>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const double alpha, const double* A, const int stride_a, const double* B,
+    const int stride_b, const double beta, double* C, const int stride_c,
+    const int batch);
+
 template <>
 void caffe_cpu_gemv<float>(const CBLAS_TRANSPOSE TransA, const int M,
     const int N, const float alpha, const float* A, const float* x,
@@ -394,4 +461,88 @@ void caffe_cpu_scale<double>(const int n, const double alpha, const double *x,
   cblas_dscal(n, alpha, y, 1);
 }
 
+static inline uint16_t float_to_half(float value) {
+  uint32_t f;
+  memcpy(&f, &value, sizeof(f));  // NOLINT(caffe/alt_fn)
+  const uint16_t sign = (f >> 16) & 0x8000;
+  const uint32_t abs = f & 0x7fffffff;
+  if (abs >= 0x7f800000) {
+    // Infinity or NaN, keeping NaNs quiet
+    return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+  }
+  if (abs >= 0x477ff000) {
+    // Rounds above 65504, the largest finite half
+    return sign | 0x7c00;
+  }
+  uint32_t half, rest, halfway;
+  if (abs >= 0x38800000) {
+    // Normal: rebias the exponent from 127 to 15, drop 13 mantissa bits
+    half = (abs - 0x38000000) >> 13;
+    rest = abs & 0x1fff;
+    halfway = 0x1000;
+  } else if (abs >= 0x33000000) {
+    // Subnormal half, value = half * 2^-24
+    const int shift = 126 - static_cast<int>(abs >> 23);
+    const uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+    half = mantissa >> shift;
+    rest = mantissa & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  } else {
+    return sign;
+  }
+  if (rest > halfway || (rest == halfway && (half & 1))) {
+    ++half;
+  }
+  return sign | half;
+}
+
+static inline float half_to_float(uint16_t half) {
+  const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+  const uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+  uint32_t f;
+  if (exponent == 0x1f) {
+    f = sign | 0x7f800000 | (mantissa << 13);
+  } else if (exponent) {
+    f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa) {
+    // Subnormal half, normalize it
+    int shift = 0;
+    while (!(mantissa & 0x400)) {
+      mantissa <<= 1;
+      ++shift;
+    }
+    f = sign | ((113 - shift) << 23) | ((mantissa & 0x3ff) << 13);
+  } else {
+    f = sign;
+  }
+  float value;
+  memcpy(&value, &f, sizeof(value));  // NOLINT(caffe/alt_fn)
+  return value;
+}
+
+template <typename Dtype>
+void caffe_cpu_to_half(const int n, const Dtype* x, uint16_t* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = float_to_half(static_cast<float>(x[i]));
+  }
+}
+
+template
+void caffe_cpu_to_half<float>(const int n, const float* x, uint16_t* y);
+template
+void caffe_cpu_to_half<double>(const int n, const double* x, uint16_t* y);
+
+template <typename Dtype>
+void caffe_cpu_from_half(const int n, const uint16_t* x, Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = half_to_float(x[i]);
+  }
+}
+
+template
+void caffe_cpu_from_half<float>(const int n, const uint16_t* x, float* y);
+template
+void caffe_cpu_from_half<double>(const int n, const uint16_t* x, double* y);
+
 }  // namespace caffe
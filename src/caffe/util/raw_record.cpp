@@ -0,0 +1,150 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/raw_record.hpp"
+
+namespace caffe {
+
+static const char kMagic[] = "\xca" "ffe";
+
+static void put_int32(int32_t value, char* bytes) {
+  const uint32_t bits = value;
+  for (int i = 0; i < 4; ++i) {
+    bytes[i] = static_cast<char>((bits >> (8 * i)) & 0xff);
+  }
+}
+
+static int32_t get_int32(const char* bytes) {
+  uint32_t bits = 0;
+  for (int i = 0; i < 4; ++i) {
+    bits |= static_cast<uint32_t>(static_cast<uint8_t>(bytes[i])) << (8 * i);
+  }
+  return static_cast<int32_t>(bits);
+}
+
+static int value_size(Datum::DataType type) {
+  switch (type) {
+  case Datum_DataType_UINT8:
+    return 1;
+  case Datum_DataType_FLOAT16:
+    return 2;
+  case Datum_DataType_FLOAT32:
+    return 4;
+  default:
+    LOG(FATAL) << "Unknown raw record type " << type;
+  }
+  return 0;
+}
+
+bool IsRawRecord(const string& value) {
+  return IsRawRecord(value.data(), value.size());
+}
+
+bool IsRawRecord(const char* value, size_t size) {
+  return size >= kRawRecordHeaderSize && memcmp(value, kMagic, 4) == 0;
+}
+
+void DatumToRawRecord(const Datum& datum, Datum::DataType type,
+    string* record) {
+  CHECK(!datum.encoded()) << "Decode datums before storing them raw";
+  const int count = datum.channels() * datum.height() * datum.width();
+  record->resize(kRawRecordHeaderSize + count * value_size(type));
+  char* bytes = &(*record)[0];
+  memcpy(bytes, kMagic, 4);  // NOLINT(caffe/alt_fn)
+  bytes[4] = static_cast<char>(type);
+  bytes[5] = bytes[6] = bytes[7] = 0;
+  put_int32(datum.label(), bytes + 8);
+  put_int32(datum.channels(), bytes + 12);
+  put_int32(datum.height(), bytes + 16);
+  put_int32(datum.width(), bytes + 20);
+  char* payload = bytes + kRawRecordHeaderSize;
+  const bool has_uint8 = datum.data().size() > 0 &&
+      datum.data_type() == Datum_DataType_UINT8;
+  if (type == Datum_DataType_UINT8 && has_uint8) {
+    CHECK_EQ(datum.data().size(), count);
+    memcpy(payload, datum.data().data(), count);  // NOLINT(caffe/alt_fn)
+    return;
+  }
+  vector<float> values(count);
+  DatumToFloat(datum, &values[0]);
+  vector<uint16_t> halfs(type == Datum_DataType_FLOAT16 ? count : 0);
+  if (type == Datum_DataType_FLOAT16) {
+    caffe_cpu_to_half<float>(count, &values[0], &halfs[0]);
+  }
+  for (int i = 0; i < count; ++i) {
+    if (type == Datum_DataType_FLOAT32) {
+      uint32_t bits;
+      memcpy(&bits, &values[i], 4);  // NOLINT(caffe/alt_fn)
+      put_int32(bits, payload + 4 * i);
+    } else if (type == Datum_DataType_FLOAT16) {
+      payload[2 * i] = static_cast<char>(halfs[i] & 0xff);
+      payload[2 * i + 1] = static_cast<char>(halfs[i] >> 8);
+    } else {
+      payload[i] = static_cast<char>(static_cast<uint8_t>(values[i]));
+    }
+  }
+}
+
+void RawRecordToDatum(const string& record, Datum* datum) {
+  RawRecordToDatum(record.data(), record.size(), datum);
+}
+
+void RawRecordToDatum(const char* bytes, size_t record_size, Datum* datum) {
+  CHECK(IsRawRecord(bytes, record_size)) << "Not a raw record";
+  const Datum::DataType type = static_cast<Datum::DataType>(bytes[4]);
+  CHECK(Datum::DataType_IsValid(type)) << "Unknown raw record type " << type;
+  datum->set_data_type(type);
+  datum->set_label(get_int32(bytes + 8));
+  datum->set_channels(get_int32(bytes + 12));
+  datum->set_height(get_int32(bytes + 16));
+  datum->set_width(get_int32(bytes + 20));
+  const int size = datum->channels() * datum->height() * datum->width() *
+      value_size(type);
+  CHECK_EQ(record_size, kRawRecordHeaderSize + size)
+      << "Truncated raw record";
+  datum->set_data(bytes + kRawRecordHeaderSize, size);
+  datum->clear_float_data();
+  datum->set_encoded(false);
+}
+
+void DatumToFloat(const Datum& datum, float* values) {
+  const int count = datum.channels() * datum.height() * datum.width();
+  const string& data = datum.data();
+  if (!data.size()) {
+    CHECK_EQ(datum.float_data_size(), count);
+    for (int i = 0; i < count; ++i) {
+      values[i] = datum.float_data(i);
+    }
+    return;
+  }
+  CHECK_EQ(data.size(), count * value_size(datum.data_type()));
+  const char* bytes = data.data();
+  switch (datum.data_type()) {
+  case Datum_DataType_UINT8:
+    for (int i = 0; i < count; ++i) {
+      values[i] = static_cast<uint8_t>(bytes[i]);
+    }
+    break;
+  case Datum_DataType_FLOAT16: {
+    vector<uint16_t> halfs(count);
+    for (int i = 0; i < count; ++i) {
+      halfs[i] = static_cast<uint8_t>(bytes[2 * i]) |
+          static_cast<uint8_t>(bytes[2 * i + 1]) << 8;
+    }
+    caffe_cpu_from_half<float>(count, &halfs[0], values);
+    break;
+  }
+  case Datum_DataType_FLOAT32:
+    for (int i = 0; i < count; ++i) {
+      const uint32_t bits = get_int32(bytes + 4 * i);
+      memcpy(&values[i], &bits, 4);  // NOLINT(caffe/alt_fn)
+    }
+    break;
+  default:
+    LOG(FATAL) << "Unknown datum data type " << datum.data_type();
+  }
+}
+
+}  // namespace caffe
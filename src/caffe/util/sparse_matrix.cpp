@@ -0,0 +1,129 @@
+#include <vector>
+
+#include "caffe/util/sparse_matrix.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void SparseMatrix<Dtype>::FromDense(int rows, int cols, const Dtype* dense) {
+  rows_ = rows;
+  cols_ = cols;
+  row_start_.resize(rows + 1);
+  columns_.clear();
+  values_.clear();
+  for (int r = 0; r < rows; ++r) {
+    row_start_[r] = values_.size();
+    const Dtype* row = dense + r * cols;
+    for (int c = 0; c < cols; ++c) {
+      if (row[c] != 0) {
+        columns_.push_back(c);
+        values_.push_back(row[c]);
+      }
+    }
+  }
+  row_start_[rows] = values_.size();
+}
+
+template <typename Dtype>
+void SparseMatrix<Dtype>::Gemm(int n, const Dtype* B, Dtype* C) const {
+  for (int r = 0; r < rows_; ++r) {
+    // Accumulate the rows of B picked by the non-zeros, contiguous in n
+    Dtype* c = C + r * n;
+    for (int j = 0; j < n; ++j) {
+      c[j] = 0;
+    }
+    for (int i = row_start_[r]; i < row_start_[r + 1]; ++i) {
+      const Dtype value = values_[i];
+      const Dtype* b = B + columns_[i] * n;
+      for (int j = 0; j < n; ++j) {
+        c[j] += value * b[j];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void SparseMatrix<Dtype>::GemmTransposed(int m, const Dtype* B,
+    Dtype* C) const {
+  for (int k = 0; k < m; ++k) {
+    const Dtype* b = B + k * cols_;
+    Dtype* c = C + k * rows_;
+    for (int r = 0; r < rows_; ++r) {
+      Dtype sum = 0;
+      for (int i = row_start_[r]; i < row_start_[r + 1]; ++i) {
+        sum += values_[i] * b[columns_[i]];
+      }
+      c[r] = sum;
+    }
+  }
+}
+
+template <typename Dtype>
+const SparseMatrix<Dtype>* SparseWeights<Dtype>::Get(
+    const Blob<Dtype>& weights, int rows, int cols) {
+  CHECK_EQ(weights.count(), rows * cols);
+  if (source_ != weights.data() || version_ != source_->version()) {
+    source_ = weights.data();
+    version_ = source_->version();
+    const Dtype* data = weights.cpu_data();
+    int nnz = 0;
+    for (int i = 0; i < weights.count(); ++i) {
+      nnz += data[i] != 0;
+    }
+    sparse_ = nnz <= sparse_max_density() * weights.count();
+    matrix_.FromDense(sparse_ ? rows : 0, cols, data);
+  }
+  return sparse_ ? &matrix_ : NULL;
+}
+
+static double sparse_max_density_ = 0.1;
+
+double sparse_max_density() {
+  return sparse_max_density_;
+}
+
+void set_sparse_max_density(double density) {
+  sparse_max_density_ = density;
+}
+
+template <typename Dtype>
+static void sparsify(const google::protobuf::RepeatedField<Dtype>& dense,
+    google::protobuf::RepeatedField<Dtype>* values,
+    google::protobuf::RepeatedField<uint32_t>* indices) {
+  int nnz = 0;
+  for (int i = 0; i < dense.size(); ++i) {
+    nnz += dense.Get(i) != 0;
+  }
+  // All zero blobs stay dense, sparse ones need at least one index
+  if (!nnz || nnz > dense.size() / 2) {
+    return;
+  }
+  google::protobuf::RepeatedField<Dtype> kept;
+  int last = 0;
+  for (int i = 0; i < dense.size(); ++i) {
+    if (dense.Get(i) != 0) {
+      kept.Add(dense.Get(i));
+      indices->Add(i - last);
+      last = i;
+    }
+  }
+  values->Swap(&kept);
+}
+
+void SparsifyBlobProto(BlobProto* proto) {
+  if (proto->sparse_index_size()) {
+    return;
+  }
+  if (proto->double_data_size()) {
+    sparsify(proto->double_data(), proto->mutable_double_data(),
+        proto->mutable_sparse_index());
+  } else {
+    sparsify(proto->data(), proto->mutable_data(),
+        proto->mutable_sparse_index());
+  }
+}
+
+INSTANTIATE_CLASS(SparseMatrix);
+INSTANTIATE_CLASS(SparseWeights);
+
+}  // namespace caffe
@@ -0,0 +1,135 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/util/task_graph.hpp"
+
+namespace caffe {
+
+class TaskGraph::Sync {
+ public:
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+};
+
+class TaskGraph::Worker : public InternalThread {
+ public:
+  explicit Worker(TaskGraph* graph) : graph_(graph) {}
+  virtual ~Worker() {
+    StopInternalThread();
+  }
+
+ protected:
+  virtual void InternalThreadEntry() {
+    try {
+      graph_->Work(false);
+    } catch (boost::thread_interrupted&) {
+      // Interrupted exception is expected on shutdown
+    }
+  }
+
+  TaskGraph* graph_;
+};
+
+TaskGraph::TaskGraph(int threads)
+    : sync_(new Sync()), dependents_(NULL), task_(NULL), remaining_(0),
+      busy_(false) {
+  for (int i = 1; i < threads; ++i) {
+    workers_.push_back(shared_ptr<Worker>(new Worker(this)));
+    workers_.back()->StartInternalThread();
+  }
+}
+
+TaskGraph::~TaskGraph() {
+  for (int i = 0; i < workers_.size(); ++i) {
+    workers_[i]->StopInternalThread();
+  }
+}
+
+void TaskGraph::Run(const vector<vector<int> >& dependents,
+    const vector<int>& num_deps, const boost::function<void(int)>& task) {
+  CHECK_EQ(dependents.size(), num_deps.size());
+  if (!dependents.size()) {
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    CHECK_EQ(remaining_, 0) << "TaskGraph::Run is not reentrant";
+    dependents_ = &dependents;
+    task_ = &task;
+    pending_ = num_deps;
+    remaining_ = num_deps.size();
+    for (int i = 0; i < num_deps.size(); ++i) {
+      if (!num_deps[i]) {
+        ready_.push_back(i);
+      }
+    }
+    CHECK(ready_.size()) << "Task graph has a cycle";
+  }
+  sync_->condition_.notify_all();
+  Work(true);
+}
+
+void TaskGraph::ParallelFor(int count,
+    const boost::function<void(int)>& task) {
+  bool busy;
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    busy = busy_ || workers_.empty();
+    if (!busy) {
+      busy_ = true;
+    }
+  }
+  if (busy) {
+    for (int i = 0; i < count; ++i) {
+      task(i);
+    }
+    return;
+  }
+  vector<vector<int> > dependents(count);
+  vector<int> num_deps(count, 0);
+  Run(dependents, num_deps, task);
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  busy_ = false;
+}
+
+static boost::mutex shared_mutex_;
+static shared_ptr<TaskGraph> shared_;
+
+TaskGraph& TaskGraph::Shared() {
+  boost::mutex::scoped_lock lock(shared_mutex_);
+  if (!shared_) {
+    shared_.reset(new TaskGraph(std::max(1u,
+        boost::thread::hardware_concurrency())));
+  }
+  return *shared_;
+}
+
+void TaskGraph::Work(bool caller) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (!caller || remaining_ > 0) {
+    if (ready_.empty()) {
+      sync_->condition_.wait(lock);
+      continue;
+    }
+    const int i = ready_.front();
+    ready_.pop_front();
+    lock.unlock();
+    (*task_)(i);
+    lock.lock();
+    const vector<int>& dependents = (*dependents_)[i];
+    for (int j = 0; j < dependents.size(); ++j) {
+      if (!--pending_[dependents[j]]) {
+        ready_.push_back(dependents[j]);
+      }
+    }
+    --remaining_;
+    // Wakes workers for new tasks, and the caller when all are done
+    if (dependents.size() || !remaining_) {
+      sync_->condition_.notify_all();
+    }
+  }
+}
+
+}  // namespace caffe
@@ -12,6 +12,8 @@ namespace bp = boost::python;
 
 #include "boost/algorithm/string.hpp"
 #include "caffe/caffe.hpp"
+#include "caffe/util/host_allocator.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 
 using caffe::Blob;
 using caffe::Caffe;
@@ -39,6 +41,24 @@ DEFINE_string(weights, "",
     "separated by ','. Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_string(outputs, "",
+    "Optional; for test, the output blobs to compute, separated by ','. "
+    "Layers they do not depend on are not run.");
+DEFINE_string(endpoints, "",
+    "Optional; train with several processes exchanging gradients over "
+    "sockets. Endpoints are given as tcp://host:port or unix:path, one per "
+    "process separated by ',', or a single one from which each process "
+    "derives its own (port + rank, or path.rank).");
+DEFINE_int32(processes, 0,
+    "Optional; the number of training processes when a single endpoint "
+    "is given. Defaults to the number of endpoints.");
+DEFINE_int32(rank, 0,
+    "Optional; the rank of this process in multi-process training.");
+DEFINE_int32(host_cache_mb, 0,
+    "Optional; the maximum host memory in MB kept by the allocator for "
+    "reuse after blobs are freed or reshaped, 0 to disable caching.");
+DEFINE_bool(huge_pages, false,
+    "Optional; back host allocations of 2MB and more with huge pages.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -93,6 +113,28 @@ static void get_gpus(vector<int>* gpus) {
   }
 }
 
+// Configure the host memory allocator from the flags
+static void set_host_memory() {
+  CHECK_GE(FLAGS_host_cache_mb, 0);
+  caffe::HostAllocator::Get().set_cache_limit(
+      static_cast<size_t>(FLAGS_host_cache_mb) << 20);
+  caffe::HostAllocator::Get().set_huge_pages(FLAGS_huge_pages);
+}
+
+static void LogHostMemory() {
+  const caffe::HostAllocator& allocator = caffe::HostAllocator::Get();
+  if (!allocator.cache_limit() && !allocator.huge_pages()) {
+    // Blocks are not counted
+    return;
+  }
+  const caffe::HostAllocator::Stats stats = allocator.stats();
+  LOG(INFO) << "Host memory: " << (stats.live_bytes >> 20) << " MB live, "
+      << (stats.peak_bytes >> 20) << " MB peak, "
+      << (stats.cached_bytes >> 20) << " MB cached, "
+      << stats.cache_hits << " of " << stats.allocations
+      << " allocations reused";
+}
+
 // caffe commands to call by
 //     caffe <command> <args>
 //
@@ -148,11 +190,33 @@ int train() {
       }
   }
 
+  vector<string> endpoints;
+  if (FLAGS_endpoints.size()) {
+    caffe::SocketRing::expand(FLAGS_endpoints, FLAGS_processes, &endpoints);
+    Caffe::set_process_count(endpoints.size());
+    Caffe::set_process_rank(FLAGS_rank);
+    LOG(INFO) << "Process " << FLAGS_rank << " of " << endpoints.size();
+    if (FLAGS_rank != 0) {
+      // Only the first process snapshots
+      solver_param.set_snapshot(0);
+      solver_param.set_snapshot_after_train(false);
+    }
+    if (solver_param.random_seed() >= 0) {
+      // Weights are broadcast from the first process, but data augmentation
+      // should differ between processes. Shuffled sources they split must
+      // be read in the same order by all.
+      Caffe::set_process_seed(solver_param.random_seed());
+      solver_param.set_random_seed(solver_param.random_seed() + FLAGS_rank);
+    }
+  }
+
   vector<int> gpus;
   get_gpus(&gpus);
   if (gpus.size() == 0) {
     Caffe::set_mode(Caffe::CPU);
   } else {
+    CHECK_EQ(endpoints.size(), 0)
+        << "Multi-process training is only supported in CPU mode.";
     ostringstream s;
     for (int i = 0; i < gpus.size(); ++i) {
       s << (i ? ", " : "") << gpus[i];
@@ -177,11 +241,15 @@ int train() {
   if (gpus.size() > 1) {
     caffe::P2PSync<float> sync(solver, NULL, solver->param());
     sync.run(gpus);
+  } else if (endpoints.size() > 1) {
+    caffe::SocketSync<float> sync(solver, endpoints, FLAGS_rank);
+    sync.run();
   } else {
     LOG(INFO) << "Starting Optimization";
     solver->Solve();
   }
   LOG(INFO) << "Optimization Done.";
+  LogHostMemory();
   return 0;
 }
 RegisterBrewFunction(train);
@@ -204,7 +272,17 @@ int test() {
     Caffe::set_mode(Caffe::CPU);
   }
   // Instantiate the caffe net.
-  Net<float> caffe_net(FLAGS_model, caffe::TEST);
+  caffe::NetParameter net_param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &net_param);
+  net_param.mutable_state()->set_phase(caffe::TEST);
+  if (FLAGS_outputs.size()) {
+    vector<string> outputs;
+    boost::split(outputs, FLAGS_outputs, boost::is_any_of(","));
+    for (int i = 0; i < outputs.size(); ++i) {
+      net_param.add_output(outputs[i]);
+    }
+  }
+  Net<float> caffe_net(net_param);
   caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
   LOG(INFO) << "Running for " << FLAGS_iterations << " iterations.";
 
@@ -340,6 +418,7 @@ int time() {
     FLAGS_iterations << " ms.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
   LOG(INFO) << "*** Benchmark ends ***";
+  LogHostMemory();
   return 0;
 }
 RegisterBrewFunction(time);
@@ -357,6 +436,7 @@ int main(int argc, char** argv) {
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  set_host_memory();
   if (argc == 2) {
 #ifdef WITH_PYTHON_LAYER
     try {
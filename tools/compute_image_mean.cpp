@@ -1,16 +1,22 @@
 #include <stdint.h>
 #include <algorithm>
+#include <cmath>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
 #include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
+#include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/raw_record.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 
@@ -19,7 +25,96 @@ using std::pair;
 using boost::scoped_ptr;
 
 DEFINE_string(backend, "lmdb",
-        "The backend {leveldb, lmdb} containing the images");
+        "The backend {leveldb, lmdb, packed} containing the images");
+DEFINE_int32(threads, 0,
+    "Optional: the number of threads decoding and summing images, 0 for one "
+    "per core.");
+DEFINE_double(sample, 1,
+    "Optional: the fraction of the images to use, evenly spread over the "
+    "database, for huge datasets.");
+
+// Per pixel sums, and per channel sums and sums of squares, of the images a
+// thread is given. Threads sum in double precision, and are added at the end.
+struct ImageSums {
+  ImageSums(int channels, int dim)
+      : dim(dim), count(0), sum(channels * dim), channel_sum(channels),
+        channel_sqsum(channels) {}
+
+  template <typename T>
+  void Add(const T* data) {
+    for (int c = 0; c < channel_sum.size(); ++c) {
+      const T* channel = data + c * dim;
+      double* channel_sums = &sum[c * dim];
+      double csum = 0;
+      double csqsum = 0;
+      for (int i = 0; i < dim; ++i) {
+        const double value = channel[i];
+        channel_sums[i] += value;
+        csum += value;
+        csqsum += value * value;
+      }
+      channel_sum[c] += csum;
+      channel_sqsum[c] += csqsum;
+    }
+    ++count;
+  }
+
+  void Add(const ImageSums& other) {
+    for (int i = 0; i < sum.size(); ++i) {
+      sum[i] += other.sum[i];
+    }
+    for (int c = 0; c < channel_sum.size(); ++c) {
+      channel_sum[c] += other.channel_sum[c];
+      channel_sqsum[c] += other.channel_sqsum[c];
+    }
+    count += other.count;
+  }
+
+  int dim;
+  int count;
+  std::vector<double> sum;
+  std::vector<double> channel_sum;
+  std::vector<double> channel_sqsum;
+};
+
+// Reads a Datum or a raw record
+static void parse_value(const string& value, Datum* datum) {
+  if (IsRawRecord(value)) {
+    RawRecordToDatum(value, datum);
+  } else {
+    datum->ParseFromString(value);
+  }
+}
+
+// Decodes and sums the datums the reader parses, until given NULL
+static void sum_images(BlockingQueue<Datum*>* free, BlockingQueue<Datum*>* full,
+    int data_size, ImageSums* sums) {
+  Datum* datum;
+  std::vector<float> raw_floats(data_size);
+  while ((datum = full->pop()) != NULL) {
+    DecodeDatumNative(datum);
+    const std::string& data = datum->data();
+    if (datum->data_type() != Datum_DataType_UINT8) {
+      // Floats of raw records
+      CHECK_EQ(datum->channels() * datum->height() * datum->width(),
+          data_size) << "Incorrect datum shape";
+      DatumToFloat(*datum, &raw_floats[0]);
+      sums->Add(&raw_floats[0]);
+      free->push(datum);
+      continue;
+    }
+    const int size_in_datum = std::max<int>(datum->data().size(),
+        datum->float_data_size());
+    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
+        size_in_datum;
+    if (data.size() != 0) {
+      sums->Add(reinterpret_cast<const uint8_t*>(data.data()));
+    } else {
+      sums->Add(datum->float_data().data());
+    }
+    free->push(datum);
+  }
+}
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -31,7 +126,7 @@ int main(int argc, char** argv) {
   gflags::SetUsageMessage("Compute the mean_image of a set of images given by"
         " a leveldb/lmdb\n"
         "Usage:\n"
-        "    compute_image_mean [FLAGS] INPUT_DB [OUTPUT_FILE]\n");
+        "    compute_image_mean [FLAGS] INPUT_DB[@SHARDS] [OUTPUT_FILE]\n");
 
   gflags::ParseCommandLineFlags(&argc, &argv, true);
 
@@ -39,16 +134,17 @@ int main(int argc, char** argv) {
     gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/compute_image_mean");
     return 1;
   }
+  CHECK(FLAGS_sample > 0 && FLAGS_sample <= 1) << "sample is a fraction";
 
+  const std::vector<std::string> shards = db::ShardNames(argv[1]);
   scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
-  db->Open(argv[1], db::READ);
+  db->Open(shards[0], db::READ);
   scoped_ptr<db::Cursor> cursor(db->NewCursor());
 
   BlobProto sum_blob;
-  int count = 0;
   // load first datum
   Datum datum;
-  datum.ParseFromString(cursor->value());
+  parse_value(cursor->value(), &datum);
 
   if (DecodeDatumNative(&datum)) {
     LOG(INFO) << "Decoding Datum";
@@ -59,61 +155,83 @@ int main(int argc, char** argv) {
   sum_blob.set_height(datum.height());
   sum_blob.set_width(datum.width());
   const int data_size = datum.channels() * datum.height() * datum.width();
-  int size_in_datum = std::max<int>(datum.data().size(),
-                                    datum.float_data_size());
-  for (int i = 0; i < size_in_datum; ++i) {
-    sum_blob.add_data(0.);
-  }
-  LOG(INFO) << "Starting Iteration";
-  while (cursor->valid()) {
-    Datum datum;
-    datum.ParseFromString(cursor->value());
-    DecodeDatumNative(&datum);
-
-    const std::string& data = datum.data();
-    size_in_datum = std::max<int>(datum.data().size(),
-        datum.float_data_size());
-    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-        size_in_datum;
-    if (data.size() != 0) {
-      CHECK_EQ(data.size(), size_in_datum);
-      for (int i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
+  const int channels = sum_blob.channels();
+  const int dim = sum_blob.height() * sum_blob.width();
+
+  // The reader parses datums, which threads decode and sum
+  const int threads = FLAGS_threads > 0 ? FLAGS_threads :
+      std::max<int>(1, boost::thread::hardware_concurrency());
+  BlockingQueue<Datum*> free;
+  BlockingQueue<Datum*> full;
+  for (int i = 0; i < threads * 4; ++i) {
+    free.push(new Datum());
+  }
+  std::vector<shared_ptr<ImageSums> > sums;
+  boost::thread_group summers;
+  for (int i = 0; i < threads; ++i) {
+    sums.push_back(shared_ptr<ImageSums>(new ImageSums(channels, dim)));
+    summers.create_thread(boost::bind(&sum_images, &free, &full, data_size,
+        sums.back().get()));
+  }
+
+  LOG(INFO) << "Starting Iteration with " << threads << " threads";
+  int64_t read = 0;
+  int count = 0;
+  for (int s = 0; s < shards.size(); ++s) {
+    if (s > 0) {
+      db->Close();
+      db->Open(shards[s], db::READ);
+      cursor.reset(db->NewCursor());
+    }
+    for (; cursor->valid(); cursor->Next(), ++read) {
+      // Keeps images where the sampled count steps up
+      if (static_cast<int64_t>((read + 1) * FLAGS_sample) ==
+          static_cast<int64_t>(read * FLAGS_sample)) {
+        continue;
       }
-    } else {
-      CHECK_EQ(datum.float_data_size(), size_in_datum);
-      for (int i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) +
-            static_cast<float>(datum.float_data(i)));
+      Datum* datum = free.pop();
+      parse_value(cursor->value(), datum);
+      full.push(datum);
+      ++count;
+      if (count % 10000 == 0) {
+        LOG(INFO) << "Processed " << count << " files.";
       }
     }
-    ++count;
-    if (count % 10000 == 0) {
-      LOG(INFO) << "Processed " << count << " files.";
-    }
-    cursor->Next();
   }
+  for (int i = 0; i < threads; ++i) {
+    full.push(NULL);
+  }
+  summers.join_all();
+  Datum* unused;
+  while (free.try_pop(&unused)) {
+    delete unused;
+  }
+  for (int i = 1; i < threads; ++i) {
+    sums[0]->Add(*sums[i]);
+  }
+  const ImageSums& total = *sums[0];
+  CHECK_EQ(total.count, count);
+  CHECK_GT(count, 0) << "No images sampled";
 
   if (count % 10000 != 0) {
     LOG(INFO) << "Processed " << count << " files.";
   }
-  for (int i = 0; i < sum_blob.data_size(); ++i) {
-    sum_blob.set_data(i, sum_blob.data(i) / count);
+  for (int i = 0; i < total.sum.size(); ++i) {
+    sum_blob.add_data(total.sum[i] / count);
   }
   // Write to disk
   if (argc == 3) {
     LOG(INFO) << "Write to " << argv[2];
     WriteProtoToBinaryFile(sum_blob, argv[2]);
   }
-  const int channels = sum_blob.channels();
-  const int dim = sum_blob.height() * sum_blob.width();
-  std::vector<float> mean_values(channels, 0.0);
   LOG(INFO) << "Number of channels: " << channels;
   for (int c = 0; c < channels; ++c) {
-    for (int i = 0; i < dim; ++i) {
-      mean_values[c] += sum_blob.data(dim * c + i);
-    }
-    LOG(INFO) << "mean_value channel [" << c << "]:" << mean_values[c] / dim;
+    const double values = static_cast<double>(count) * dim;
+    const double mean = total.channel_sum[c] / values;
+    const double variance = total.channel_sqsum[c] / values - mean * mean;
+    LOG(INFO) << "mean_value channel [" << c << "]:" << mean;
+    LOG(INFO) << "std_value channel [" << c << "]:"
+        << std::sqrt(std::max(variance, 0.));
   }
   return 0;
 }
@@ -7,6 +7,8 @@
 // should be a list of files as well as their labels, in the format as
 //   subfolder1/file1.JPEG 7
 //   ....
+// A DB_NAME of the form name@N stores the images to N databases in turn,
+// which data layers read back in order from the same name@N source.
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
@@ -14,25 +16,26 @@
 #include <utility>
 #include <vector>
 
-#include "boost/scoped_ptr.hpp"
+#include "boost/bind.hpp"
+#include "boost/thread.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/raw_record.hpp"
 #include "caffe/util/rng.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 using std::pair;
-using boost::scoped_ptr;
 
 DEFINE_bool(gray, false,
     "When this option is on, treat images as grayscale ones");
 DEFINE_bool(shuffle, false,
     "Randomly shuffle the order of images and their labels");
 DEFINE_string(backend, "lmdb",
-        "The backend {lmdb, leveldb} for storing the result");
+        "The backend {lmdb, leveldb, packed} for storing the result");
 DEFINE_int32(resize_width, 0, "Width images are resized to");
 DEFINE_int32(resize_height, 0, "Height images are resized to");
 DEFINE_bool(check_size, false,
@@ -41,6 +44,88 @@ DEFINE_bool(encoded, false,
     "When this option is on, the encoded image will be save in datum");
 DEFINE_string(encode_type, "",
     "Optional: What type should we encode the image as ('png','jpg',...).");
+DEFINE_bool(raw, false,
+    "Optional: store raw records of uint8 pixels instead of Datums, which "
+    "are read without parsing, see util/raw_record.hpp.");
+DEFINE_int32(threads, 0,
+    "Optional: the number of threads reading and converting images, "
+    "0 for one per core. Images are still stored in list order.");
+
+// Images are converted by several threads into a ring of slots, from which
+// the main thread stores them in order. Threads do not run further ahead of
+// the stored images than the ring size.
+struct Converted {
+  bool ready;
+  bool status;
+  int data_size;
+  string value;
+};
+
+struct Conversion {
+  std::vector<std::pair<std::string, int> > lines;
+  std::string root_folder;
+  int resize_height;
+  int resize_width;
+  bool is_color;
+  bool encoded;
+  string encode_type;
+  bool raw;
+
+  boost::mutex mutex;
+  boost::condition_variable converted;
+  boost::condition_variable stored;
+  int next_line;
+  int stored_lines;
+  std::vector<Converted> slots;
+};
+
+static void convert_images(Conversion* c) {
+  Datum datum;
+  for (;;) {
+    int line_id;
+    {
+      boost::mutex::scoped_lock lock(c->mutex);
+      const int num_lines = c->lines.size();
+      const int num_slots = c->slots.size();
+      while (c->next_line < num_lines &&
+          c->next_line >= c->stored_lines + num_slots) {
+        c->stored.wait(lock);
+      }
+      if (c->next_line == num_lines) {
+        return;
+      }
+      line_id = c->next_line++;
+    }
+    std::string enc = c->encode_type;
+    if (c->encoded && !enc.size()) {
+      // Guess the encoding type from the file name
+      string fn = c->lines[line_id].first;
+      size_t p = fn.rfind('.');
+      if ( p == fn.npos )
+        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
+      enc = fn.substr(p);
+      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+    }
+    const bool status = ReadImageToDatum(c->root_folder +
+        c->lines[line_id].first, c->lines[line_id].second, c->resize_height,
+        c->resize_width, c->is_color, enc, &datum);
+    string out;
+    if (status && c->raw) {
+      DatumToRawRecord(datum, Datum_DataType_UINT8, &out);
+    } else if (status) {
+      CHECK(datum.SerializeToString(&out));
+    }
+    {
+      boost::mutex::scoped_lock lock(c->mutex);
+      Converted& slot = c->slots[line_id % c->slots.size()];
+      slot.status = status;
+      slot.data_size = datum.data().size();
+      slot.value.swap(out);
+      slot.ready = true;
+    }
+    c->converted.notify_all();
+  }
+}
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -52,7 +137,7 @@ int main(int argc, char** argv) {
   gflags::SetUsageMessage("Convert a set of images to the leveldb/lmdb\n"
         "format used as input for Caffe.\n"
         "Usage:\n"
-        "    convert_imageset [FLAGS] ROOTFOLDER/ LISTFILE DB_NAME\n"
+        "    convert_imageset [FLAGS] ROOTFOLDER/ LISTFILE DB_NAME[@SHARDS]\n"
         "The ImageNet dataset for the training demo is at\n"
         "    http://www.image-net.org/download-images\n");
   gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -62,90 +147,113 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  const bool is_color = !FLAGS_gray;
   const bool check_size = FLAGS_check_size;
-  const bool encoded = FLAGS_encoded;
-  const string encode_type = FLAGS_encode_type;
 
+  Conversion c;
   std::ifstream infile(argv[2]);
-  std::vector<std::pair<std::string, int> > lines;
   std::string filename;
   int label;
   while (infile >> filename >> label) {
-    lines.push_back(std::make_pair(filename, label));
+    c.lines.push_back(std::make_pair(filename, label));
   }
   if (FLAGS_shuffle) {
     // randomly shuffle data
     LOG(INFO) << "Shuffling data";
-    shuffle(lines.begin(), lines.end());
+    shuffle(c.lines.begin(), c.lines.end());
   }
-  LOG(INFO) << "A total of " << lines.size() << " images.";
+  LOG(INFO) << "A total of " << c.lines.size() << " images.";
 
-  if (encode_type.size() && !encoded)
+  c.encoded = FLAGS_encoded;
+  c.encode_type = FLAGS_encode_type;
+  if (c.encode_type.size() && !c.encoded)
     LOG(INFO) << "encode_type specified, assuming encoded=true.";
+  c.raw = FLAGS_raw;
+  CHECK(!c.raw || !(c.encoded || c.encode_type.size()))
+      << "Raw records hold decoded images";
 
-  int resize_height = std::max<int>(0, FLAGS_resize_height);
-  int resize_width = std::max<int>(0, FLAGS_resize_width);
+  c.resize_height = std::max<int>(0, FLAGS_resize_height);
+  c.resize_width = std::max<int>(0, FLAGS_resize_width);
+  c.is_color = !FLAGS_gray;
+  c.root_folder = argv[1];
 
-  // Create new DB
-  scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
-  db->Open(argv[3], db::NEW);
-  scoped_ptr<db::Transaction> txn(db->NewTransaction());
+  // Create new DBs, one per shard
+  const std::vector<string> shards = db::ShardNames(argv[3]);
+  std::vector<shared_ptr<db::DB> > dbs;
+  std::vector<shared_ptr<db::Transaction> > txns;
+  for (int i = 0; i < shards.size(); ++i) {
+    dbs.push_back(shared_ptr<db::DB>(db::GetDB(FLAGS_backend)));
+    dbs[i]->Open(shards[i], db::NEW);
+    txns.push_back(shared_ptr<db::Transaction>(dbs[i]->NewTransaction()));
+  }
+
+  // Start converting
+  const int threads = FLAGS_threads > 0 ? FLAGS_threads :
+      std::max<int>(1, boost::thread::hardware_concurrency());
+  LOG(INFO) << "Converting with " << threads << " threads";
+  const Converted empty = {false, false, 0, ""};
+  c.slots.resize(threads * 16, empty);
+  c.next_line = 0;
+  c.stored_lines = 0;
+  boost::thread_group converters;
+  for (int i = 0; i < threads; ++i) {
+    converters.create_thread(boost::bind(&convert_images, &c));
+  }
 
   // Storing to db
-  std::string root_folder(argv[1]);
-  Datum datum;
   int count = 0;
   const int kMaxKeyLength = 256;
   char key_cstr[kMaxKeyLength];
   int data_size = 0;
   bool data_size_initialized = false;
+  string out;
 
-  for (int line_id = 0; line_id < lines.size(); ++line_id) {
+  for (int line_id = 0; line_id < c.lines.size(); ++line_id) {
     bool status;
-    std::string enc = encode_type;
-    if (encoded && !enc.size()) {
-      // Guess the encoding type from the file name
-      string fn = lines[line_id].first;
-      size_t p = fn.rfind('.');
-      if ( p == fn.npos )
-        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
-      enc = fn.substr(p);
-      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+    int size;
+    {
+      boost::mutex::scoped_lock lock(c.mutex);
+      Converted& slot = c.slots[line_id % c.slots.size()];
+      while (!slot.ready) {
+        c.converted.wait(lock);
+      }
+      status = slot.status;
+      size = slot.data_size;
+      out.swap(slot.value);
+      slot.ready = false;
+      ++c.stored_lines;
     }
-    status = ReadImageToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color,
-        enc, &datum);
+    c.stored.notify_all();
     if (status == false) continue;
     if (check_size) {
       if (!data_size_initialized) {
-        data_size = datum.channels() * datum.height() * datum.width();
+        data_size = size;
         data_size_initialized = true;
       } else {
-        const std::string& data = datum.data();
-        CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
-            << data.size();
+        CHECK_EQ(size, data_size) << "Incorrect data field size " << size;
       }
     }
     // sequential
     int length = snprintf(key_cstr, kMaxKeyLength, "%08d_%s", line_id,
-        lines[line_id].first.c_str());
+        c.lines[line_id].first.c_str());
 
     // Put in db
-    string out;
-    CHECK(datum.SerializeToString(&out));
-    txn->Put(string(key_cstr, length), out);
+    txns[count % shards.size()]->Put(string(key_cstr, length), out);
 
     if (++count % 1000 == 0) {
       // Commit db
-      txn->Commit();
-      txn.reset(db->NewTransaction());
+      for (int i = 0; i < shards.size(); ++i) {
+        txns[i]->Commit();
+        txns[i].reset(dbs[i]->NewTransaction());
+      }
       LOG(ERROR) << "Processed " << count << " files.";
     }
   }
+  converters.join_all();
   // write the last batch
   if (count % 1000 != 0) {
-    txn->Commit();
+    for (int i = 0; i < shards.size(); ++i) {
+      txns[i]->Commit();
+    }
     LOG(ERROR) << "Processed " << count << " files.";
   }
   return 0;
@@ -0,0 +1,29 @@
+// This program converts trained weights from a binary NetParameter, such as a
+// .caffemodel, to a file that nets can memory-map instead of parsing, see
+// MappedWeights. Net::CopyTrainedLayersFrom maps files ending in ".mmap".
+// Usage:
+//    convert_model_mmap model.caffemodel model.mmap
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/mapped_weights.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: "
+        << "convert_model_mmap model.caffemodel model.mmap";
+    return 1;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromBinaryFileOrDie(string(argv[1]), &net_param);
+  WriteMappedWeights(net_param, argv[2]);
+
+  LOG(ERROR) << "Wrote memory-mappable weights to " << argv[2];
+  return 0;
+}
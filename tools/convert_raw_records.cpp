@@ -0,0 +1,88 @@
+// This program converts a database of Datums to raw records, which data
+// layers read without parsing them, see util/raw_record.hpp.
+// Usage:
+//    convert_raw_records [FLAGS] INPUT_DB OUTPUT_DB
+//
+// Encoded images are decoded. Values are stored as uint8 if the datums hold
+// bytes and as float32 if they hold float_data, unless -type is given.
+
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+
+#include "boost/scoped_ptr.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/raw_record.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using boost::scoped_ptr;
+
+DEFINE_string(backend, "lmdb",
+    "The backend {lmdb, leveldb, packed} of the input and output databases");
+DEFINE_string(type, "",
+    "Optional: the type of the stored values {uint8, float16, float32}");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Convert a leveldb/lmdb of Datums to raw records\n"
+        "Usage:\n"
+        "    convert_raw_records [FLAGS] INPUT_DB OUTPUT_DB\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 3) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/convert_raw_records");
+    return 1;
+  }
+  Datum::DataType type = Datum_DataType_UINT8;
+  if (FLAGS_type.size()) {
+    string name = FLAGS_type;
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    CHECK(Datum::DataType_Parse(name, &type)) << "Unknown type " << FLAGS_type;
+  }
+
+  scoped_ptr<db::DB> input(db::GetDB(FLAGS_backend));
+  input->Open(argv[1], db::READ);
+  scoped_ptr<db::Cursor> cursor(input->NewCursor());
+  scoped_ptr<db::DB> output(db::GetDB(FLAGS_backend));
+  output->Open(argv[2], db::NEW);
+  scoped_ptr<db::Transaction> txn(output->NewTransaction());
+
+  Datum datum;
+  string record;
+  int count = 0;
+  int64_t datum_bytes = 0;
+  int64_t record_bytes = 0;
+  for (; cursor->valid(); cursor->Next()) {
+    const string value = cursor->value();
+    datum.ParseFromString(value);
+    DecodeDatumNative(&datum);
+    const Datum::DataType record_type = FLAGS_type.size() ? type :
+        datum.data().size() ? Datum_DataType_UINT8 : Datum_DataType_FLOAT32;
+    DatumToRawRecord(datum, record_type, &record);
+    txn->Put(cursor->key(), record);
+    datum_bytes += value.size();
+    record_bytes += record.size();
+    if (++count % 1000 == 0) {
+      txn->Commit();
+      txn.reset(output->NewTransaction());
+      LOG(INFO) << "Processed " << count << " records.";
+    }
+  }
+  if (count % 1000 != 0) {
+    txn->Commit();
+    LOG(INFO) << "Processed " << count << " records.";
+  }
+  LOG(INFO) << "Wrote " << record_bytes << " bytes of raw records from "
+      << datum_bytes << " bytes of Datums.";
+  return 0;
+}
@@ -1,8 +1,12 @@
+#include <stdint.h>
 #include <stdio.h>  // for snprintf
+#include <algorithm>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/thread.hpp"
 #include "google/protobuf/text_format.h"
 
 #include "caffe/blob.hpp"
@@ -11,6 +15,8 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 #include "caffe/vision_layers.hpp"
 
 using caffe::Blob;
@@ -21,6 +27,239 @@ using boost::shared_ptr;
 using std::string;
 namespace db = caffe::db;
 
+// The features of one mini batch, for each extracted blob
+struct Features {
+  std::vector<std::vector<float> > data;
+  std::vector<std::vector<int> > shapes;
+};
+
+// Writes the features of one blob
+class FeatureWriter {
+ public:
+  virtual ~FeatureWriter() {}
+  // Appends shape[0] feature vectors of the remaining shape
+  virtual void Write(const float* features, const std::vector<int>& shape) = 0;
+  virtual void Close() = 0;
+};
+
+// As Datums with float_data, to a database or a sharded one (name@N)
+class DBFeatureWriter : public FeatureWriter {
+ public:
+  DBFeatureWriter(const string& name, const string& db_type) : count_(0) {
+    const std::vector<string> shards = db::ShardNames(name);
+    for (size_t i = 0; i < shards.size(); ++i) {
+      dbs_.push_back(shared_ptr<db::DB>(db::GetDB(db_type)));
+      dbs_[i]->Open(shards[i], db::NEW);
+      txns_.push_back(shared_ptr<db::Transaction>(dbs_[i]->NewTransaction()));
+    }
+  }
+
+  virtual void Write(const float* features, const std::vector<int>& shape) {
+    // Legacy 4D shape, as Blob::LegacyShape
+    CHECK_LE(shape.size(), 4)
+        << "Datums cannot hold features of more than 4 axes";
+    std::vector<int> legacy(4, 1);
+    std::copy(shape.begin(), shape.end(), legacy.begin());
+    datum_.set_channels(legacy[1]);
+    datum_.set_height(legacy[2]);
+    datum_.set_width(legacy[3]);
+    const int dim = legacy[1] * legacy[2] * legacy[3];
+    datum_.mutable_float_data()->Resize(dim, 0);
+    const int kMaxKeyStrLength = 100;
+    char key_str[kMaxKeyStrLength];
+    for (int n = 0; n < shape[0]; ++n) {
+      std::copy(features + n * dim, features + (n + 1) * dim,
+          datum_.mutable_float_data()->mutable_data());
+      int length = snprintf(key_str, kMaxKeyStrLength, "%010d", count_);
+      string out;
+      CHECK(datum_.SerializeToString(&out));
+      txns_[count_ % txns_.size()]->Put(std::string(key_str, length), out);
+      if (++count_ % 1000 == 0) {
+        for (size_t i = 0; i < txns_.size(); ++i) {
+          txns_[i]->Commit();
+          txns_[i].reset(dbs_[i]->NewTransaction());
+        }
+      }
+    }
+  }
+
+  virtual void Close() {
+    for (size_t i = 0; i < txns_.size(); ++i) {
+      if (count_ % 1000 != 0) {
+        txns_[i]->Commit();
+      }
+      dbs_[i]->Close();
+    }
+  }
+
+ protected:
+  std::vector<shared_ptr<db::DB> > dbs_;
+  std::vector<shared_ptr<db::Transaction> > txns_;
+  Datum datum_;
+  int count_;
+};
+
+// As a float32 or float16 .npy array of all the features, which numpy can
+// memory map. The header is rewritten with the final shape on Close().
+class NpyFeatureWriter : public FeatureWriter {
+ public:
+  NpyFeatureWriter(const string& name, bool half)
+      : half_(half), count_(0) {
+    file_ = fopen(name.c_str(), "wb");
+    CHECK(file_) << "Cannot create " << name;
+    WriteHeader();
+  }
+
+  virtual void Write(const float* features, const std::vector<int>& shape) {
+    if (!count_) {
+      shape_ = shape;
+    }
+    CHECK(shape.size() == shape_.size() &&
+          std::equal(shape.begin() + 1, shape.end(), shape_.begin() + 1))
+        << "Features of different shapes";
+    int size = 1;
+    for (size_t i = 0; i < shape.size(); ++i) {
+      size *= shape[i];
+    }
+    if (half_) {
+      halfs_.resize(size);
+      caffe::caffe_cpu_to_half<float>(size, features, &halfs_[0]);
+      CHECK_EQ(fwrite(&halfs_[0], sizeof(uint16_t), size, file_),
+          size_t(size));
+    } else {
+      CHECK_EQ(fwrite(features, sizeof(float), size, file_), size_t(size));
+    }
+    count_ += shape[0];
+  }
+
+  virtual void Close() {
+    CHECK_EQ(fseek(file_, 0, SEEK_SET), 0);
+    WriteHeader();
+    CHECK_EQ(fclose(file_), 0);
+  }
+
+ protected:
+  // Format version 1.0, padded to kHeaderSize bytes
+  void WriteHeader() {
+    std::ostringstream dict;
+    dict << "{'descr': '<" << (half_ ? "f2" : "f4")
+        << "', 'fortran_order': False, 'shape': (" << count_ << ",";
+    for (size_t i = 1; i < shape_.size(); ++i) {
+      dict << " " << shape_[i] << ",";
+    }
+    dict << "), }";
+    const int kHeaderSize = 128;
+    string header("\x93NUMPY\x01\x00", 8);
+    const int length = kHeaderSize - 10;
+    header += static_cast<char>(length & 0xff);
+    header += static_cast<char>(length >> 8);
+    string text = dict.str();
+    CHECK_LT(text.size(), size_t(length))
+        << "Feature shape too long for the header";
+    text.resize(length - 1, ' ');
+    header += text + "\n";
+    CHECK_EQ(fwrite(header.data(), 1, header.size(), file_), header.size());
+  }
+
+  FILE* file_;
+  bool half_;
+  int count_;
+  std::vector<int> shape_;
+  std::vector<uint16_t> halfs_;
+};
+
+// Writes the features of each mini batch while the net computes the next
+// one. The writers are created on the writing thread, as LMDB transactions
+// must stay on the thread that began them.
+class AsyncFeatureWriter {
+ public:
+  AsyncFeatureWriter(const std::vector<string>& names,
+      const std::vector<string>& blob_names, const string& db_type)
+      : names_(names), blob_names_(blob_names), db_type_(db_type),
+        features_(NULL), done_(false) {
+    thread_ = boost::thread(&AsyncFeatureWriter::Run, this);
+  }
+
+  // Queues features, once those queued before are written
+  void Write(const Features* features) {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (features_) {
+      condition_.wait(lock);
+    }
+    features_ = features;
+    condition_.notify_all();
+  }
+
+  // Writes the queued features and closes the writers
+  void Close() {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (features_) {
+        condition_.wait(lock);
+      }
+      done_ = true;
+      condition_.notify_all();
+    }
+    thread_.join();
+  }
+
+ protected:
+  void Run() {
+    std::vector<shared_ptr<FeatureWriter> > writers;
+    for (size_t i = 0; i < names_.size(); ++i) {
+      LOG(INFO)<< "Opening dataset " << names_[i];
+      if (db_type_ == "npy" || db_type_ == "npy16") {
+        writers.push_back(shared_ptr<FeatureWriter>(
+            new NpyFeatureWriter(names_[i], db_type_ == "npy16")));
+      } else {
+        writers.push_back(shared_ptr<FeatureWriter>(
+            new DBFeatureWriter(names_[i], db_type_)));
+      }
+    }
+    std::vector<int> counts(names_.size(), 0);
+    for (;;) {
+      const Features* features;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (!features_ && !done_) {
+          condition_.wait(lock);
+        }
+        if (!features_) {
+          break;
+        }
+        features = features_;
+      }
+      for (size_t i = 0; i < writers.size(); ++i) {
+        writers[i]->Write(&features->data[i][0], features->shapes[i]);
+        const int count = counts[i] + features->shapes[i][0];
+        if (count / 1000 > counts[i] / 1000) {
+          LOG(ERROR)<< "Extracted features of " << count <<
+              " query images for feature blob " << blob_names_[i];
+        }
+        counts[i] = count;
+      }
+      boost::mutex::scoped_lock lock(mutex_);
+      features_ = NULL;
+      condition_.notify_all();
+    }
+    for (size_t i = 0; i < writers.size(); ++i) {
+      writers[i]->Close();
+      LOG(ERROR)<< "Extracted features of " << counts[i] <<
+          " query images for feature blob " << blob_names_[i];
+    }
+  }
+
+  const std::vector<string> names_;
+  const std::vector<string> blob_names_;
+  const string db_type_;
+  boost::thread thread_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+  // Features queued or being written
+  const Features* features_;
+  bool done_;
+};
+
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv);
 
@@ -41,8 +280,11 @@ int feature_extraction_pipeline(int argc, char** argv) {
     "  feature_extraction_proto_file  extract_feature_blob_name1[,name2,...]"
     "  save_feature_dataset_name1[,name2,...]  num_mini_batches  db_type"
     "  [CPU/GPU] [DEVICE_ID=0]\n"
+    "db_type is leveldb or lmdb to store Datums, or npy or npy16 to store"
+    " float32 or float16 arrays of all the features.\n"
     "Note: you can extract multiple features in one pass by specifying"
     " multiple feature blob names and dataset names seperated by ','."
+    " A dataset name@N is written to N shards."
     " The names cannot contain white space characters and the number of blobs"
     " and datasets must be equal.";
     return 1;
@@ -96,14 +338,20 @@ int feature_extraction_pipeline(int argc, char** argv) {
    }
    */
   std::string feature_extraction_proto(argv[++arg_pos]);
-  shared_ptr<Net<Dtype> > feature_extraction_net(
-      new Net<Dtype>(feature_extraction_proto, caffe::TEST));
-  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
-
   std::string extract_feature_blob_names(argv[++arg_pos]);
   std::vector<std::string> blob_names;
   boost::split(blob_names, extract_feature_blob_names, boost::is_any_of(","));
 
+  // Only run the layers the features depend on
+  caffe::NetParameter net_param;
+  caffe::ReadNetParamsFromTextFileOrDie(feature_extraction_proto, &net_param);
+  net_param.mutable_state()->set_phase(caffe::TEST);
+  for (size_t i = 0; i < blob_names.size(); ++i) {
+    net_param.add_output(blob_names[i]);
+  }
+  shared_ptr<Net<Dtype> > feature_extraction_net(new Net<Dtype>(net_param));
+  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
+
   std::string save_feature_dataset_names(argv[++arg_pos]);
   std::vector<std::string> dataset_names;
   boost::split(dataset_names, save_feature_dataset_names,
@@ -119,69 +367,30 @@ int feature_extraction_pipeline(int argc, char** argv) {
   }
 
   int num_mini_batches = atoi(argv[++arg_pos]);
-
-  std::vector<shared_ptr<db::DB> > feature_dbs;
-  std::vector<shared_ptr<db::Transaction> > txns;
   const char* db_type = argv[++arg_pos];
-  for (size_t i = 0; i < num_features; ++i) {
-    LOG(INFO)<< "Opening dataset " << dataset_names[i];
-    shared_ptr<db::DB> db(db::GetDB(db_type));
-    db->Open(dataset_names.at(i), db::NEW);
-    feature_dbs.push_back(db);
-    shared_ptr<db::Transaction> txn(db->NewTransaction());
-    txns.push_back(txn);
-  }
+  AsyncFeatureWriter writer(dataset_names, blob_names, db_type);
 
   LOG(ERROR)<< "Extacting Features";
 
-  Datum datum;
-  const int kMaxKeyStrLength = 100;
-  char key_str[kMaxKeyStrLength];
+  // Features are copied to one buffer while the other one is written
+  Features buffers[2];
   std::vector<Blob<float>*> input_vec;
-  std::vector<int> image_indices(num_features, 0);
   for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index) {
     feature_extraction_net->Forward(input_vec);
+    Features& features = buffers[batch_index % 2];
+    features.data.resize(num_features);
+    features.shapes.resize(num_features);
     for (int i = 0; i < num_features; ++i) {
       const shared_ptr<Blob<Dtype> > feature_blob = feature_extraction_net
           ->blob_by_name(blob_names[i]);
-      int batch_size = feature_blob->num();
-      int dim_features = feature_blob->count() / batch_size;
-      const Dtype* feature_blob_data;
-      for (int n = 0; n < batch_size; ++n) {
-        datum.set_height(feature_blob->height());
-        datum.set_width(feature_blob->width());
-        datum.set_channels(feature_blob->channels());
-        datum.clear_data();
-        datum.clear_float_data();
-        feature_blob_data = feature_blob->cpu_data() +
-            feature_blob->offset(n);
-        for (int d = 0; d < dim_features; ++d) {
-          datum.add_float_data(feature_blob_data[d]);
-        }
-        int length = snprintf(key_str, kMaxKeyStrLength, "%010d",
-            image_indices[i]);
-        string out;
-        CHECK(datum.SerializeToString(&out));
-        txns.at(i)->Put(std::string(key_str, length), out);
-        ++image_indices[i];
-        if (image_indices[i] % 1000 == 0) {
-          txns.at(i)->Commit();
-          txns.at(i).reset(feature_dbs.at(i)->NewTransaction());
-          LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-              " query images for feature blob " << blob_names[i];
-        }
-      }  // for (int n = 0; n < batch_size; ++n)
-    }  // for (int i = 0; i < num_features; ++i)
-  }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
-  // write the last batch
-  for (int i = 0; i < num_features; ++i) {
-    if (image_indices[i] % 1000 != 0) {
-      txns.at(i)->Commit();
+      const Dtype* feature_blob_data = feature_blob->cpu_data();
+      features.data[i].assign(feature_blob_data,
+          feature_blob_data + feature_blob->count());
+      features.shapes[i] = feature_blob->shape();
     }
-    LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-        " query images for feature blob " << blob_names[i];
-    feature_dbs.at(i)->Close();
-  }
+    writer.Write(&features);
+  }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
+  writer.Close();
 
   LOG(ERROR)<< "Successfully extracted the features!";
   return 0;
@@ -0,0 +1,37 @@
+// This program folds Power layers with power 1 into the Convolution or
+// InnerProduct layers computing their inputs, as Net::Init does at test time
+// with fold_affine set, and writes out the simplified net for inspection.
+// Usage:
+//    fold_net deploy.prototxt folded.prototxt
+//
+// The weights are left unchanged, so the folded net loads the same
+// caffemodel as the original one.
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: fold_net deploy.prototxt folded.prototxt";
+    return 1;
+  }
+  NetParameter param;
+  ReadNetParamsFromTextFileOrDie(string(argv[1]), &param);
+  param.mutable_state()->set_phase(TEST);
+  NetParameter filtered_param;
+  Net<float>::FilterNet(param, &filtered_param);
+  NetParameter folded_param;
+  Net<float>::FoldAffineLayers(filtered_param, &folded_param);
+  LOG(INFO) << "Folded " << filtered_param.layer_size() -
+      folded_param.layer_size() << " layers";
+  WriteProtoToTextFile(folded_param, argv[2]);
+  LOG(INFO) << "Wrote folded net to " << argv[2];
+  return 0;
+}
@@ -0,0 +1,389 @@
+// This program serves a net over a Unix-domain socket, batching concurrent
+// requests dynamically, and generates synthetic load to benchmark it.
+// Usage:
+//    inference_server serve -model deploy.prototxt -weights net.caffemodel
+//        [-output prob] [-socket path] [-max_latency_ms 5] [-gpu 0]
+//    inference_server load [-socket path] [-clients 8] [-requests 1000]
+//
+// The net must have a single input blob, whose num is the maximum batch
+// size. Each request is a single example: the client sends its size as a
+// uint32 then the float values, and receives the values of the output blob
+// for that example the same way. On connection, the server sends the
+// sizes of an input and an output example, as two uint32.
+#include <errno.h>
+#include <glog/logging.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "boost/thread.hpp"
+#include "caffe/caffe.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::Net;
+using caffe::shared_ptr;
+using caffe::string;
+using caffe::vector;
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+
+DEFINE_string(model, "",
+    "The model definition protocol buffer text file, with a single input.");
+DEFINE_string(weights, "",
+    "The trained weights.");
+DEFINE_string(output, "",
+    "The blob to serve; optional if the net has a single output.");
+DEFINE_int32(gpu, -1,
+    "Optional; run in GPU mode on the given device ID.");
+DEFINE_string(socket, "/tmp/caffe_inference.sock",
+    "The Unix-domain socket path to serve on or to connect to.");
+DEFINE_int32(max_latency_ms, 5,
+    "The longest time a request waits for others to fill a batch.");
+DEFINE_int32(report_seconds, 10,
+    "The interval between latency and throughput reports of the server.");
+DEFINE_int32(clients, 8,
+    "The number of concurrent clients generating load.");
+DEFINE_int32(requests, 1000,
+    "The number of requests sent by each client generating load.");
+
+// Returns false if the write failed, e.g. the peer disconnected.
+static bool write_all(int fd, const void* data, size_t bytes) {
+  const char* p = reinterpret_cast<const char*>(data);
+  while (bytes) {
+    ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    bytes -= n;
+  }
+  return true;
+}
+
+// Returns false if the connection was closed or failed before all bytes
+// were read.
+static bool read_all(int fd, void* data, size_t bytes) {
+  char* p = reinterpret_cast<char*>(data);
+  while (bytes) {
+    ssize_t n = recv(fd, p, bytes, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    bytes -= n;
+  }
+  return true;
+}
+
+static sockaddr_un socket_address(const string& path) {
+  sockaddr_un addr;
+  caffe::caffe_memset(sizeof(addr), 0, &addr);
+  addr.sun_family = AF_UNIX;
+  CHECK_LT(path.size(), sizeof(addr.sun_path)) << "Path too long: " << path;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return addr;
+}
+
+static double milliseconds(const ptime& from, const ptime& to) {
+  return (to - from).total_microseconds() / 1000.;
+}
+
+// Value at the given fraction of sorted values
+static double percentile(vector<double>* values, double fraction) {
+  if (values->empty()) {
+    return 0;
+  }
+  std::sort(values->begin(), values->end());
+  return (*values)[static_cast<size_t>(fraction * (values->size() - 1))];
+}
+
+// A single example to run, and its result
+class Request {
+ public:
+  explicit Request(int input_size)
+      : input(input_size), arrival(microsec_clock::universal_time()),
+        done_(false) {
+  }
+
+  void wait() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!done_) {
+      condition_.wait(lock);
+    }
+  }
+
+  void finish() {
+    boost::mutex::scoped_lock lock(mutex_);
+    done_ = true;
+    condition_.notify_one();
+  }
+
+  vector<float> input;
+  vector<float> output;
+  const ptime arrival;
+
+ protected:
+  bool done_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+};
+
+// Requests waiting to be batched
+class RequestQueue {
+ public:
+  void push(Request* request) {
+    boost::mutex::scoped_lock lock(mutex_);
+    queue_.push_back(request);
+    condition_.notify_one();
+  }
+
+  Request* pop() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.empty()) {
+      condition_.wait(lock);
+    }
+    Request* request = queue_.front();
+    queue_.pop_front();
+    return request;
+  }
+
+  // Returns NULL if no request arrived before the deadline.
+  Request* pop(const ptime& deadline) {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.empty()) {
+      if (!condition_.timed_wait(lock, deadline)) {
+        return NULL;
+      }
+    }
+    Request* request = queue_.front();
+    queue_.pop_front();
+    return request;
+  }
+
+ protected:
+  std::deque<Request*> queue_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+};
+
+// Reads requests from a client until it disconnects. Errors only close
+// the connection of that client.
+static void serve_client(int fd, RequestQueue* queue, uint32_t input_size,
+                         uint32_t output_size) {
+  uint32_t sizes[2] = {input_size, output_size};
+  bool connected = write_all(fd, sizes, sizeof(sizes));
+  uint32_t size;
+  while (connected && read_all(fd, &size, sizeof(size))) {
+    if (size != input_size) {
+      LOG(WARNING) << "Closing client " << fd << ": request of " << size
+          << " values instead of " << input_size;
+      break;
+    }
+    Request request(input_size);
+    if (!read_all(fd, &request.input[0], size * sizeof(float))) {
+      LOG(WARNING) << "Client " << fd << " disconnected during a request";
+      break;
+    }
+    queue->push(&request);
+    request.wait();
+    connected = write_all(fd, &output_size, sizeof(output_size)) &&
+        write_all(fd, &request.output[0], output_size * sizeof(float));
+    if (!connected) {
+      LOG(WARNING) << "Client " << fd << " disconnected before its result: "
+          << strerror(errno);
+    }
+  }
+  close(fd);
+}
+
+static void accept_clients(int listen_fd, RequestQueue* queue,
+                           uint32_t input_size, uint32_t output_size) {
+  while (true) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GE(fd, 0) << "Accept failed: " << strerror(errno);
+    boost::thread(serve_client, fd, queue, input_size, output_size).detach();
+  }
+}
+
+// Serve: run the net on batches of requests.
+int serve() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to serve.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to serve.";
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Net<float> net(FLAGS_model, caffe::TEST);
+  net.CopyTrainedLayersFrom(FLAGS_weights);
+  CHECK_EQ(net.input_blobs().size(), 1) << "The net must have one input.";
+  Blob<float>* input = net.input_blobs()[0];
+  Blob<float>* output;
+  if (FLAGS_output.size()) {
+    CHECK(net.has_blob(FLAGS_output)) << "Unknown blob " << FLAGS_output;
+    output = net.blob_by_name(FLAGS_output).get();
+  } else {
+    CHECK_EQ(net.output_blobs().size(), 1)
+        << "The net has several outputs, choose one with -output.";
+    output = net.output_blobs()[0];
+  }
+  vector<int> shape = input->shape();
+  const int max_batch = shape[0];
+  const uint32_t input_size = input->count(1);
+  const uint32_t output_size = output->count(1);
+  const boost::posix_time::milliseconds max_latency(FLAGS_max_latency_ms);
+
+  unlink(FLAGS_socket.c_str());
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECK_GE(listen_fd, 0) << "Cannot create socket: " << strerror(errno);
+  sockaddr_un addr = socket_address(FLAGS_socket);
+  CHECK_EQ(bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+           0) << "Cannot bind " << FLAGS_socket << ": " << strerror(errno);
+  CHECK_EQ(listen(listen_fd, SOMAXCONN), 0) << strerror(errno);
+  RequestQueue queue;
+  boost::thread acceptor(accept_clients, listen_fd, &queue, input_size,
+                         output_size);
+  LOG(INFO) << "Serving on " << FLAGS_socket << ", batches of up to "
+      << max_batch << ", waiting at most " << FLAGS_max_latency_ms << " ms";
+
+  vector<double> latencies;
+  int batches = 0;
+  ptime report_start = microsec_clock::universal_time();
+  vector<Request*> batch;
+  while (true) {
+    // Wait for a request, then for others until the batch is full or the
+    // first one has waited long enough.
+    batch.clear();
+    batch.push_back(queue.pop());
+    const ptime deadline = batch[0]->arrival + max_latency;
+    while (batch.size() < max_batch) {
+      Request* request = queue.pop(deadline);
+      if (!request) {
+        break;
+      }
+      batch.push_back(request);
+    }
+    if (shape[0] != batch.size()) {
+      shape[0] = batch.size();
+      input->Reshape(shape);
+      net.Reshape();
+    }
+    float* input_data = input->mutable_cpu_data();
+    for (int i = 0; i < batch.size(); ++i) {
+      caffe::caffe_copy<float>(input_size, &batch[i]->input[0],
+                               input_data + i * input_size);
+    }
+    net.ForwardPrefilled();
+    const float* output_data = output->cpu_data();
+    const ptime now = microsec_clock::universal_time();
+    for (int i = 0; i < batch.size(); ++i) {
+      batch[i]->output.assign(output_data + i * output_size,
+                              output_data + (i + 1) * output_size);
+      latencies.push_back(milliseconds(batch[i]->arrival, now));
+      batch[i]->finish();
+    }
+    ++batches;
+
+    const double elapsed = milliseconds(report_start, now) / 1000;
+    if (elapsed >= FLAGS_report_seconds) {
+      const int requests = latencies.size();
+      LOG(INFO) << requests / elapsed << " requests/s, mean batch "
+          << static_cast<double>(requests) / batches << ", latency p50 "
+          << percentile(&latencies, 0.5) << " ms, p99 "
+          << percentile(&latencies, 0.99) << " ms";
+      latencies.clear();
+      batches = 0;
+      report_start = now;
+    }
+  }
+  return 0;
+}
+
+// Sends requests of random values one after the other.
+static void generate_load(vector<double>* latencies) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECK_GE(fd, 0) << "Cannot create socket: " << strerror(errno);
+  sockaddr_un addr = socket_address(FLAGS_socket);
+  CHECK_EQ(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0)
+      << "Cannot connect to " << FLAGS_socket << ": " << strerror(errno);
+  uint32_t sizes[2];
+  CHECK(read_all(fd, sizes, sizeof(sizes))) << "Connection closed";
+  vector<float> input(sizes[0]);
+  vector<float> output(sizes[1]);
+  for (int i = 0; i < FLAGS_requests; ++i) {
+    caffe::caffe_rng_uniform<float>(input.size(), 0, 1, &input[0]);
+    const ptime start = microsec_clock::universal_time();
+    CHECK(write_all(fd, &sizes[0], sizeof(sizes[0])) &&
+          write_all(fd, &input[0], input.size() * sizeof(float)))
+        << "Socket write failed: " << strerror(errno);
+    uint32_t size;
+    CHECK(read_all(fd, &size, sizeof(size))) << "Connection closed";
+    CHECK_EQ(size, output.size());
+    CHECK(read_all(fd, &output[0], size * sizeof(float)))
+        << "Connection closed";
+    latencies->push_back(milliseconds(start,
+                                      microsec_clock::universal_time()));
+  }
+  close(fd);
+}
+
+// Load: benchmark a running server with concurrent clients.
+int load() {
+  vector<vector<double> > latencies(FLAGS_clients);
+  const ptime start = microsec_clock::universal_time();
+  boost::thread_group clients;
+  for (int i = 0; i < FLAGS_clients; ++i) {
+    clients.create_thread(boost::bind(generate_load, &latencies[i]));
+  }
+  clients.join_all();
+  const double elapsed =
+      milliseconds(start, microsec_clock::universal_time()) / 1000;
+  vector<double> all;
+  for (int i = 0; i < latencies.size(); ++i) {
+    all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+  }
+  LOG(INFO) << FLAGS_clients << " clients sent " << all.size()
+      << " requests in " << elapsed << " s: " << all.size() / elapsed
+      << " requests/s, latency p50 " << percentile(&all, 0.5)
+      << " ms, p99 " << percentile(&all, 0.99) << " ms";
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  // Print output to stderr (while still logging).
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("serve a net with dynamic batching\n"
+      "usage: inference_server <command> <args>\n\n"
+      "commands:\n"
+      "  serve           serve a model on a Unix-domain socket\n"
+      "  load            generate load on a running server");
+  caffe::GlobalInit(&argc, &argv);
+  if (argc == 2 && string(argv[1]) == "serve") {
+    return serve();
+  } else if (argc == 2 && string(argv[1]) == "load") {
+    return load();
+  }
+  gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/inference_server");
+  return 1;
+}
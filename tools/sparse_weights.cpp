@@ -0,0 +1,196 @@
+// This program stores the weights of pruned models sparsely, and measures
+// the weight density below which sparse products beat dense gemm.
+// Usage:
+//    sparse_weights convert in.caffemodel out.caffemodel [-threshold 0]
+//    sparse_weights benchmark [-rows 1024] [-cols 1024] [-columns 64]
+//
+// Blobs with at most half non-zero values are stored as values and indices,
+// which Blob::FromProto reads back. With a threshold, weights of
+// InnerProduct and Convolution layers at most that large in absolute value
+// are pruned first. At test time on the CPU, these layers multiply by
+// weights sparser than sparse_max_density() without their zeros.
+#include <glog/logging.h>
+
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/bind.hpp"
+#include "caffe/caffe.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/sparse_matrix.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using caffe::BlobProto;
+using caffe::CPUTimer;
+using caffe::NetParameter;
+using caffe::SparseMatrix;
+using caffe::string;
+using caffe::vector;
+
+DEFINE_double(threshold, 0,
+    "Prune InnerProduct and Convolution weights with an absolute value at "
+    "most this large.");
+DEFINE_int32(rows, 1024,
+    "Benchmark: the number of weight rows, i.e. outputs.");
+DEFINE_int32(cols, 1024,
+    "Benchmark: the number of weight columns, i.e. inputs per output.");
+DEFINE_int32(columns, 64,
+    "Benchmark: the number of columns multiplied, the batch size of an inner "
+    "product or the output size of a convolution.");
+DEFINE_int32(iterations, 10,
+    "Benchmark: the number of timed products per measure.");
+
+static int prune(BlobProto* blob) {
+  int pruned = 0;
+  for (int i = 0; i < blob->data_size(); ++i) {
+    if (blob->data(i) != 0 && std::fabs(blob->data(i)) <= FLAGS_threshold) {
+      blob->set_data(i, 0);
+      ++pruned;
+    }
+  }
+  for (int i = 0; i < blob->double_data_size(); ++i) {
+    if (blob->double_data(i) != 0 &&
+        std::fabs(blob->double_data(i)) <= FLAGS_threshold) {
+      blob->set_double_data(i, 0);
+      ++pruned;
+    }
+  }
+  return pruned;
+}
+
+int convert(const string& input, const string& output) {
+  NetParameter param;
+  caffe::ReadNetParamsFromBinaryFileOrDie(input, &param);
+  const int dense_size = param.ByteSize();
+  for (int i = 0; i < param.layer_size(); ++i) {
+    caffe::LayerParameter* layer = param.mutable_layer(i);
+    if (!layer->blobs_size()) {
+      continue;
+    }
+    if (FLAGS_threshold > 0 && (layer->type() == "InnerProduct" ||
+        layer->type() == "Convolution")) {
+      LOG(INFO) << "Pruned " << prune(layer->mutable_blobs(0))
+          << " weights of " << layer->name();
+    }
+    for (int j = 0; j < layer->blobs_size(); ++j) {
+      caffe::SparsifyBlobProto(layer->mutable_blobs(j));
+    }
+  }
+  caffe::WriteProtoToBinaryFile(param, output);
+  LOG(INFO) << "Wrote " << output << ", " << param.ByteSize() << " bytes "
+      << "instead of " << dense_size;
+  return 0;
+}
+
+// Average time of iterations calls in ms
+template <typename F>
+static float time_ms(F f) {
+  CPUTimer timer;
+  f();  // Warm up
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    f();
+  }
+  timer.Stop();
+  return timer.MicroSeconds() / 1000 / FLAGS_iterations;
+}
+
+// The products the layers run: convolution weights times columns, and
+// inner product inputs times transposed weights
+struct Products {
+  int rows, cols, columns;
+  const float* dense;
+  const SparseMatrix<float>* sparse;
+  const float* input;
+  float* output;
+  bool transposed;
+
+  void Dense() const {
+    if (transposed) {
+      caffe::caffe_cpu_gemm<float>(CblasNoTrans, CblasTrans, columns, rows,
+          cols, 1, input, dense, 0, output);
+    } else {
+      caffe::caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, rows, columns,
+          cols, 1, dense, input, 0, output);
+    }
+  }
+  void Sparse() const {
+    if (transposed) {
+      sparse->GemmTransposed(columns, input, output);
+    } else {
+      sparse->Gemm(columns, input, output);
+    }
+  }
+};
+
+int benchmark() {
+  const int rows = FLAGS_rows;
+  const int cols = FLAGS_cols;
+  const int columns = FLAGS_columns;
+  vector<float> weights(rows * cols);
+  vector<float> keep(rows * cols);
+  vector<float> input(cols * columns);
+  vector<float> output(rows * columns);
+  caffe::caffe_rng_gaussian<float>(input.size(), 0, 1, &input[0]);
+  caffe::caffe_rng_uniform<float>(keep.size(), 0, 1, &keep[0]);
+  const double densities[] = {1, 0.7, 0.5, 0.4, 0.3, 0.2, 0.15, 0.1, 0.05,
+      0.02, 0.01};
+  const char* names[] = {"conv", "inner product"};
+  LOG(INFO) << "Weights " << rows << " x " << cols << ", " << columns
+      << " columns, times in ms";
+  LOG(INFO) << "density  conv dense/sparse  inner product dense/sparse";
+  double crossover[] = {0, 0};
+  for (int d = 0; d < sizeof(densities) / sizeof(densities[0]); ++d) {
+    for (int i = 0; i < weights.size(); ++i) {
+      weights[i] = keep[i] < densities[d] ? 1 - 2 * keep[i] : 0;
+    }
+    SparseMatrix<float> sparse;
+    sparse.FromDense(rows, cols, &weights[0]);
+    std::ostringstream line;
+    line << densities[d];
+    for (int t = 0; t < 2; ++t) {
+      const Products products = {rows, cols, columns, &weights[0], &sparse,
+          &input[0], &output[0], t == 1};
+      const float dense_ms = time_ms(
+          boost::bind(&Products::Dense, &products));
+      const float sparse_ms = time_ms(
+          boost::bind(&Products::Sparse, &products));
+      line << "  " << dense_ms << " / " << sparse_ms;
+      // The highest density from which sparse wins at all lower ones
+      if (sparse_ms >= dense_ms) {
+        crossover[t] = 0;
+      } else if (!crossover[t]) {
+        crossover[t] = densities[d];
+      }
+    }
+    LOG(INFO) << line.str();
+  }
+  for (int t = 0; t < 2; ++t) {
+    LOG(INFO) << "Sparse " << names[t] << " wins from density "
+        << crossover[t] << ", sparse_max_density() is "
+        << caffe::sparse_max_density();
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  // Print output to stderr (while still logging).
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("store pruned weights sparsely\n"
+      "usage: sparse_weights <command> <args>\n\n"
+      "commands:\n"
+      "  convert         convert in.caffemodel to sparse out.caffemodel\n"
+      "  benchmark       time sparse and dense products by weight density");
+  caffe::GlobalInit(&argc, &argv);
+  if (argc == 4 && string(argv[1]) == "convert") {
+    return convert(argv[2], argv[3]);
+  } else if (argc == 2 && string(argv[1]) == "benchmark") {
+    return benchmark();
+  }
+  gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/sparse_weights");
+  return 1;
+}